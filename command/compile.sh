@@ -14,7 +14,7 @@ fi
 BIN="prog_pipe"
 CFLAGS="-m32 -Wall -c -fno-builtin -W -Wstrict-prototypes -Wmissing-prototypes -Wsystem-headers"
 LIB="-I ../lib/ -I ../lib/kernel/ -I ../lib/user/ -I ../kernel/ -I ../device/ -I ../thread/ -I ../userprog/ -I ../fs/ -I ../shell/"
-OBJS="../build/string.o ../build/syscall.o ../build/stdio.o ../build/assert.o start.o"
+OBJS="../build/string.o ../build/syscall.o ../build/stdio.o ../build/assert.o ../build/mutex.o ../build/uthread.o start.o"
 DD_IN=$BIN
 DD_OUT="/usr/local/bochs/hd60M.img" 
 
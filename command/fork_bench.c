@@ -0,0 +1,62 @@
+/* fork + exit 微基准: 反复 fork 一个立即退出的子进程并 wait 回收它, 测出每轮的平均耗时.
+   用法: fork_bench [轮数], 默认 1000 轮. 编译时把 compile.sh 中的 BIN 改为 fork_bench */
+#include "stdio.h"
+#include "syscall.h"
+#include "string.h"
+
+#define DEFAULT_ROUNDS 1000
+
+/* 把十进制字符串转换成整数, 遇到非数字字符即停止 */
+static uint32_t str2uint(const char* str) {
+    uint32_t val = 0;
+    while (*str >= '0' && *str <= '9') {
+        val = val * 10 + (*str - '0');
+        str++;
+    }
+    return val;
+}
+
+/* 从 start 到 end 经过的微秒数 */
+static uint32_t elapsed_us(const struct timespec* start, const struct timespec* end) {
+    uint32_t sec = end->tv_sec - start->tv_sec;
+    if (end->tv_nsec < start->tv_nsec) {
+        return (sec - 1) * 1000000 + (end->tv_nsec + 1000000000 - start->tv_nsec) / 1000;
+    }
+    return sec * 1000000 + (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+int main(int argc, char** argv) {
+    uint32_t rounds = DEFAULT_ROUNDS;
+    if (argc > 1) {
+        rounds = str2uint(argv[1]);
+        if (rounds == 0) {
+            printf("usage: %s [rounds]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint32_t done = 0;
+    while (done < rounds) {
+        int16_t pid = fork();
+        if (pid == 0) {
+            exit(0);
+        }
+        if (pid < 0) {
+            printf("fork failed after %d rounds\n", done);
+            break;
+        }
+        int32_t status;
+        wait(&status);
+        done++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (done == 0) {
+        return 1;
+    }
+    uint32_t total_us = elapsed_us(&start, &end);
+    printf("fork+exit+wait: %d rounds in %d us, %d us per round\n", done, total_us, total_us / done);
+    return 0;
+}
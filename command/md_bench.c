@@ -0,0 +1,188 @@
+/* md 设备的组建和吞吐量基准. 编译时把 compile.sh 中的 BIN 改为 md_bench.
+   用法: md_bench create raid0 <条带KB> <分区> <分区> [...]  组建 RAID0 设备, 打印设备名
+         md_bench create raid1 <分区> <分区> [...]          组建 RAID1 设备, 分区可写成 missing
+         md_bench [-w] [-m MB] [-j N] <设备> [<设备> ...]
+             依次顺序读(-w 时为写)各设备的前 MB 兆字节, 默认 16MB.
+             -j 时由 N 个子进程同时读写, 各自负责相邻的 MB 兆字节, 打印总的吞吐量
+   例如 "md_bench create raid0 64 sdb5 sdd1" 后, 用 "md_bench sdb5 md0" 比较单盘和条带设备的吞吐量;
+   "md_bench create raid1 sdb5 sdd1" 后, 用 "md_bench -j 2 sdb5 md1" 比较两个读者时单盘和镜像的吞吐量.
+   -w 会覆盖设备上的数据, 已挂载的分区和 md 成员不允许直接写 */
+#include "stdio.h"
+#include "syscall.h"
+#include "string.h"
+
+#define DEFAULT_MB 16
+#define MAX_JOBS 8
+#define IO_SECTORS 512             // 每次 blkio 读写 256KB, 能跨越多个条带
+
+/* 把十进制字符串转换成整数, 遇到非数字字符即停止 */
+static uint32_t str2uint(const char* str) {
+    uint32_t val = 0;
+    while (*str >= '0' && *str <= '9') {
+        val = val * 10 + (*str - '0');
+        str++;
+    }
+    return val;
+}
+
+/* 从 start 到 end 经过的微秒数 */
+static uint32_t elapsed_us(const struct timespec* start, const struct timespec* end) {
+    uint32_t sec = end->tv_sec - start->tv_sec;
+    if (end->tv_nsec < start->tv_nsec) {
+        return (sec - 1) * 1000000 + (end->tv_nsec + 1000000000 - start->tv_nsec) / 1000;
+    }
+    return sec * 1000000 + (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+static void usage(const char* prog) {
+    printf("usage: %s create raid0 <chunk_kb> <part> <part> [...]\n", prog);
+    printf("       %s create raid1 <part|missing> <part|missing> [...]\n", prog);
+    printf("       %s [-w] [-m MB] [-j N] <dev> [<dev> ...]\n", prog);
+}
+
+/* 组建 md 设备, argv 从级别开始 */
+static int md_bench_create(int argc, char** argv) {
+    struct md_config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    int arg_idx = 1;
+    if (!strcmp(argv[0], "raid0")) {
+        cfg.level = MD_RAID0;
+        cfg.chunk_sects = str2uint(argv[arg_idx++]) * 2;
+        if (cfg.chunk_sects == 0) {
+            printf("bad chunk size %s\n", argv[1]);
+            return 1;
+        }
+    } else if (!strcmp(argv[0], "raid1")) {
+        cfg.level = MD_RAID1;
+    } else {
+        printf("unknown level %s\n", argv[0]);
+        return 1;
+    }
+    cfg.member_cnt = argc - arg_idx;
+    if (cfg.member_cnt < 2 || cfg.member_cnt > MD_MAX_MEMBERS) {
+        printf("need 2 to %d member partitions\n", MD_MAX_MEMBERS);
+        return 1;
+    }
+    uint32_t idx;
+    for (idx = 0; idx < cfg.member_cnt; idx++) {
+        if (strlen(argv[arg_idx + idx]) >= sizeof(cfg.members[idx])) {
+            printf("bad partition name %s\n", argv[arg_idx + idx]);
+            return 1;
+        }
+        strcpy(cfg.members[idx], argv[arg_idx + idx]);
+    }
+    int32_t md_no = md_create(&cfg);
+    if (md_no == -1) {
+        printf("md_create failed\n");
+        return 1;
+    }
+    printf("md%d created\n", md_no);
+    return 0;
+}
+
+/* 顺序读写设备 dev 从第 start_mb 兆字节起的 mb 兆字节, 成功返回 0 */
+static int md_bench_io(const char* dev, uint32_t start_mb, uint32_t mb, bool is_write, void* buf) {
+    struct blkio io;
+    strcpy(io.dev, dev);
+    io.sec_cnt = IO_SECTORS;
+    io.buf = buf;
+    io.is_write = is_write;
+
+    uint32_t end_lba = (start_mb + mb) * 2048;
+    for (io.lba = start_mb * 2048; io.lba < end_lba; io.lba += IO_SECTORS) {
+        if (blkio(&io) == -1) {
+            printf("%s: blkio at sector %d failed\n", dev, io.lba);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* 由 jobs 个进程同时读写设备 dev, 每个进程负责 mb 兆字节, 打印总耗时和总吞吐量.
+   jobs 为 1 时在本进程中读写 */
+static int md_bench_run(const char* dev, uint32_t mb, uint32_t jobs, bool is_write, void* buf) {
+    struct timespec start, end;
+    int ret = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (jobs == 1) {
+        ret = md_bench_io(dev, 0, mb, is_write, buf);
+    } else {
+        uint32_t job, started = 0;
+        for (job = 0; job < jobs; job++) {
+            int16_t pid = fork();
+            if (pid == 0) {
+                exit(md_bench_io(dev, job * mb, mb, is_write, buf));
+            }
+            if (pid < 0) {
+                printf("fork failed\n");
+                ret = 1;
+                break;
+            }
+            started++;
+        }
+        while (started-- > 0) {
+            int32_t status;
+            wait(&status);
+            ret |= status;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (ret != 0) {
+        return 1;
+    }
+
+    uint32_t ms = elapsed_us(&start, &end) / 1000;
+    if (ms == 0) {
+        ms = 1;
+    }
+    uint32_t total_mb = mb * jobs;
+    printf("%s: %d job(s) %s %dMB in %d ms, %d KB/s\n", dev, jobs, is_write ? "wrote" : "read",
+           total_mb, ms, total_mb * 1024 * 1000 / ms);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && !strcmp(argv[1], "create")) {
+        if (argc < 5) {
+            usage(argv[0]);
+            return 1;
+        }
+        return md_bench_create(argc - 2, argv + 2);
+    }
+
+    bool is_write = false;
+    uint32_t mb = DEFAULT_MB;
+    uint32_t jobs = 1;
+    int arg_idx = 1;
+    while (arg_idx < argc && argv[arg_idx][0] == '-') {
+        if (!strcmp(argv[arg_idx], "-w")) {
+            is_write = true;
+        } else if (!strcmp(argv[arg_idx], "-m") && arg_idx + 1 < argc) {
+            mb = str2uint(argv[++arg_idx]);
+        } else if (!strcmp(argv[arg_idx], "-j") && arg_idx + 1 < argc) {
+            jobs = str2uint(argv[++arg_idx]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+        arg_idx++;
+    }
+    if (arg_idx == argc || mb == 0 || jobs == 0 || jobs > MAX_JOBS) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    void* buf = malloc(IO_SECTORS * 512);
+    if (buf == NULL) {
+        printf("out of memory\n");
+        return 1;
+    }
+    memset(buf, 0x5a, IO_SECTORS * 512);
+    int ret = 0;
+    while (arg_idx < argc) {
+        ret |= md_bench_run(argv[arg_idx], mb, jobs, is_write, buf);
+        arg_idx++;
+    }
+    free(buf);
+    return ret;
+}
@@ -0,0 +1,67 @@
+/* 系统调用往返微基准: 分别用 getpid 的库函数(cpu 支持时走 sysenter)和直接 int 0x80 反复调用, 比较每次的平均耗时.
+   用法: syscall_bench [次数], 默认 100000 次. 编译时把 compile.sh 中的 BIN 改为 syscall_bench */
+#include "stdio.h"
+#include "syscall.h"
+#include "string.h"
+
+#define DEFAULT_CALLS 100000
+
+/* 把十进制字符串转换成整数, 遇到非数字字符即停止 */
+static uint32_t str2uint(const char* str) {
+    uint32_t val = 0;
+    while (*str >= '0' && *str <= '9') {
+        val = val * 10 + (*str - '0');
+        str++;
+    }
+    return val;
+}
+
+/* 从 start 到 end 经过的微秒数 */
+static uint32_t elapsed_us(const struct timespec* start, const struct timespec* end) {
+    uint32_t sec = end->tv_sec - start->tv_sec;
+    if (end->tv_nsec < start->tv_nsec) {
+        return (sec - 1) * 1000000 + (end->tv_nsec + 1000000000 - start->tv_nsec) / 1000;
+    }
+    return sec * 1000000 + (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+/* 绕过库函数, 总是用 int 0x80 发起 getpid */
+static int32_t getpid_int80(void) {
+    int32_t retval;
+    asm volatile ("int $0x80" : "=a" (retval) : "a" (SYS_GETPID) : "memory");
+    return retval;
+}
+
+/* 打印 calls 次调用共耗时 total_us 微秒时的平均耗时, 单位为纳秒 */
+static void report(const char* name, uint32_t calls, uint32_t total_us) {
+    uint32_t ns_per_call = total_us / calls * 1000 + total_us % calls * 1000 / calls;
+    printf("%s: %d calls in %d us, %d ns per call\n", name, calls, total_us, ns_per_call);
+}
+
+int main(int argc, char** argv) {
+    uint32_t calls = DEFAULT_CALLS;
+    if (argc > 1) {
+        calls = str2uint(argv[1]);
+        if (calls == 0) {
+            printf("usage: %s [calls]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    struct timespec start, end;
+    uint32_t i;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < calls; i++) {
+        getpid();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report("getpid (library)", calls, elapsed_us(&start, &end));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < calls; i++) {
+        getpid_int80();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report("getpid (int 0x80)", calls, elapsed_us(&start, &end));
+    return 0;
+}
@@ -0,0 +1,104 @@
+/* 用异步队列实现的 ls -l: 每读出一批目录项, 就把它们的 stat 一次提交给内核, 一次陷入取回全部结果.
+   用法: uring_ls 绝对路径. 编译时把 compile.sh 中的 BIN 改为 uring_ls */
+#include "stdio.h"
+#include "syscall.h"
+#include "string.h"
+#include "dir.h"
+
+#define BATCH 32                   // 每批提交的 stat 个数, 不超过队列项数
+
+struct entry {
+    char path[MAX_PATH_LEN];
+    char filename[MAX_FILE_NAME_LEN];
+    uint32_t i_no;
+    enum file_types f_type;
+    struct stat st;
+};
+
+/* 取一个空闲的提交项, 调用者保证提交队列不满 */
+static struct uring_sqe* get_sqe(struct uring* ring) {
+    struct uring_sqe* sqe = &ring->sqes[ring->sq_tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(struct uring_sqe));
+    return sqe;
+}
+
+/* 提交本批的 nr 个 stat, 等全部完成后打印, 返回失败的个数 */
+static uint32_t stat_batch(struct uring* ring, struct entry* ents, uint32_t nr) {
+    uint32_t i;
+    for (i = 0; i < nr; i++) {
+        struct uring_sqe* sqe = get_sqe(ring);
+        sqe->opcode = URING_OP_STAT;
+        sqe->addr = ents[i].path;
+        sqe->addr2 = &ents[i].st;
+        sqe->user_data = i;
+        ring->sq_tail++;
+    }
+    uring_enter(nr, nr);
+
+    uint32_t failed = 0;
+    bool ok[BATCH];
+    while (ring->cq_head != ring->cq_tail) {
+        struct uring_cqe* cqe = &ring->cqes[ring->cq_head & ring->cq_mask];
+        ok[cqe->user_data] = cqe->res != -1;
+        ring->cq_head++;
+    }
+    for (i = 0; i < nr; i++) {
+        if (!ok[i]) {
+            printf("uring_ls: cannot access %s\n", ents[i].filename);
+            failed++;
+            continue;
+        }
+        char ftype = ents[i].f_type == FT_REGULAR ? '-' : 'd';
+        printf("%c  %d  %d  %s\n", ftype, ents[i].i_no, ents[i].st.st_size, ents[i].filename);
+    }
+    return failed;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 2 || argv[1][0] != '/') {
+        printf("usage: %s absolute_path\n", argv[0]);
+        return 1;
+    }
+    char* pathname = argv[1];
+    uint32_t pathname_len = strlen(pathname);
+    if (pathname_len + MAX_FILE_NAME_LEN + 1 >= MAX_PATH_LEN) {
+        printf("uring_ls: path too long\n");
+        return 1;
+    }
+    struct dir* dir = opendir(pathname);
+    if (dir == NULL) {
+        printf("uring_ls: cannot open %s\n", pathname);
+        return 1;
+    }
+    struct uring* ring = uring_setup(BATCH);
+    struct entry* ents = malloc(sizeof(struct entry) * BATCH);
+    if (ring == NULL || ents == NULL) {
+        printf("uring_ls: out of memory\n");
+        closedir(dir);
+        return 1;
+    }
+
+    uint32_t nr = 0, failed = 0;
+    struct dir_entry* dir_e;
+    while ((dir_e = readdir(dir)) != NULL) {
+        struct entry* e = &ents[nr++];
+        strcpy(e->path, pathname);
+        if (pathname[pathname_len - 1] != '/') {
+            strcat(e->path, "/");
+        }
+        strcat(e->path, dir_e->filename);
+        strcpy(e->filename, dir_e->filename);
+        e->i_no = dir_e->i_no;
+        e->f_type = dir_e->f_type;
+        if (nr == BATCH) {
+            failed += stat_batch(ring, ents, nr);
+            nr = 0;
+        }
+    }
+    if (nr > 0) {
+        failed += stat_batch(ring, ents, nr);
+    }
+    closedir(dir);
+    free(ents);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+#include "blk.h"
+#include "global.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "thread.h"
+#include "process.h"
+#include "stdio.h"
+#include "kernel/stdio-kernel.h"
+
+#define BLK_DISPATCHER_PRIO 31     // 与工作线程相同, 使请求能及时发给硬盘
+
+/* 分派线程在 pgdir 所在的地址空间中访问请求的缓冲区, pgdir 为 NULL 时回到内核地址空间.
+   调度时会按 pgdir 重新装入页表, 所以切换期间被换下 cpu 也不要紧 */
+static void use_pgdir(uint32_t* pgdir) {
+    struct task_struct* cur = running_thread();
+    if (cur->pgdir == pgdir) {
+        return;
+    }
+    enum intr_status old_status = intr_disable();
+    cur->pgdir = pgdir;
+    page_dir_activate(cur);
+    intr_set_status(old_status);
+}
+
+/* 按 C-LOOK 取出下一条要执行的请求, 并把紧随其后、方向和地址空间都相同的请求合并进来.
+   取出的请求放在 q->batch 中, 返回其个数. 调用者须持有 q->lock 且队列不为空 */
+static uint32_t pick_batch(struct blk_queue* q) {
+    /* 从磁头位置向上找第一个请求, 找不到就回到 lba 最小的请求 */
+    struct list_elem* elem = q->requests.head.next;
+    while (elem != &q->requests.tail &&
+           (elem2entry(struct blk_request, queue_tag, elem))->lba < q->head_pos) {
+        elem = elem->next;
+    }
+    if (elem == &q->requests.tail) {
+        elem = q->requests.head.next;
+    }
+
+    struct blk_request* first = elem2entry(struct blk_request, queue_tag, elem);
+    uint32_t cnt = 0, sec_cnt = 0;
+    while (1) {
+        struct blk_request* req = elem2entry(struct blk_request, queue_tag, elem);
+        elem = elem->next;
+        list_remove(&req->queue_tag);
+        q->batch[cnt++] = req;
+        sec_cnt += req->sec_cnt;
+        if (elem == &q->requests.tail || cnt == BLK_MAX_SEGS) {
+            break;
+        }
+        struct blk_request* next = elem2entry(struct blk_request, queue_tag, elem);
+        if (next->lba != first->lba + sec_cnt || next->is_write != first->is_write ||
+            next->pgdir != first->pgdir || sec_cnt + next->sec_cnt > IDE_MAX_SECTORS) {
+            break;
+        }
+    }
+    return cnt;
+}
+
+/* 分派线程: 每次取出一批请求, 用一条命令完成后再唤醒各个提交者. 队列为空时阻塞 */
+static void blk_dispatcher(void* arg) {
+    struct blk_queue* q = arg;
+    while (1) {
+        enum intr_status old_status = spin_lock_irqsave(&q->lock);
+        while (list_empty(&q->requests)) {
+            /* 先置为阻塞态再放锁, 此后提交的请求一定能看到 idle 并唤醒自己 */
+            q->idle = true;
+            running_thread()->status = TASK_BLOCKED;
+            spin_unlock(&q->lock);
+            schedule();
+            spin_lock(&q->lock);
+        }
+        uint32_t cnt = pick_batch(q);
+        spin_unlock_irqrestore(&q->lock, old_status);
+
+        struct blk_request* first = q->batch[0];
+        bool ok;
+        use_pgdir(first->pgdir);
+        if (cnt == 1) {
+            /* 单个请求可能超过一条命令的上限, 交给驱动去拆分 */
+            if (first->is_write) {
+                ok = ide_write(q->hd, first->lba, first->buf, first->sec_cnt);
+            } else {
+                ok = ide_read(q->hd, first->lba, first->buf, first->sec_cnt);
+            }
+        } else {
+            uint32_t idx;
+            for (idx = 0; idx < cnt; idx++) {
+                q->segs[idx].buf = q->batch[idx]->buf;
+                q->segs[idx].sec_cnt = q->batch[idx]->sec_cnt;
+            }
+            ok = ide_rw_segs(q->hd, first->lba, q->segs, cnt, first->is_write);
+        }
+        use_pgdir(NULL);
+
+        struct blk_request* last = q->batch[cnt - 1];
+        q->head_pos = last->lba + last->sec_cnt;
+        old_status = spin_lock_irqsave(&q->lock);
+        q->in_flight -= cnt;
+        spin_unlock_irqrestore(&q->lock, old_status);
+        /* 合并在一起的请求同成败. 通知之后请求可能已被提交者释放, 不能再访问 */
+        while (cnt > 0) {
+            struct blk_request* req = q->batch[--cnt];
+            req->error = (ok ? 0 : -1);
+            if (req->end_io != NULL) {
+                req->end_io(req);
+            } else {
+                sema_up(&req->done);
+            }
+        }
+    }
+}
+
+/* 初始化读写请求 req, 不设完成回调. 需要回调时在提交前设置 req->end_io */
+void blk_request_init(struct blk_request* req, struct disk* hd, uint32_t lba, void* buf,
+                      uint32_t sec_cnt, bool is_write) {
+    req->hd = hd;
+    req->lba = lba;
+    req->sec_cnt = sec_cnt;
+    req->buf = buf;
+    req->is_write = is_write;
+    req->end_io = NULL;
+    req->private = NULL;
+    req->error = 0;
+}
+
+/* 为 cnt 个请求分配内核页. 请求会被分派线程和其他提交者访问, 不能像 sys_malloc 那样
+   在用户进程中分配到进程自己的堆里. 失败返回 NULL */
+struct blk_request* blk_alloc_requests(uint32_t cnt) {
+    return get_kernel_pages(DIV_ROUND_UP(cnt * sizeof(struct blk_request), PG_SIZE));
+}
+
+/* 释放 blk_alloc_requests 分配的 cnt 个请求 */
+void blk_free_requests(struct blk_request* reqs, uint32_t cnt) {
+    mfree_page(PF_KERNEL, reqs, DIV_ROUND_UP(cnt * sizeof(struct blk_request), PG_SIZE));
+}
+
+/* 异步提交请求 req: 按 lba 插入所在硬盘的队列, 必要时唤醒分派线程, 不等待完成 */
+void blk_submit(struct blk_request* req) {
+    struct blk_queue* q = req->hd->queue;
+    ASSERT(q != NULL && req->sec_cnt > 0);
+    ASSERT((uint32_t)req >= 0xc0000000);  // 请求须在内核内存中, 见 struct blk_request
+    req->pgdir = running_thread()->pgdir;
+    sema_init(&req->done, 0);
+
+    enum intr_status old_status = spin_lock_irqsave(&q->lock);
+    /* 插在第一个 lba 更大的请求之前, lba 相同的保持提交顺序 */
+    struct list_elem* elem = q->requests.head.next;
+    while (elem != &q->requests.tail &&
+           (elem2entry(struct blk_request, queue_tag, elem))->lba <= req->lba) {
+        elem = elem->next;
+    }
+    list_insert_before(elem, &req->queue_tag);
+    q->in_flight++;
+    if (q->idle) {
+        q->idle = false;
+        thread_unblock(q->dispatcher);
+    }
+    spin_unlock_irqrestore(&q->lock, old_status);
+}
+
+/* 阻塞到 req 完成, 等待的时间计入当前任务的 blocked_disk. req 不能设置了 end_io */
+void blk_wait(struct blk_request* req) {
+    ASSERT(req->end_io == NULL);
+    struct task_struct* cur = running_thread();
+    cur->block_reason = BLOCK_DISK;
+    sema_down(&req->done);
+    cur->block_reason = BLOCK_OTHER;
+}
+
+/* 等待 reqs 中的 cnt 个请求全部完成. 它们已一起提交, 所以总的等待时间取决于最慢的一个 */
+void blk_wait_all(struct blk_request* reqs, uint32_t cnt) {
+    uint32_t idx;
+    for (idx = 0; idx < cnt; idx++) {
+        blk_wait(&reqs[idx]);
+    }
+}
+
+/* 经请求队列读写硬盘, 阻塞到完成, 返回请求的 error */
+int32_t blk_rw(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt, bool is_write) {
+    struct blk_request req;
+    blk_request_init(&req, hd, lba, buf, sec_cnt, is_write);
+    blk_submit(&req);
+    blk_wait(&req);
+    return req.error;
+}
+
+/* 经请求队列从硬盘读取 sec_cnt 个扇区到 buf, 阻塞到读完.
+   文件系统无法处理读写错误, 所以出错时停机 */
+void blk_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    if (blk_rw(hd, lba, buf, sec_cnt, false) != 0) {
+        char error[64];
+        sprintf(error, "%s read sector %d failed!\n", hd->name, lba);
+        PANIC(error);
+    }
+}
+
+/* 经请求队列将 buf 中 sec_cnt 个扇区写入硬盘, 阻塞到写完. 出错时停机, 同 blk_read */
+void blk_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    if (blk_rw(hd, lba, buf, sec_cnt, true) != 0) {
+        char error[64];
+        sprintf(error, "%s write sector %d failed!\n", hd->name, lba);
+        PANIC(error);
+    }
+}
+
+/* 为每块硬盘建立请求队列和分派线程, 须在 ide_init 之后、文件系统使用硬盘之前调用 */
+void blk_init(void) {
+    printk("blk_init start\n");
+    uint8_t channel_no, dev_no;
+    for (channel_no = 0; channel_no < channel_cnt; channel_no++) {
+        for (dev_no = 0; dev_no < 2; dev_no++) {
+            struct disk* hd = &channels[channel_no].devices[dev_no];
+            struct blk_queue* q = get_kernel_pages(DIV_ROUND_UP(sizeof(struct blk_queue), PG_SIZE));
+            if (q == NULL) {
+                PANIC("blk_init: no memory for request queue\n");
+            }
+            q->hd = hd;
+            list_init(&q->requests);
+            spin_lock_init(&q->lock);
+            q->idle = false;
+            q->head_pos = 0;
+            q->in_flight = 0;
+            hd->queue = q;
+            q->dispatcher = thread_start(hd->name, BLK_DISPATCHER_PRIO, blk_dispatcher, q);
+        }
+    }
+    printk("blk_init done\n");
+}
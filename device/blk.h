@@ -0,0 +1,66 @@
+#ifndef __DEVICE_BLK_H
+#define __DEVICE_BLK_H
+
+#include "stdint.h"
+#include "global.h"
+#include "kernel/list.h"
+#include "sync.h"
+#include "spinlock.h"
+#include "ide.h"
+
+#define BLK_MAX_SEGS 64            // 一条合并后的命令最多包含的请求数
+
+struct blk_request;
+
+/* 请求完成时在分派线程中调用, 此后请求归提交者处理, 可以在回调中释放或重新提交.
+   回调应尽快返回, 否则会耽误本盘后续请求的分派 */
+typedef void blk_end_io(struct blk_request* req);
+
+/* 一次块设备读写请求. 用 blk_request_init 填好后由 blk_submit 异步提交,
+   提交者随后可以继续做别的事, 完成时调用 end_io, 未设置 end_io 时可以用 blk_wait 等待.
+   在完成之前请求和 buf 都必须保持有效; buf 在用户地址空间时, 提交的进程须等请求完成后才能退出.
+   请求本身会链入各任务共用的队列, 由分派线程在提交者的地址空间之外访问, 所以必须在内核内存中:
+   放在内核栈上, 或用 blk_alloc_requests 分配, 不能用用户进程中的 sys_malloc. 只有 buf 可以在用户空间.
+   重叠的请求之间不保证先后, 有依赖的请求要等前一个完成后再提交 */
+struct blk_request {
+    struct disk* hd;
+    uint32_t lba;                  // 起始扇区
+    uint32_t sec_cnt;              // 扇区数
+    void* buf;
+    bool is_write;
+    uint32_t* pgdir;               // 提交者的页目录, buf 位于这个地址空间
+    struct list_elem queue_tag;    // 在请求队列中的结点
+    struct semaphore done;         // 未设置 end_io 时, 请求完成时 up
+    blk_end_io* end_io;            // 完成回调, 为 NULL 时用 done 通知
+    int32_t error;                 // 完成时设置, 0 表示成功, -1 表示硬盘报告出错
+    void* private;                 // 留给提交者使用, 块设备层不碰它
+};
+
+/* 每块硬盘的请求队列. 请求按 lba 排序, 由本盘的分派线程按 C-LOOK 电梯算法逐条发给驱动:
+   磁头只向 lba 增大的方向扫, 扫到头后跳回最小的 lba. 相邻的请求合并成一条命令 */
+struct blk_queue {
+    struct disk* hd;
+    struct list requests;          // 待处理的请求, 按 lba 升序, lba 相同的按提交顺序
+    struct spinlock lock;          // 保护 requests、idle 和 in_flight
+    struct task_struct* dispatcher;  // 分派线程
+    bool idle;                     // 分派线程因队列为空而阻塞
+    uint32_t head_pos;             // 上一条命令结束处的 lba, 电梯从这里继续向上扫
+    uint32_t in_flight;            // 已提交还未完成的请求数, 为 0 时硬盘空闲
+    /* 以下只由分派线程使用 */
+    struct blk_request* batch[BLK_MAX_SEGS];  // 本次合并发出的请求
+    struct ide_seg segs[BLK_MAX_SEGS];
+};
+
+void blk_init(void);
+void blk_request_init(struct blk_request* req, struct disk* hd, uint32_t lba, void* buf,
+                      uint32_t sec_cnt, bool is_write);
+struct blk_request* blk_alloc_requests(uint32_t cnt);
+void blk_free_requests(struct blk_request* reqs, uint32_t cnt);
+void blk_submit(struct blk_request* req);
+void blk_wait(struct blk_request* req);
+void blk_wait_all(struct blk_request* reqs, uint32_t cnt);
+int32_t blk_rw(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt, bool is_write);
+void blk_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+void blk_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+
+#endif
@@ -10,6 +10,7 @@
 #include "timer.h"
 #include "string.h"
 #include "kernel/list.h"
+#include "pci.h"
 
 
 /* 定义硬盘各寄存器的端口号 */
@@ -24,11 +25,14 @@
 #define reg_cmd(channel)	 (reg_status(channel))
 #define reg_alt_status(channel)  (channel->port_base + 0x206)
 #define reg_ctl(channel)	 reg_alt_status(channel)
+#define reg_features(channel)	 reg_error(channel)
 
 /* reg_alt_status寄存器的一些关键位 */
 #define BIT_STAT_BSY	 0x80	      // 硬盘忙
 #define BIT_STAT_DRDY	 0x40	      // 驱动器准备好	 
+#define BIT_STAT_DF	 0x20	      // 驱动器故障
 #define BIT_STAT_DRQ	 0x8	      // 数据传输准备好了
+#define BIT_STAT_ERR	 0x1	      // 上一条命令出错
 
 /* device寄存器的一些关键位 */
 #define BIT_DEV_MBS	0xa0	    // 第7位和第5位固定为1
@@ -39,6 +43,41 @@
 #define CMD_IDENTIFY	   0xec	    // identify指令
 #define CMD_READ_SECTOR	   0x20     // 读扇区指令
 #define CMD_WRITE_SECTOR   0x30	    // 写扇区指令
+#define CMD_READ_DMA	   0xc8	    // DMA 读扇区指令
+#define CMD_WRITE_DMA	   0xca	    // DMA 写扇区指令
+#define CMD_READ_MULTIPLE  0xc4	    // 多扇区读, 每块中断一次
+#define CMD_WRITE_MULTIPLE 0xc5	    // 多扇区写, 每块中断一次
+#define CMD_SET_MULTIPLE   0xc6	    // 设置多扇区命令每块的扇区数
+#define CMD_FLUSH_CACHE	   0xe7	    // 把写缓存中的数据写到盘片上
+#define CMD_SET_FEATURES   0xef	    // 设置特性, 由 features 寄存器指定哪一项
+
+#define FEATURE_ENABLE_WCACHE 0x02  // SET FEATURES: 打开写缓存
+
+#define MAX_MULTI_SECTORS 16	    // 多扇区模式每块最多的扇区数
+
+/* IDENTIFY 数据中用到的字 */
+#define ID_MULTI_MAX	   47	    // 低 8 位: 多扇区命令每块最多的扇区数
+#define ID_CAPABILITIES	   49	    // 第 8 位: 支持 DMA
+#define ID_SECTORS	   60	    // 60~61 两个字: 可用 LBA28 寻址的扇区数
+#define ID_CMDSET_SUPPORT  82	    // 第 5 位: 支持写缓存
+#define ID_CMDSET_SUPPORT2 83	    // 第 12 位: 支持 FLUSH CACHE, 第 15、14 位为 01 时本字有效
+#define ID_CMDSET_ENABLED  85	    // 第 5 位: 写缓存已打开
+
+/* 总线主控 DMA 寄存器, 每个通道 8 个端口, ide1 在 ide0 之后 */
+#define reg_bm_cmd(channel)	 (channel->bmide_base + 0)
+#define reg_bm_status(channel)	 (channel->bmide_base + 2)
+#define reg_bm_prdt(channel)	 (channel->bmide_base + 4)
+
+#define BM_CMD_START	 0x1	      // 置位开始传输, 清零停止
+#define BM_CMD_READ	 0x8	      // 传输方向: 置位为从硬盘读到内存
+#define BM_STATUS_ERR	 0x2	      // 传输出错, 写 1 清除
+#define BM_STATUS_INTR	 0x4	      // 硬盘已发出中断, 写 1 清除
+#define BM_STATUS_DRV0_DMA 0x20	      // 主盘可用 DMA
+#define BM_STATUS_DRV1_DMA 0x40	      // 从盘可用 DMA
+
+#define PRD_EOT		 0x8000	      // PRD 表的最后一项
+#define PCI_IDE_PROG_BUS_MASTER 0x80  // prog_if 第 7 位: 控制器支持总线主控
+#define PCI_IDE_PROG_NATIVE 0x05      // prog_if 第 0、2 位: 两个通道是否工作在 PCI 原生模式
 
 /* 定义可读写的最大扇区数,调试用的 */
 #define max_lba ((80*1024*1024/512) - 1)	// 只支持80MB硬盘
@@ -147,88 +186,267 @@ static bool busy_wait(struct disk* hd) {
     return false;
 }
 
-/* 从硬盘读取 sec_cnt 个扇区到 buf */
-void ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
-    ASSERT(lba <= max_lba);
-    ASSERT(sec_cnt > 0);
-    lock_acquire(&hd->my_channel->lock);
+/* 阻塞等待 channel 上的硬盘完成命令, 等待的时间计入当前任务的 blocked_disk */
+static void wait_disk_done(struct ide_channel* channel) {
+    struct task_struct* cur = running_thread();
+    cur->block_reason = BLOCK_DISK;
+    sema_down(&channel->disk_done);
+    cur->block_reason = BLOCK_OTHER;
+}
 
-    /* 1 先选择操作的硬盘 */
-    select_disk(hd);
+/* 按扇区遍历一组内存段的游标 */
+struct seg_cursor {
+    struct ide_seg* seg;  // 当前段
+    uint32_t sec_idx;     // 下一个扇区在当前段中的下标
+};
+
+/* 返回游标处扇区的地址, 并前进一个扇区 */
+static void* cursor_next(struct seg_cursor* cur) {
+    while (cur->sec_idx == cur->seg->sec_cnt) {
+        cur->seg++;
+        cur->sec_idx = 0;
+    }
+    void* addr = (void*)((uint32_t)cur->seg->buf + cur->sec_idx * 512);
+    cur->sec_idx++;
+    return addr;
+}
 
-    uint32_t secs_op;        // 每次操作的扇区数
-    uint32_t secs_done = 0;  // 已完成的扇区数
-    while (secs_done < sec_cnt) {
-        if ((secs_done + 256) <= sec_cnt) {
-            secs_op = 256;
-        } else {
-            secs_op = sec_cnt - secs_done;
-        }
+/* 用 PIO 从硬盘 lba 处读取 sec_cnt 个扇区到 segs, sec_cnt 不超过 256.
+   硬盘每准备好一块数据中断一次, 设置了多扇区模式时一块是 multi_sectors 个扇区, 否则是 1 个.
+   硬盘报告出错时返回 false */
+static bool pio_read(struct disk* hd, uint32_t lba, struct ide_seg* segs, uint32_t sec_cnt) {
+    struct ide_channel* channel = hd->my_channel;
+    struct seg_cursor cur = {segs, 0};
+    uint32_t secs_left = sec_cnt;
+    uint32_t block = (hd->multi_sectors != 0 ? hd->multi_sectors : 1);
+
+    /* 2 写入待读入的扇区数和起始扇区号 */
+    select_sector(hd, lba, sec_cnt);
 
-        /* 2 写入待读入的扇区数和起始扇区号 */
-        select_sector(hd, lba + secs_done, secs_op);
+    /* 3 执行的命令写入 reg_cmd 寄存器 */
+    cmd_out(channel, hd->multi_sectors != 0 ? CMD_READ_MULTIPLE : CMD_READ_SECTOR);  // 准备开始读数据
 
-        /* 3 执行的命令写入 reg_cmd 寄存器 */
-        cmd_out(hd->my_channel, CMD_READ_SECTOR);  // 准备开始读数据
+    while (secs_left > 0) {
+        uint32_t secs_op = (secs_left < block ? secs_left : block);
 
         /* 阻塞自己的时机 
            在硬盘已经开始工作（开始在内部读数据或写数据）后才能阻塞自己，
            现在硬盘已经开始忙了，
-           将自己阻塞，等待硬盘完成读操作后通过中断处理程序唤醒自己 */
-        sema_down(&hd->my_channel->disk_done);
+           将自己阻塞，等待硬盘准备好这一块后通过中断处理程序唤醒自己 */
+        wait_disk_done(channel);
 
         /* 4 检测硬盘状态是否可读, 醒来后开始执行下面代码 */
         if (!busy_wait(hd)) {
-            char error[64];
-            sprintf(error, "%s read sector %d failed!\n", hd->name, lba);
-            PANIC(error);
+            printk("%s read sector %d failed!\n", hd->name, lba);
+            return false;
         }
 
-        /* 5 把数据从硬盘的缓冲区中读出 */
-        read_from_sector(hd, (void*)((uint32_t)buf + secs_done * 512), secs_op);
-        secs_done += secs_op;
+        /* 5 把这一块数据从硬盘的缓冲区中读出, 还有剩余时硬盘会为下一块再次中断 */
+        if (secs_left > secs_op) {
+            channel->expecting_intr = true;
+        }
+        secs_left -= secs_op;
+        while (secs_op-- > 0) {
+            read_from_sector(hd, cursor_next(&cur), 1);
+        }
     }
+    return true;
+}
+
+/* 用 PIO 将 segs 中共 sec_cnt 个扇区写入硬盘 lba 处, sec_cnt 不超过 256.
+   每写入一块数据硬盘中断一次, 块的大小同 pio_read. 硬盘报告出错时返回 false */
+static bool pio_write(struct disk* hd, uint32_t lba, struct ide_seg* segs, uint32_t sec_cnt) {
+    struct ide_channel* channel = hd->my_channel;
+    struct seg_cursor cur = {segs, 0};
+    uint32_t secs_left = sec_cnt;
+    uint32_t block = (hd->multi_sectors != 0 ? hd->multi_sectors : 1);
+
+    /* 2 写入待写入的扇区数和起始扇区号 */
+    select_sector(hd, lba, sec_cnt);
+
+    /* 3 执行的命令写入 reg_cmd 寄存器 */
+    cmd_out(channel, hd->multi_sectors != 0 ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR);  // 准备开始写数据
+
+    while (secs_left > 0) {
+        uint32_t secs_op = (secs_left < block ? secs_left : block);
+
+        /* 4 检测硬盘状态是否可写 */
+        if (!busy_wait(hd)) {
+            printk("%s write sector %d failed!\n", hd->name, lba);
+            return false;
+        }
+
+        /* 5 将这一块数据写入硬盘 */
+        channel->expecting_intr = true;
+        secs_left -= secs_op;
+        while (secs_op-- > 0) {
+            write2sector(hd, cursor_next(&cur), 1);
+        }
+
+        wait_disk_done(channel);  // 在硬盘响应期间阻塞自己
+    }
+    /* 最后一块写完后的中断里才报告这一块是否出错 */
+    return !(inb(reg_status(channel)) & (BIT_STAT_ERR | BIT_STAT_DF));
+}
+
+/* 向 hd 发出不传输数据的命令 cmd, features 和 sec_cnt 分别写入特性和扇区数寄存器.
+   阻塞到命令完成, 成功返回 true */
+static bool nondata_cmd(struct disk* hd, uint8_t cmd, uint8_t features, uint8_t sec_cnt) {
+    struct ide_channel* channel = hd->my_channel;
+    select_disk(hd);
+    outb(reg_features(channel), features);
+    outb(reg_sect_cnt(channel), sec_cnt);
+    cmd_out(channel, cmd);
+    wait_disk_done(channel);
+    return !(inb(reg_status(channel)) & (BIT_STAT_BSY | BIT_STAT_ERR | BIT_STAT_DF));
+}
+
+/* 把 hd 写缓存中的数据写到盘片上, 文件系统在需要数据落盘时调用.
+   没有打开写缓存时直接返回. 成功返回 0, 失败返回 -1 */
+int32_t ide_flush(struct disk* hd) {
+    if (!hd->write_cache) {
+        return 0;
+    }
+    lock_acquire(&hd->my_channel->lock);
+    bool ok = nondata_cmd(hd, CMD_FLUSH_CACHE, 0, 0);
     lock_release(&hd->my_channel->lock);
+    if (!ok) {
+        printk("%s flush cache failed\n", hd->name);
+        return -1;
+    }
+    return 0;
+}
+
+/* 为 segs 建立通道的 PRD 表. 虚拟地址连续的缓冲区在物理上未必连续,
+   所以每个页内的片段单独成一项, 这样也不会跨越 64KB 边界. 有段不是字对齐时返回 false */
+static bool prdt_build(struct ide_channel* channel, struct ide_seg* segs, uint32_t seg_cnt) {
+    uint32_t seg_idx, idx = 0;
+    for (seg_idx = 0; seg_idx < seg_cnt; seg_idx++) {
+        uint32_t vaddr = (uint32_t)segs[seg_idx].buf;
+        uint32_t byte_cnt = segs[seg_idx].sec_cnt * 512;
+        if (vaddr & 1) {
+            return false;
+        }
+        while (byte_cnt > 0) {
+            uint32_t len = PG_SIZE - (vaddr & (PG_SIZE - 1));
+            if (len > byte_cnt) {
+                len = byte_cnt;
+            }
+            ASSERT(idx < PG_SIZE / sizeof(struct prd));
+            channel->prdt[idx].phy_addr = addr_v2p(vaddr);
+            channel->prdt[idx].byte_cnt = len;
+            channel->prdt[idx].flags = 0;
+            idx++;
+            vaddr += len;
+            byte_cnt -= len;
+        }
+    }
+    channel->prdt[idx - 1].flags = PRD_EOT;
+    return true;
+}
+
+/* 用总线主控 DMA 在硬盘 lba 处读写 segs 中共 sec_cnt 个扇区, sec_cnt 不超过 256.
+   传输期间 cpu 可以去执行别的任务, 完成后由中断唤醒.
+   通道不支持 DMA、缓冲区不能用于 DMA 或传输出错时返回 false, 由调用者改用 PIO */
+static bool dma_transfer(struct disk* hd, uint32_t lba, struct ide_seg* segs, uint32_t seg_cnt,
+                         uint32_t sec_cnt, bool is_write) {
+    struct ide_channel* channel = hd->my_channel;
+    if (channel->bmide_base == 0 || !hd->dma) {
+        return false;
+    }
+    if (!prdt_build(channel, segs, seg_cnt)) {
+        return false;
+    }
+
+    /* 1 设置 PRD 表地址和传输方向, 清除上次留下的出错和中断标志 */
+    outl(reg_bm_prdt(channel), addr_v2p((uint32_t)channel->prdt));
+    outb(reg_bm_cmd(channel), is_write ? 0 : BM_CMD_READ);
+    outb(reg_bm_status(channel), inb(reg_bm_status(channel)) | BM_STATUS_ERR | BM_STATUS_INTR);
+
+    /* 2 向硬盘发出 DMA 命令, 再启动总线主控 */
+    select_sector(hd, lba, sec_cnt);
+    cmd_out(channel, is_write ? CMD_WRITE_DMA : CMD_READ_DMA);
+    outb(reg_bm_cmd(channel), inb(reg_bm_cmd(channel)) | BM_CMD_START);
+
+    /* 3 整个传输完成后硬盘才发中断, 在此之前阻塞自己 */
+    wait_disk_done(channel);
+    outb(reg_bm_cmd(channel), inb(reg_bm_cmd(channel)) & ~BM_CMD_START);
+
+    uint8_t bm_status = inb(reg_bm_status(channel));
+    uint8_t status = inb(reg_status(channel));
+    if ((bm_status & BM_STATUS_ERR) || (status & (BIT_STAT_ERR | BIT_STAT_DF | BIT_STAT_BSY))) {
+        /* 出错后本通道不再使用 DMA, 这一段由调用者用 PIO 重做 */
+        printk("%s dma %s sector %d failed, status 0x%x/0x%x, fall back to pio\n",
+               hd->name, is_write ? "write" : "read", lba, status, bm_status);
+        channel->bmide_base = 0;
+        return false;
+    }
+    return true;
 }
 
-/* 将 buf 中 sec_cnt 扇区数据写入硬盘 */
-void ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+/* 用一条命令在 hd 的 lba 处连续读写 segs 中共 sec_cnt 个扇区, sec_cnt 不超过 256.
+   优先用 DMA, 不行再用 PIO. 调用者须持有通道锁, 成功返回 true */
+static bool rw_segs_locked(struct disk* hd, uint32_t lba, struct ide_seg* segs, uint32_t seg_cnt,
+                           uint32_t sec_cnt, bool is_write) {
     ASSERT(lba <= max_lba);
-    ASSERT(sec_cnt > 0);
-    lock_acquire(&hd->my_channel->lock);
+    ASSERT(sec_cnt > 0 && sec_cnt <= IDE_MAX_SECTORS);
 
     /* 1 先选择操作的硬盘 */
     select_disk(hd);
 
+    if (dma_transfer(hd, lba, segs, seg_cnt, sec_cnt, is_write)) {
+        return true;
+    }
+    if (is_write) {
+        return pio_write(hd, lba, segs, sec_cnt);
+    }
+    return pio_read(hd, lba, segs, sec_cnt);
+}
+
+/* 用一条命令在 hd 的 lba 处连续读写 segs 中的各段, 总扇区数不超过 IDE_MAX_SECTORS.
+   供块设备层把相邻的多个请求合并成一次传输. 成功返回 true, 硬盘报告出错时返回 false */
+bool ide_rw_segs(struct disk* hd, uint32_t lba, struct ide_seg* segs, uint32_t seg_cnt, bool is_write) {
+    uint32_t idx, sec_cnt = 0;
+    for (idx = 0; idx < seg_cnt; idx++) {
+        sec_cnt += segs[idx].sec_cnt;
+    }
+    lock_acquire(&hd->my_channel->lock);
+    bool ok = rw_segs_locked(hd, lba, segs, seg_cnt, sec_cnt, is_write);
+    lock_release(&hd->my_channel->lock);
+    return ok;
+}
+
+/* 在 hd 的 lba 处读写 buf 中 sec_cnt 个扇区, 每次最多 IDE_MAX_SECTORS 个. 出错即停止并返回 false */
+static bool ide_rw(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt, bool is_write) {
+    ASSERT(lba <= max_lba);
+    ASSERT(sec_cnt > 0);
+    lock_acquire(&hd->my_channel->lock);
+
     uint32_t secs_op;        // 每次操作的扇区数
     uint32_t secs_done = 0;  // 已完成的扇区数
-    while (secs_done < sec_cnt) {
-        if ((secs_done + 256) <= sec_cnt) {
-            secs_op = 256;
+    bool ok = true;
+    while (ok && secs_done < sec_cnt) {
+        if ((secs_done + IDE_MAX_SECTORS) <= sec_cnt) {
+            secs_op = IDE_MAX_SECTORS;
         } else {
             secs_op = sec_cnt - secs_done;
         }
-
-        /* 2 写入待读入的扇区数和起始扇区号 */
-        select_sector(hd, lba + secs_done, secs_op);
-
-        /* 3 执行的命令写入 reg_cmd 寄存器 */
-        cmd_out(hd->my_channel, CMD_WRITE_SECTOR);  // 准备开始写数据
-
-        /* 4 检测硬盘状态是否可读, 醒来后开始执行下面代码 */
-        if (!busy_wait(hd)) {
-            char error[64];
-            sprintf(error, "%s write sector %d failed!\n", hd->name, lba);
-            PANIC(error);
-        }
-
-        /* 5 将数据写入硬盘 */
-        write2sector(hd, (void*)((uint32_t)buf + secs_done * 512), secs_op);
-
-        sema_down(&hd->my_channel->disk_done);  // 在硬盘响应期间阻塞自己
+        struct ide_seg seg = {(void*)((uint32_t)buf + secs_done * 512), secs_op};
+        ok = rw_segs_locked(hd, lba + secs_done, &seg, 1, secs_op, is_write);
         secs_done += secs_op;
     }
-    lock_release(&hd->my_channel->lock);  // 醒来后开始释放锁
+    lock_release(&hd->my_channel->lock);
+    return ok;
+}
+
+/* 从硬盘读取 sec_cnt 个扇区到 buf, 成功返回 true */
+bool ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    return ide_rw(hd, lba, buf, sec_cnt, false);
+}
+
+/* 将 buf 中 sec_cnt 扇区数据写入硬盘, 成功返回 true */
+bool ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    return ide_rw(hd, lba, buf, sec_cnt, true);
 }
 
 /* 硬盘中断处理程序 */
@@ -241,13 +459,24 @@ void intr_hd_handler(uint8_t irq_no) {
        每次读写硬盘时会申请锁，从而保证了同步一致性 */
     if (channel->expecting_intr) {
         channel->expecting_intr = false;
-        sema_up(&channel->disk_done);
         /* 读取状态寄存器使硬盘控制器认为此次的中断已被处理，
            从而硬盘可以继续执行新的读写 */
+        if (channel->bmide_base != 0) {
+            /* DMA 时还要清除总线主控的中断标志, 出错标志留给驱动程序检查 */
+            outb(reg_bm_status(channel), (inb(reg_bm_status(channel)) & ~BM_STATUS_ERR) | BM_STATUS_INTR);
+        }
         inb(reg_status(channel));
+        /* 上半部只应答控制器, 唤醒驱动程序等收尾工作交给下半部 */
+        schedule_work(&channel->done_work);
     }
 }
 
+/* 硬盘中断的下半部, 在工作线程中唤醒等待本通道的驱动程序 */
+static void ide_done_work(void* arg) {
+    struct ide_channel* channel = arg;
+    sema_up(&channel->disk_done);
+}
+
 
 /* 将 dst 中 len 个相邻字节交换位置后存入 buf */
 static void swap_pairs_bytes(const char* dst, char* buf, uint32_t len) {
@@ -265,7 +494,7 @@ static void identify_disk(struct disk* hd) {
     char id_info[512];
     select_disk(hd);
     cmd_out(hd->my_channel, CMD_IDENTIFY);
-    sema_down(&hd->my_channel->disk_done);
+    wait_disk_done(hd->my_channel);
 
     if (!busy_wait(hd)) {
         char error[64];
@@ -281,15 +510,45 @@ static void identify_disk(struct disk* hd) {
     memset(buf, 0, sizeof(buf));
     swap_pairs_bytes(&id_info[md_start], buf, md_len);
     printk("      MODULE: %s\n", buf);
-    uint32_t sectors = *(uint32_t*)&id_info[60 * 2];
+    uint16_t* id_words = (uint16_t*)id_info;
+    uint32_t sectors = *(uint32_t*)&id_words[ID_SECTORS];
     printk("      SECTORS: %d\n", sectors);
     printk("      CAPACITY: %dMB\n", sectors * 512 / 1024 / 1024);
+
+    hd->dma = (id_words[ID_CAPABILITIES] & 0x100) != 0;
+
+    /* 多扇区模式: 取不超过 MAX_MULTI_SECTORS 且硬盘支持的最大的 2 的幂 */
+    hd->multi_sectors = 0;
+    uint8_t multi_max = id_words[ID_MULTI_MAX] & 0xff;
+    if (multi_max != 0) {
+        uint8_t multi = MAX_MULTI_SECTORS;
+        while (multi > multi_max) {
+            multi >>= 1;
+        }
+        if (nondata_cmd(hd, CMD_SET_MULTIPLE, 0, multi)) {
+            hd->multi_sectors = multi;
+        }
+    }
+
+    /* 只有能用 FLUSH CACHE 把数据刷下去时才打开写缓存, 否则 sync 无从保证数据落盘 */
+    hd->write_cache = false;
+    uint16_t cmdset2 = id_words[ID_CMDSET_SUPPORT2];
+    bool flush_ok = (cmdset2 & 0xc000) == 0x4000 && (cmdset2 & 0x1000);
+    if (flush_ok && (id_words[ID_CMDSET_SUPPORT] & 0x20)) {
+        hd->write_cache = (id_words[ID_CMDSET_ENABLED] & 0x20) ||
+                          nondata_cmd(hd, CMD_SET_FEATURES, FEATURE_ENABLE_WCACHE, 0);
+    }
+    printk("      DMA: %s, MULTIPLE: %d, WRITE CACHE: %s\n",
+           hd->dma ? "yes" : "no", hd->multi_sectors, hd->write_cache ? "on" : "off");
 }
 
 /* 扫描硬盘 hd 中地址为 ext_lba 的扇区中的所有分区 */
 static void partition_scan(struct disk* hd, uint32_t ext_lba) {
     struct boot_sector* bs = sys_malloc(sizeof(struct boot_sector));
-    ide_read(hd, ext_lba, bs, 1);
+    if (!ide_read(hd, ext_lba, bs, 1)) {
+        sys_free(bs);
+        return;
+    }
     uint8_t part_idx = 0;
     struct partition_table_entry* p = bs->partition_table;
 
@@ -346,6 +605,39 @@ static bool partition_info(struct list_elem* pelem, int arg UNUSED) {
 }
 
 
+/* 在 PCI 总线上找 IDE 控制器(如 PIIX), 它支持总线主控且工作在兼容模式时,
+   为已初始化的各通道打开 DMA. 否则各通道继续只用 PIO */
+static void ide_dma_init(void) {
+    struct pci_dev pdev;
+    if (!pci_find_class(0x01, 0x01, &pdev)) {
+        printk("   no pci ide controller, use pio\n");
+        return;
+    }
+    printk("   pci ide controller %x:%x at bus %d dev %d func %d\n",
+           pdev.vendor_id, pdev.device_id, pdev.bus, pdev.dev, pdev.func);
+    uint32_t bar4 = pci_read_config32(&pdev, PCI_BAR4);
+    if (!(pdev.prog_if & PCI_IDE_PROG_BUS_MASTER) || (pdev.prog_if & PCI_IDE_PROG_NATIVE) ||
+        !(bar4 & PCI_BAR_IO) || (bar4 & 0xfffc) == 0) {
+        printk("   bus master dma unavailable, use pio\n");
+        return;
+    }
+    pci_write_config16(&pdev, PCI_COMMAND,
+                       pci_read_config16(&pdev, PCI_COMMAND) | PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+
+    uint8_t channel_no;
+    for (channel_no = 0; channel_no < channel_cnt; channel_no++) {
+        struct ide_channel* channel = &channels[channel_no];
+        channel->prdt = get_kernel_pages(1);
+        if (channel->prdt == NULL) {
+            continue;
+        }
+        channel->bmide_base = (bar4 & 0xfffc) + channel_no * 8;
+        /* 告诉控制器两块硬盘都可用 DMA, 有的 BIOS 不设置这两位 */
+        outb(reg_bm_status(channel), BM_STATUS_DRV0_DMA | BM_STATUS_DRV1_DMA);
+        printk("   %s bus master dma at port 0x%x\n", channel->name, channel->bmide_base);
+    }
+}
+
 /* 硬盘数据结构初始化 */
 void ide_init() {
     printk("ide_init start\n");
@@ -376,12 +668,15 @@ void ide_init() {
         }
 
         channel->expecting_intr = false;  // 未向硬盘写入指令时不期待硬盘的中断
+        channel->bmide_base = 0;          // 先只用 PIO, 识别完所有硬盘后再由 ide_dma_init 打开 DMA
+        channel->prdt = NULL;
         lock_init(&channel->lock);
 
         /* 始化为 0 ，目的是向硬盘控制器请求数据后，硬盘驱动 sema_down 此信号量会
            阻塞线程，直到硬盘完成后通过发中断，由中断处理程序将此信号量 
            sema_up ，唤醒线程 */
         sema_init(&channel->disk_done, 0);
+        work_init(&channel->done_work, ide_done_work, channel);
 
         register_handler(channel->irq_no, intr_hd_handler);
 
@@ -401,6 +696,7 @@ void ide_init() {
         dev_no = 0;			  	   // 将硬盘驱动器号置0,为下一个channel的两个硬盘初始化。
         channel_no++;  // 下一个 channel
     }
+    ide_dma_init();
     printk("\n   all partition info\n");
     /* 打印所有分区信息 */
     list_traversal(&partition_list, partition_info, (int)NULL);
@@ -4,6 +4,11 @@
 #include "stdint.h"
 #include "sync.h"
 #include "kernel/bitmap.h"
+#include "workqueue.h"
+
+#define IDE_MAX_SECTORS 256          // 一条读写命令最多的扇区数
+
+struct blk_queue;
 
 /* 分区结构 */
 struct partition {
@@ -16,6 +21,7 @@ struct partition {
     struct bitmap block_bitmap;  // 块位图
     struct bitmap inode_bitmap;  // i 结点位图
     struct list open_inodes;     // 本分区打开的 i 结点队列
+    struct lock alloc_lock;      // 保护块位图、inode 位图及 inode 表所在扇区的读改写
 };
 
 /* 硬盘结构 */
@@ -23,10 +29,27 @@ struct disk {
     char name[8];                     // 本硬盘的名称
     struct ide_channel* my_channel;   // 此块硬盘归属于哪个 ide 通道
     uint8_t dev_no;                   // 本硬盘是主 0 ，还是从 1
+    bool dma;                         // IDENTIFY 表明硬盘支持 DMA
+    uint8_t multi_sectors;            // READ/WRITE MULTIPLE 每块的扇区数, 0 表示只用单扇区命令
+    bool write_cache;                 // 已打开写缓存, 数据落盘须靠 ide_flush
+    struct blk_queue* queue;          // 块设备层的请求队列, 见 blk.h
     struct partition prim_parts[4];   // 主分区顶最多是 4 个
     struct partition logic_parts[8];  // 逻辑分区数量无限，这里支持 8 个
 };
 
+/* 物理区域描述符, 总线主控 DMA 按 PRD 表逐项传输, 每项不能跨越 64KB 边界 */
+struct prd {
+    uint32_t phy_addr;  // 内存缓冲区的物理地址, 须字对齐
+    uint16_t byte_cnt;  // 字节数, 0 表示 64KB
+    uint16_t flags;     // 最高位为 1 表示这是表中最后一项
+} __attribute__ ((packed));
+
+/* 一条读写命令中的一段内存, 各段依次对应硬盘上连续的扇区 */
+struct ide_seg {
+    void* buf;
+    uint32_t sec_cnt;
+};
+
 /* ata通道结构 */
 struct ide_channel {
     char name[8];                 // 本 ata 通道名称
@@ -35,6 +58,9 @@ struct ide_channel {
     struct lock lock;             // 通道锁
     bool expecting_intr;          // 表示等待硬盘的中断
     struct semaphore disk_done;   // 用于阻塞、唤醒驱动程序
+    struct work_struct done_work; // 中断的下半部, 在工作线程中唤醒驱动程序
+    uint16_t bmide_base;          // 总线主控 DMA 寄存器的端口基址, 为 0 表示本通道只用 PIO
+    struct prd* prdt;             // DMA 用的 PRD 表, 占一页
     struct disk devices[2];       // 一个通道上连接两个硬盘，一主一从
 };
 
@@ -44,7 +70,9 @@ extern struct list partition_list;
 
 void intr_hd_handler(uint8_t irq_no);
 void ide_init(void);
-void ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
-void ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+bool ide_read(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+bool ide_write(struct disk* hd, uint32_t lba, void* buf, uint32_t sec_cnt);
+int32_t ide_flush(struct disk* hd);
+bool ide_rw_segs(struct disk* hd, uint32_t lba, struct ide_seg* segs, uint32_t seg_cnt, bool is_write);
 
 #endif
\ No newline at end of file
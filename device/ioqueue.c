@@ -6,6 +6,7 @@
 /* 初始化 io 队列 ioq */
 void ioqueue_init(struct ioqueue* ioq) {
     lock_init(&ioq->lock);
+    spin_lock_init(&ioq->spinlock);
     ioq->producer = ioq->consumer = NULL;
     ioq->head = ioq->tail = 0;  // 队列的首尾指针指向缓冲区数组第 0 个位置
 }
@@ -27,11 +28,23 @@ bool ioq_empty(struct ioqueue* ioq) {
     return ioq->head == ioq->tail;
 }
 
-/* 使当前生产者或消费者在此缓冲区上等待 */
-static void ioq_wait(struct task_struct** waiter) {
-    ASSERT(*waiter == NULL && waiter != NULL);
-    *waiter = running_thread();
-    thread_block(TASK_BLOCKED);
+/* 在 cond 成立时使当前生产者或消费者在此缓冲区上等待, 调用前后都持有 ioq->spinlock.
+   睡眠锁不能在持自旋锁时申请, 拿到睡眠锁后缓冲区可能已经变了, 所以要重新判断 cond */
+static void ioq_wait(struct ioqueue* ioq, struct task_struct** waiter, bool (*cond)(struct ioqueue*)) {
+    spin_unlock(&ioq->spinlock);
+    lock_acquire(&ioq->lock);
+    spin_lock(&ioq->spinlock);
+    if (cond(ioq)) {
+        ASSERT(*waiter == NULL && waiter != NULL);
+        *waiter = running_thread();
+        running_thread()->status = TASK_BLOCKED;
+        spin_unlock(&ioq->spinlock);
+        schedule();
+    } else {
+        spin_unlock(&ioq->spinlock);
+    }
+    lock_release(&ioq->lock);
+    spin_lock(&ioq->spinlock);
 }
 
 /* 唤醒 waiter */
@@ -48,10 +61,9 @@ char ioq_getchar(struct ioqueue* ioq) {
     /*若缓冲区（队列）为空，把消费者 ioq→consumer 记为当前线程自己，
       目的是将来生产者往缓冲区里装商品后，生产者知道唤醒哪个消费者，
       也就是唤醒当前线程自己 */
+    spin_lock(&ioq->spinlock);
     while (ioq_empty(ioq)) {
-        lock_acquire(&ioq->lock);
-        ioq_wait(&ioq->consumer);
-        lock_release(&ioq->lock);
+        ioq_wait(ioq, &ioq->consumer, ioq_empty);
     }
 
     char byte = ioq->buf[ioq->tail];  // 从缓冲区中取出
@@ -60,6 +72,7 @@ char ioq_getchar(struct ioqueue* ioq) {
     if (ioq->producer != NULL) {
         wakeup(&ioq->producer);  // 唤醒生产者
     }
+    spin_unlock(&ioq->spinlock);
 
     return byte;
 }
@@ -71,10 +84,9 @@ void ioq_putchar(struct ioqueue* ioq, char byte) {
     /* 若缓冲区（队列）已经满了，把生产者 ioq->producer 记为自己，
        为的是当缓冲区里的东西被消费者取完后让消费者知道唤醒哪个生产者 ，
        也就是唤醒当前线程 自己 */
+    spin_lock(&ioq->spinlock);
     while (ioq_full(ioq)) {
-        lock_acquire(&ioq->lock);
-        ioq_wait(&ioq->producer);
-        lock_release(&ioq->lock);
+        ioq_wait(ioq, &ioq->producer, ioq_full);
     }
 
     ioq->buf[ioq->head] = byte;       // 把字节放入缓冲区中
@@ -83,6 +95,7 @@ void ioq_putchar(struct ioqueue* ioq, char byte) {
     if (ioq->consumer != NULL) {
         wakeup(&ioq->consumer);  // 唤醒消费者
     }
+    spin_unlock(&ioq->spinlock);
 }
 
 /* 返回环形缓冲区中的数据长度 */
@@ -9,7 +9,8 @@
 
 /* 环形队列 */
 struct ioqueue {
-    struct lock lock;
+    struct lock lock;          // 同一时刻只允许一个生产者或消费者在此睡眠
+    struct spinlock spinlock;  // 保护缓冲区和 producer、consumer, 中断处理程序中也会用到
     /* 生产者，缓冲区不满时就继续往里面放数据，
        否则就睡眠，此项记录哪个生产者在此缓冲区上睡眠 */
     struct task_struct* producer;
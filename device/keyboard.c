@@ -4,8 +4,11 @@
 #include "io.h"
 #include "global.h"
 #include "ioqueue.h"
+#include "workqueue.h"
+#include "spinlock.h"
 
 #define KBD_BUF_PORT 0x60  // 键盘 buffer 寄存器端口号为 0x60
+#define SCANCODE_BUF_SIZE 64  // 上半部暂存扫描码的环形缓冲区大小
 
 /**
  * 用转义字符定义的控制字符.
@@ -48,6 +51,12 @@
 static int ctrl_status, shift_status, alt_status, caps_lock_status, ext_scancode;
 struct ioqueue kbd_buf;  // 定义键盘缓冲区
 
+/* 中断处理程序只把扫描码放进这里, 由下半部在工作线程中翻译成字符 */
+static uint8_t scancode_buf[SCANCODE_BUF_SIZE];
+static uint32_t scancode_head, scancode_tail;
+static struct spinlock scancode_lock;
+static struct work_struct kbd_work;
+
 /**
  * 以通码为索引的显示字符数组，零号元素为shift没有按下时的展示，1反之.
  */ 
@@ -116,16 +125,14 @@ static char keymap[][2] = {
 /*其它按键暂不处理*/
 };
 
-/* 键盘中断处理程序 */
-static void intr_keyboard_handler(void) {
+/* 处理一个扫描码, 在下半部中调用 */
+static void keyboard_translate(uint16_t scancode) {
     // 这次中断发生前的上一次中断，以下任意三个键是否有按下 
     bool ctrl_down_last = ctrl_status;
     bool shift_down_last = shift_status;
     bool caps_lock_last = caps_lock_status;
 
     bool break_code;
-    // 必须要读取输出缓冲区寄存器，否则 8042 不再继续响应键盘中断
-    uint16_t scancode = inb(KBD_BUF_PORT);
 
     /* 若扫描码 scancode 是 e0 开头的，表示此键的按下将产生多个扫描码，
        所以马上结束此次中断处理函数，等待下一个扫描码进来 */
@@ -200,10 +207,12 @@ static void intr_keyboard_handler(void) {
 
             /*若 kbd_buf 中未满并且待加入的 cur_char 不为 O,
               将其加入到缓冲区 kbd_buf 中 */
+            enum intr_status old_status = intr_disable();
             if (!ioq_full(&kbd_buf)) {
                 //put_char(cur_char);  // 临时的
                 ioq_putchar(&kbd_buf, cur_char);
             }
+            intr_set_status(old_status);
             
             return;
         }
@@ -226,11 +235,44 @@ static void intr_keyboard_handler(void) {
     }
 }
 
+/* 键盘中断的下半部: 在工作线程中开中断翻译上半部攒下的扫描码 */
+static void keyboard_bottom_half(void* arg UNUSED) {
+    while (1) {
+        enum intr_status old_status = spin_lock_irqsave(&scancode_lock);
+        if (scancode_tail == scancode_head) {
+            spin_unlock_irqrestore(&scancode_lock, old_status);
+            return;
+        }
+        uint8_t scancode = scancode_buf[scancode_tail];
+        scancode_tail = (scancode_tail + 1) % SCANCODE_BUF_SIZE;
+        spin_unlock_irqrestore(&scancode_lock, old_status);
+
+        keyboard_translate(scancode);
+    }
+}
+
+/* 键盘中断处理程序(上半部): 只取走扫描码, 其余的留给下半部 */
+static void intr_keyboard_handler(void) {
+    // 必须要读取输出缓冲区寄存器，否则 8042 不再继续响应键盘中断
+    uint8_t scancode = inb(KBD_BUF_PORT);
+
+    spin_lock(&scancode_lock);
+    uint32_t next = (scancode_head + 1) % SCANCODE_BUF_SIZE;
+    if (next != scancode_tail) {  // 下半部来不及处理时丢弃新的按键
+        scancode_buf[scancode_head] = scancode;
+        scancode_head = next;
+    }
+    spin_unlock(&scancode_lock);
+    schedule_work(&kbd_work);
+}
+
 
 // 键盘初始化
 void keyboard_init() {
     put_str("keyboard init start\n");
     ioqueue_init(&kbd_buf);
+    spin_lock_init(&scancode_lock);
+    work_init(&kbd_work, keyboard_bottom_half, NULL);
     register_handler(0x21, intr_keyboard_handler);
     put_str("keyboard init done\n");
 }
\ No newline at end of file
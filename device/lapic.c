@@ -0,0 +1,173 @@
+#include "lapic.h"
+#include "global.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "thread.h"
+#include "timer.h"
+#include "kernel/print.h"
+
+/* local APIC 寄存器映射到的虚拟地址, 它位于内核堆之上, 页表由 loader 预先建好 */
+#define LAPIC_VADDR 0xfee00000
+
+/* local APIC 寄存器偏移 */
+#define LAPIC_ID        0x020   // local APIC ID
+#define LAPIC_TPR       0x080   // 任务优先级
+#define LAPIC_EOI       0x0b0   // 中断结束
+#define LAPIC_SVR       0x0f0   // 伪中断向量, 含 APIC 软件使能位
+#define LAPIC_ESR       0x280   // 错误状态
+#define LAPIC_ICR_LOW   0x300   // 中断命令寄存器低 32 位, 写它即发出中断
+#define LAPIC_ICR_HIGH  0x310   // 中断命令寄存器高 32 位, 目标 APIC ID
+#define LAPIC_LVT_TIMER 0x320   // 定时器本地中断
+#define LAPIC_LVT_LINT0 0x350   // LINT0 引脚, 8259A 接在 BSP 的这个引脚上
+#define LAPIC_LVT_LINT1 0x360   // LINT1 引脚, 接 NMI
+#define LAPIC_LVT_ERROR 0x370   // 错误中断
+#define LAPIC_TIMER_INIT 0x380  // 定时器初始计数
+#define LAPIC_TIMER_CUR 0x390   // 定时器当前计数
+#define LAPIC_TIMER_DIV 0x3e0   // 定时器分频
+
+#define SVR_ENABLE 0x100
+#define LVT_MASKED 0x10000
+#define LVT_EXTINT 0x700
+#define LVT_NMI 0x400
+#define TIMER_PERIODIC 0x20000
+#define TIMER_DIV_16 0x3
+
+#define ICR_FIXED 0x000
+#define ICR_INIT 0x500
+#define ICR_STARTUP 0x600
+#define ICR_PENDING 0x1000      // 中断尚未被目标接收
+#define ICR_ASSERT 0x4000
+#define ICR_LEVEL 0x8000
+
+#define CALIBRATE_US 10000      // 用 10ms 校准定时器
+
+static uint32_t lapic_timer_count;  // 每个时钟嘀嗒对应的定时器计数, 由 BSP 校准
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return *(volatile uint32_t*)(LAPIC_VADDR + reg);
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    *(volatile uint32_t*)(LAPIC_VADDR + reg) = value;
+}
+
+/* 用 cpuid 查询 cpu 是否带有 local APIC */
+bool lapic_present(void) {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+    return (edx & (1 << 9)) != 0;
+}
+
+/* 把物理地址为 phy_addr 的 APIC 寄存器页映射到 LAPIC_VADDR, 并禁止缓存.
+   内核页目录项为所有进程共享, 故只需映射一次 */
+void lapic_map(uint32_t phy_addr) {
+    ASSERT(*pde_ptr(LAPIC_VADDR) & PG_P_1);
+    *pte_ptr(LAPIC_VADDR) = phy_addr | PG_PCD_1 | PG_PWT_1 | PG_US_S | PG_RW_W | PG_P_1;
+    asm volatile ("invlpg %0" : : "m" (*(uint8_t*)LAPIC_VADDR) : "memory");
+}
+
+/* 返回当前 cpu 的 local APIC ID */
+uint8_t lapic_id(void) {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+/* 通知 local APIC 中断处理完毕 */
+void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+/* 发出中断命令, 等待目标接收 */
+static void lapic_icr_write(uint8_t apic_id, uint32_t icr_low) {
+    lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, icr_low);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING) {
+        cpu_relax();
+    }
+}
+
+/* 向 apic_id 指定的 cpu 发送向量号为 vector 的处理器间中断 */
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector) {
+    enum intr_status old_status = intr_disable();  // ICR 是两个寄存器, 写的中途不能被打断
+    lapic_icr_write(apic_id, ICR_FIXED | vector);
+    intr_set_status(old_status);
+}
+
+/* 按 INIT-SIPI-SIPI 的顺序唤醒 apic_id 指定的 AP, 让它从物理地址 start_addr 处以实模式开始执行.
+   start_addr 须在 1MB 以下且 4KB 对齐. AP 启动后会置 *started 为 true, 等不到则返回 false */
+bool lapic_start_ap(uint8_t apic_id, uint32_t start_addr, volatile bool* started) {
+    ASSERT(start_addr < 0x100000 && (start_addr & 0xfff) == 0);
+    lapic_icr_write(apic_id, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+    udelay(10000);
+    lapic_icr_write(apic_id, ICR_INIT | ICR_LEVEL);
+
+    /* 按 Intel 的建议发两次 STARTUP, 第一次就已启动的不再发第二次 */
+    uint32_t sipi_cnt = 0;
+    while (sipi_cnt++ < 2 && !*started) {
+        lapic_icr_write(apic_id, ICR_STARTUP | (start_addr >> 12));
+        udelay(200);
+    }
+
+    uint32_t wait_ms = 0;
+    while (!*started && wait_ms++ < 1000) {
+        udelay(1000);
+    }
+    return *started;
+}
+
+/* AP 的时钟中断, 代替 8253 驱动本 cpu 的调度 */
+static void intr_lapic_timer_handler(void) {
+    lapic_eoi();
+    sched_tick(1);
+}
+
+/* 其他 cpu 要求本 cpu 重新调度, 它已把当前任务的时间片清零 */
+static void intr_reschedule_handler(void) {
+    lapic_eoi();
+    if (running_thread()->ticks == 0) {
+        schedule();
+    }
+}
+
+/* 伪中断不需要发 EOI */
+static void intr_spurious_handler(void) {
+}
+
+/* 以 8253 计数器2 为基准, 测出 local APIC 定时器在一个时钟嘀嗒内的计数 */
+static void lapic_timer_calibrate(void) {
+    lapic_write(LAPIC_TIMER_DIV, TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INIT, 0xffffffff);
+    udelay(CALIBRATE_US);
+    uint32_t elapsed = 0xffffffff - lapic_read(LAPIC_TIMER_CUR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+
+    lapic_timer_count = elapsed * (1000000 / CALIBRATE_US) / HZ;
+    put_str("   lapic timer count per tick: 0x");
+    put_int(lapic_timer_count);
+    put_char('\n');
+}
+
+/* 初始化当前 cpu 的 local APIC, 调用前需已映射寄存器.
+   8259A 仍只接在 BSP 上, BSP 继续用 8253 产生时钟中断; AP 屏蔽 LINT0, 改用本地定时器 */
+void lapic_init(bool is_bsp) {
+    lapic_write(LAPIC_SVR, SVR_ENABLE | SPURIOUS_VECTOR);
+    lapic_write(LAPIC_TPR, 0);  // 接收所有优先级的中断
+    lapic_write(LAPIC_LVT_LINT0, is_bsp ? LVT_EXTINT : LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, is_bsp ? LVT_NMI : LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, LVT_MASKED);
+    lapic_write(LAPIC_ESR, 0);  // 连写两次以清除错误状态
+    lapic_write(LAPIC_ESR, 0);
+    lapic_eoi();                // 清掉可能残留的中断
+
+    if (is_bsp) {
+        register_handler(LAPIC_TIMER_VECTOR, intr_lapic_timer_handler);
+        register_handler(RESCHEDULE_VECTOR, intr_reschedule_handler);
+        register_handler(SPURIOUS_VECTOR, intr_spurious_handler);
+        lapic_timer_calibrate();
+    } else {
+        lapic_write(LAPIC_TIMER_DIV, TIMER_DIV_16);
+        lapic_write(LAPIC_LVT_TIMER, TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+        lapic_write(LAPIC_TIMER_INIT, lapic_timer_count);
+    }
+}
@@ -0,0 +1,19 @@
+#ifndef __DEVICE_LAPIC_H
+#define __DEVICE_LAPIC_H
+
+#include "stdint.h"
+#include "global.h"
+
+#define LAPIC_TIMER_VECTOR 0x30    // local APIC 定时器中断, 驱动 AP 上的调度
+#define RESCHEDULE_VECTOR 0x31     // 处理器间中断, 要求目标 cpu 重新调度
+#define SPURIOUS_VECTOR 0x3f       // 伪中断, 低 4 位必须全为 1
+
+bool lapic_present(void);
+void lapic_map(uint32_t phy_addr);
+void lapic_init(bool is_bsp);
+uint8_t lapic_id(void);
+void lapic_eoi(void);
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector);
+bool lapic_start_ap(uint8_t apic_id, uint32_t start_addr, volatile bool* started);
+
+#endif
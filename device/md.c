@@ -0,0 +1,314 @@
+#include "md.h"
+#include "blk.h"
+#include "ide.h"
+#include "fs.h"
+#include "global.h"
+#include "debug.h"
+#include "memory.h"
+#include "string.h"
+#include "stdio.h"
+#include "sync.h"
+#include "kernel/list.h"
+#include "kernel/stdio-kernel.h"
+
+static struct md_dev md_devs[MD_MAX_DEVS];
+static struct lock md_lock;        // 保护 md 设备的创建
+
+/* 按名称找分区, 找不到返回 NULL */
+static struct partition* find_partition(const char* name) {
+    struct list_elem* elem = partition_list.head.next;
+    while (elem != &partition_list.tail) {
+        struct partition* part = elem2entry(struct partition, part_tag, elem);
+        if (!strcmp(part->name, name)) {
+            return part;
+        }
+        elem = elem->next;
+    }
+    return NULL;
+}
+
+/* 分区 part 是否已是某个 md 设备的成员 */
+static bool is_md_member(struct partition* part) {
+    uint32_t dev_idx, idx;
+    for (dev_idx = 0; dev_idx < MD_MAX_DEVS; dev_idx++) {
+        struct md_dev* md = &md_devs[dev_idx];
+        if (!md->in_use) {
+            continue;
+        }
+        for (idx = 0; idx < md->member_cnt; idx++) {
+            if (md->members[idx] == part) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/* 成员 idx 读写出错, 此后不再使用它, 镜像设备靠其余成员继续运行 */
+static void md_fail_member(struct md_dev* md, uint32_t idx) {
+    if (md->faulty[idx]) {
+        return;
+    }
+    md->faulty[idx] = true;
+    uint32_t left = 0, member_idx;
+    for (member_idx = 0; member_idx < md->member_cnt; member_idx++) {
+        if (!md->faulty[member_idx]) {
+            left++;
+        }
+    }
+    printk("%s: %s failed, %d of %d members left\n", md->name, md->members[idx]->name, left, md->member_cnt);
+}
+
+/* 按名称找 md 设备, 找不到返回 NULL */
+struct md_dev* md_find(const char* name) {
+    uint32_t dev_idx;
+    for (dev_idx = 0; dev_idx < MD_MAX_DEVS; dev_idx++) {
+        if (md_devs[dev_idx].in_use && !strcmp(md_devs[dev_idx].name, name)) {
+            return &md_devs[dev_idx];
+        }
+    }
+    return NULL;
+}
+
+/* RAID0: 逻辑扇区 lba 在第 lba / chunk_sects 个条带中, 条带轮流放在各成员上.
+   按条带把读写拆成多个请求一起提交, 落在不同成员上的部分由各自的分派线程同时执行.
+   没有冗余, 任何一个成员出错整个读写就失败 */
+static int32_t raid0_rw(struct md_dev* md, uint32_t lba, void* buf, uint32_t sec_cnt, bool is_write) {
+    uint32_t chunk = md->chunk_sects;
+    uint32_t req_cnt = DIV_ROUND_UP(lba % chunk + sec_cnt, chunk);
+    struct blk_request* reqs = blk_alloc_requests(req_cnt);
+    if (reqs == NULL) {
+        return -1;
+    }
+    uint32_t idx = 0, secs_done = 0;
+    while (secs_done < sec_cnt) {
+        uint32_t cur_lba = lba + secs_done;
+        uint32_t chunk_no = cur_lba / chunk;
+        uint32_t chunk_off = cur_lba % chunk;
+        uint32_t secs_op = chunk - chunk_off;
+        if (secs_op > sec_cnt - secs_done) {
+            secs_op = sec_cnt - secs_done;
+        }
+        struct partition* part = md->members[chunk_no % md->member_cnt];
+        uint32_t member_lba = chunk_no / md->member_cnt * chunk + chunk_off;
+        blk_request_init(&reqs[idx], part->my_disk, part->start_lba + member_lba,
+                         (void*)((uint32_t)buf + secs_done * SECTOR_SIZE), secs_op, is_write);
+        blk_submit(&reqs[idx]);
+        idx++;
+        secs_done += secs_op;
+    }
+    blk_wait_all(reqs, idx);
+    int32_t ret = 0;
+    while (idx > 0) {
+        if (reqs[--idx].error != 0) {
+            ret = -1;
+        }
+    }
+    blk_free_requests(reqs, req_cnt);
+    return ret;
+}
+
+/* RAID1 写: 同一份数据一起提交给每个正常的成员, 全部完成后返回.
+   写失败的成员被踢出, 至少一个成员写成功就算成功 */
+static int32_t raid1_write(struct md_dev* md, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    struct blk_request reqs[MD_MAX_MEMBERS];
+    uint32_t member_idx[MD_MAX_MEMBERS];
+    uint32_t cnt = 0, idx;
+    for (idx = 0; idx < md->member_cnt; idx++) {
+        if (md->faulty[idx]) {
+            continue;
+        }
+        struct partition* part = md->members[idx];
+        blk_request_init(&reqs[cnt], part->my_disk, part->start_lba + lba, buf, sec_cnt, true);
+        blk_submit(&reqs[cnt]);
+        member_idx[cnt++] = idx;
+    }
+    blk_wait_all(reqs, cnt);
+
+    int32_t ret = -1;
+    for (idx = 0; idx < cnt; idx++) {
+        if (reqs[idx].error == 0) {
+            ret = 0;
+        } else {
+            md_fail_member(md, member_idx[idx]);
+        }
+    }
+    return ret;
+}
+
+/* 为读 lba 挑一个成员: 先挑未完成请求最少的, 一样多时挑磁头离 lba 最近的,
+   磁头位置取该盘上一条命令结束处. 这样并发的读者会分散到各个成员上,
+   一个读者的顺序读则留在同一个成员上. 没有可用的成员时返回 -1 */
+static int32_t raid1_pick(struct md_dev* md, uint32_t lba) {
+    int32_t best = -1;
+    uint32_t best_busy = 0, best_dist = 0, idx;
+    for (idx = 0; idx < md->member_cnt; idx++) {
+        if (md->faulty[idx]) {
+            continue;
+        }
+        struct partition* part = md->members[idx];
+        struct blk_queue* q = part->my_disk->queue;
+        /* 不加锁读取, 只用来估计, 读到稍旧的值也无妨 */
+        uint32_t busy = q->in_flight;
+        uint32_t pos = part->start_lba + lba;
+        uint32_t dist = (pos > q->head_pos ? pos - q->head_pos : q->head_pos - pos);
+        if (best == -1 || busy < best_busy || (busy == best_busy && dist < best_dist)) {
+            best = idx;
+            best_busy = busy;
+            best_dist = dist;
+        }
+    }
+    return best;
+}
+
+/* RAID1 读: 整个读交给 raid1_pick 挑出的一个成员. 读失败的成员被踢出, 换一个成员重读 */
+static int32_t raid1_read(struct md_dev* md, uint32_t lba, void* buf, uint32_t sec_cnt) {
+    while (1) {
+        int32_t idx = raid1_pick(md, lba);
+        if (idx == -1) {
+            return -1;
+        }
+        struct partition* part = md->members[idx];
+        if (blk_rw(part->my_disk, part->start_lba + lba, buf, sec_cnt, false) == 0) {
+            return 0;
+        }
+        md_fail_member(md, idx);
+    }
+}
+
+/* 读写 md 设备从 lba 起的 sec_cnt 个扇区, 成功返回 0; 越界、内存不足或成员出错返回 -1 */
+int32_t md_rw(struct md_dev* md, uint32_t lba, void* buf, uint32_t sec_cnt, bool is_write) {
+    if (lba >= md->sec_cnt || sec_cnt > md->sec_cnt - lba) {
+        return -1;
+    }
+    if (md->level == MD_RAID1) {
+        return is_write ? raid1_write(md, lba, buf, sec_cnt) : raid1_read(md, lba, buf, sec_cnt);
+    }
+    return raid0_rw(md, lba, buf, sec_cnt, is_write);
+}
+
+/* 按 cfg 组建一个 md 设备, 成功返回设备号 n, 设备名为 "mdn"; 失败返回 -1.
+   成员须是不同硬盘上的、未挂载且不属于其他 md 设备的分区, 在不同通道上时才能同时读写.
+   RAID1 组建时不做初始同步, 只有经 md 设备写过的扇区才保证各成员一致 */
+int32_t sys_md_create(const struct md_config* cfg) {
+    if (cfg->member_cnt < 2 || cfg->member_cnt > MD_MAX_MEMBERS ||
+        (cfg->level != MD_RAID0 && cfg->level != MD_RAID1) ||
+        (cfg->level == MD_RAID0 && cfg->chunk_sects == 0)) {
+        return -1;
+    }
+    lock_acquire(&md_lock);
+    int32_t dev_idx = 0;
+    while (dev_idx < MD_MAX_DEVS && md_devs[dev_idx].in_use) {
+        dev_idx++;
+    }
+    if (dev_idx == MD_MAX_DEVS) {
+        lock_release(&md_lock);
+        return -1;
+    }
+
+    struct md_dev* md = &md_devs[dev_idx];
+    uint32_t idx, prev, min_secs = 0xffffffff, present = 0;
+    for (idx = 0; idx < cfg->member_cnt; idx++) {
+        md->members[idx] = NULL;
+        md->faulty[idx] = true;
+        if (cfg->level == MD_RAID1 && !strcmp(cfg->members[idx], MD_MISSING)) {
+            continue;
+        }
+        struct partition* part = find_partition(cfg->members[idx]);
+        if (part == NULL || part == cur_part || is_md_member(part)) {
+            printk("md_create: %s not found or busy\n", cfg->members[idx]);
+            lock_release(&md_lock);
+            return -1;
+        }
+        for (prev = 0; prev < idx; prev++) {
+            struct partition* other = md->members[prev];
+            if (other == NULL) {
+                continue;
+            }
+            if (other->my_disk == part->my_disk) {
+                printk("md_create: %s and %s are on the same disk\n", other->name, part->name);
+                lock_release(&md_lock);
+                return -1;
+            }
+            if (other->my_disk->my_channel == part->my_disk->my_channel) {
+                printk("md_create: warning, %s and %s share %s and cannot transfer at the same time\n",
+                       other->name, part->name, part->my_disk->my_channel->name);
+            }
+        }
+        md->members[idx] = part;
+        md->faulty[idx] = false;
+        present++;
+        if (part->sec_cnt < min_secs) {
+            min_secs = part->sec_cnt;
+        }
+    }
+    if (present == 0 || (cfg->level == MD_RAID0 && min_secs < cfg->chunk_sects)) {
+        lock_release(&md_lock);
+        return -1;
+    }
+
+    md->level = cfg->level;
+    md->chunk_sects = cfg->chunk_sects;
+    md->member_cnt = cfg->member_cnt;
+    if (cfg->level == MD_RAID1) {
+        md->sec_cnt = min_secs;
+    } else {
+        md->sec_cnt = (min_secs - min_secs % cfg->chunk_sects) * cfg->member_cnt;
+    }
+    sprintf(md->name, "md%d", dev_idx);
+    md->in_use = true;  // 最后置位, 之后 md_find 才能找到它
+    lock_release(&md_lock);
+
+    if (cfg->level == MD_RAID1) {
+        printk("%s: raid1, %d of %d members, %d sectors%s\n", md->name, present, md->member_cnt,
+               md->sec_cnt, present < md->member_cnt ? ", degraded" : "");
+    } else {
+        printk("%s: raid0, %d members, chunk %d sectors, %d sectors\n",
+               md->name, md->member_cnt, md->chunk_sects, md->sec_cnt);
+    }
+    return dev_idx;
+}
+
+/* 用户缓冲区 [buf, buf + sec_cnt * 512) 是否都在用户空间且已映射.
+   分派线程会在这段内存上做 DMA 或 PIO, 出了问题就是内核缺页, 或设备写坏内核内存 */
+static bool user_buf_ok(void* buf, uint32_t sec_cnt) {
+    uint32_t start = (uint32_t)buf;
+    if (start == 0 || start >= 0xc0000000 || sec_cnt > (0xc0000000 - start) / SECTOR_SIZE) {
+        return false;
+    }
+    uint32_t end = start + sec_cnt * SECTOR_SIZE;
+    uint32_t vaddr = start & 0xfffff000;
+    while (vaddr < end) {
+        /* 页目录项不存在时访问 pte 会缺页, 先检查 pde */
+        if (!(*pde_ptr(vaddr) & PG_P_1) || (*pte_ptr(vaddr) & (PG_P_1 | PG_US_U)) != (PG_P_1 | PG_US_U)) {
+            return false;
+        }
+        vaddr += PG_SIZE;
+    }
+    return true;
+}
+
+/* 绕过文件系统直接读写分区或 md 设备, 成功返回 0, 失败返回 -1.
+   不允许直接写已挂载的分区和 md 设备的成员, 以免破坏其上的数据 */
+int32_t sys_blkio(const struct blkio* io) {
+    if (io->sec_cnt == 0 || !user_buf_ok(io->buf, io->sec_cnt)) {
+        return -1;
+    }
+    struct md_dev* md = md_find(io->dev);
+    if (md != NULL) {
+        return md_rw(md, io->lba, io->buf, io->sec_cnt, io->is_write);
+    }
+
+    struct partition* part = find_partition(io->dev);
+    if (part == NULL || io->lba >= part->sec_cnt || io->sec_cnt > part->sec_cnt - io->lba) {
+        return -1;
+    }
+    if (io->is_write && (part == cur_part || is_md_member(part))) {
+        return -1;
+    }
+    return blk_rw(part->my_disk, part->start_lba + io->lba, io->buf, io->sec_cnt, io->is_write);
+}
+
+void md_init(void) {
+    lock_init(&md_lock);
+}
@@ -0,0 +1,55 @@
+#ifndef __DEVICE_MD_H
+#define __DEVICE_MD_H
+
+#include "stdint.h"
+#include "global.h"
+
+#define MD_MAX_DEVS 4              // 最多的 md 设备数, 名为 md0~md3
+#define MD_MAX_MEMBERS 4           // 每个 md 设备最多的成员分区数
+
+/* md 设备把几个分区组合成一个逻辑块设备, 成员最好在不同的通道上, 这样各成员的读写能同时进行 */
+enum md_level {
+    MD_RAID0,                      // 条带: 按 chunk_sects 轮流放在各成员上, 容量是各成员之和
+    MD_RAID1                       // 镜像: 每个成员都存一份完整数据, 容量是最小的成员
+};
+
+#define MD_MISSING "missing"       // RAID1 的成员名可以写成它, 表示缺少该成员, 设备一开始就降级运行
+
+/* sys_md_create 的参数 */
+struct md_config {
+    uint32_t level;                // 取值见 enum md_level
+    uint32_t chunk_sects;          // 条带大小, 以扇区为单位, RAID1 不用
+    uint32_t member_cnt;
+    char members[MD_MAX_MEMBERS][8];  // 成员分区名, 如 "sdb5"
+};
+
+/* sys_blkio 的参数: 绕过文件系统直接读写分区或 md 设备, lba 从设备开头算起 */
+struct blkio {
+    char dev[8];                   // 分区名或 md 设备名, 如 "sdd1"、"md0"
+    uint32_t lba;
+    uint32_t sec_cnt;
+    void* buf;
+    uint32_t is_write;
+};
+
+struct partition;
+
+/* 一个 md 设备 */
+struct md_dev {
+    bool in_use;
+    char name[8];
+    uint32_t level;
+    uint32_t chunk_sects;
+    uint32_t member_cnt;
+    struct partition* members[MD_MAX_MEMBERS];  // 缺少的成员为 NULL
+    bool faulty[MD_MAX_MEMBERS];   // 成员读写出错或缺少时置位, 此后不再使用它
+    uint32_t sec_cnt;              // 逻辑容量
+};
+
+void md_init(void);
+struct md_dev* md_find(const char* name);
+int32_t md_rw(struct md_dev* md, uint32_t lba, void* buf, uint32_t sec_cnt, bool is_write);
+int32_t sys_md_create(const struct md_config* cfg);
+int32_t sys_blkio(const struct blkio* io);
+
+#endif
@@ -0,0 +1,84 @@
+#include "pci.h"
+#include "io.h"
+#include "global.h"
+#include "interrupt.h"
+#include "spinlock.h"
+
+/* 配置机制 1: 先把要访问的地址写入 CONFIG_ADDRESS, 再从 CONFIG_DATA 读写 */
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA    0xcfc
+
+#define PCI_HEADER_MULTI_FUNC 0x80  // header type 的第 7 位为 1 表示多功能设备
+
+/* CONFIG_ADDRESS 和 CONFIG_DATA 要成对访问, 中途不能被打断, 也不能与其他 cpu 交错.
+   静态变量初值为 0, 即未上锁 */
+static struct spinlock config_lock;
+
+/* 构造访问 bus:dev.func 配置空间 offset 处所在双字的地址 */
+static uint32_t config_addr(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset) {
+    return 0x80000000 | (uint32_t)bus << 16 | (uint32_t)dev << 11 | (uint32_t)func << 8 | (offset & 0xfc);
+}
+
+static uint32_t config_read(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset) {
+    enum intr_status old_status = spin_lock_irqsave(&config_lock);
+    outl(PCI_CONFIG_ADDRESS, config_addr(bus, dev, func, offset));
+    uint32_t value = inl(PCI_CONFIG_DATA);
+    spin_unlock_irqrestore(&config_lock, old_status);
+    return value;
+}
+
+uint32_t pci_read_config32(struct pci_dev* pdev, uint8_t offset) {
+    return config_read(pdev->bus, pdev->dev, pdev->func, offset);
+}
+
+uint16_t pci_read_config16(struct pci_dev* pdev, uint8_t offset) {
+    return pci_read_config32(pdev, offset) >> ((offset & 2) * 8);
+}
+
+uint8_t pci_read_config8(struct pci_dev* pdev, uint8_t offset) {
+    return pci_read_config32(pdev, offset) >> ((offset & 3) * 8);
+}
+
+/* 配置空间只能按双字访问, 写 16 位时先读出整个双字再改写其中一半 */
+void pci_write_config16(struct pci_dev* pdev, uint8_t offset, uint16_t value) {
+    uint32_t shift = (offset & 2) * 8;
+    enum intr_status old_status = spin_lock_irqsave(&config_lock);
+    outl(PCI_CONFIG_ADDRESS, config_addr(pdev->bus, pdev->dev, pdev->func, offset));
+    uint32_t dword = inl(PCI_CONFIG_DATA);
+    dword = (dword & ~(0xffff << shift)) | (uint32_t)value << shift;
+    outl(PCI_CONFIG_DATA, dword);
+    spin_unlock_irqrestore(&config_lock, old_status);
+}
+
+/* 逐个总线、设备、功能扫描, 找到第一个类别为 class_code:subclass 的功能填入 pdev.
+   单功能设备只看功能 0. 找到返回 true */
+bool pci_find_class(uint8_t class_code, uint8_t subclass, struct pci_dev* pdev) {
+    uint32_t bus, dev, func;
+    for (bus = 0; bus < 256; bus++) {
+        for (dev = 0; dev < 32; dev++) {
+            uint32_t func_cnt = 1;
+            for (func = 0; func < func_cnt; func++) {
+                uint32_t id = config_read(bus, dev, func, PCI_VENDOR_ID);
+                if ((id & 0xffff) == 0xffff) {
+                    continue;  // 不存在的功能读出全 1
+                }
+                if (func == 0 && (config_read(bus, dev, 0, PCI_HEADER_TYPE) >> 16) & PCI_HEADER_MULTI_FUNC) {
+                    func_cnt = 8;
+                }
+                uint32_t class_reg = config_read(bus, dev, func, PCI_PROG_IF);
+                if ((class_reg >> 24) == class_code && ((class_reg >> 16) & 0xff) == subclass) {
+                    pdev->bus = bus;
+                    pdev->dev = dev;
+                    pdev->func = func;
+                    pdev->vendor_id = id & 0xffff;
+                    pdev->device_id = id >> 16;
+                    pdev->class_code = class_code;
+                    pdev->subclass = subclass;
+                    pdev->prog_if = class_reg >> 8;
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
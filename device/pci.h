@@ -0,0 +1,40 @@
+#ifndef __DEVICE_PCI_H
+#define __DEVICE_PCI_H
+
+#include "stdint.h"
+#include "global.h"
+
+/* 配置空间中常用寄存器的偏移 */
+#define PCI_VENDOR_ID 0x00
+#define PCI_DEVICE_ID 0x02
+#define PCI_COMMAND   0x04
+#define PCI_PROG_IF   0x09
+#define PCI_SUBCLASS  0x0a
+#define PCI_CLASS     0x0b
+#define PCI_HEADER_TYPE 0x0e
+#define PCI_BAR4      0x20
+
+#define PCI_COMMAND_IO 0x1          // 响应 I/O 空间的访问
+#define PCI_COMMAND_MASTER 0x4      // 允许设备作为总线主控发起 DMA
+
+#define PCI_BAR_IO 0x1              // BAR 的第 0 位为 1 表示 I/O 空间
+
+/* 用总线号、设备号和功能号定位的一个 PCI 功能 */
+struct pci_dev {
+    uint8_t bus;
+    uint8_t dev;
+    uint8_t func;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+};
+
+uint32_t pci_read_config32(struct pci_dev* pdev, uint8_t offset);
+uint16_t pci_read_config16(struct pci_dev* pdev, uint8_t offset);
+uint8_t pci_read_config8(struct pci_dev* pdev, uint8_t offset);
+void pci_write_config16(struct pci_dev* pdev, uint8_t offset, uint16_t value);
+bool pci_find_class(uint8_t class_code, uint8_t subclass, struct pci_dev* pdev);
+
+#endif
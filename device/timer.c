@@ -3,20 +3,67 @@
 #include "kernel/print.h"
 #include "thread.h"
 #include "debug.h"
+#include "interrupt.h"
+#include "global.h"
+#include "div64.h"
+#include "smp.h"
+#include "vdso.h"
 
-#define IRQ0_FREQUENCY 100  // 时钟中断频率设置为每秒 100 次
+#define IRQ0_FREQUENCY HZ   // 时钟中断频率, 默认每秒 100 次, 见 global.h
 #define INPUT_FREQUENCY 1193180
-#define COUNTER0_VALUE INPUT_FREQUENCY / IRQ0_FREQUENCY
+#define COUNTER0_VALUE (INPUT_FREQUENCY / IRQ0_FREQUENCY)
 #define COUNTER0_PORT 0x40
 #define COUNTER_MODE 2
+#define COUNTER_MODE_ONESHOT 0  // 方式0, 计数到 0 时产生一次中断
 #define COUNTER0_NO 0
+#define COUNTER2_NO 2
+#define COUNTER2_PORT 0x42
 #define READ_WRITE_LATCH 3
+#define COUNTER_LATCH 0         // 锁存当前计数值, 供随后读出
+#define COUNTER0_MAX 0xffff     // 16 位计数器能装下的最大初值
 #define PIT_CONTROL_PORT 0x43
 
-#define mil_seconds_per_intr (1000 / IRQ0_FREQUENCY)  // 每多少毫秒发生一次中断
+/* 系统控制端口 B, 位0 为计数器2 的门控, 位1 控制扬声器, 位5 为计数器2 的输出 */
+#define PORT_B 0x61
+#define PORT_B_GATE2 0x01
+#define PORT_B_SPEAKER 0x02
+#define PORT_B_OUT2 0x20
+
+#define CALIBRATE_LATCH (INPUT_FREQUENCY / 100)  // 用计数器2 定时 10ms 来校准 TSC
+#define CALIBRATE_MAX_LOOPS 1000000             // 计数器2 迟迟不到期时放弃校准
+
+#define NSEC_PER_MSEC 1000000
+#define NSEC_PER_SEC 1000000000
+
+/* 单次定时最多能睡的嘀嗒数, 受 16 位计数器限制, 100Hz 时为 5 个嘀嗒 */
+#define NOHZ_MAX_TICKS (COUNTER0_MAX / COUNTER0_VALUE)
 
 uint32_t ticks;  // ticks 是内核自中断开启以来总共的嘀嗒数
 
+/* 高精度单调时钟以 TSC 为时基. tsc_khz 为 0 表示 cpu 不支持 TSC 或校准失败,
+   此时退化为以嘀嗒计时 */
+uint32_t tsc_khz;   // TSC 每毫秒走过的周期数
+uint64_t tsc_base;  // 校准完成时的 TSC 值, 作为单调时钟的零点
+uint32_t tsc_mult;  // 纳秒数 = 周期数 * tsc_mult >> TSC_SHIFT
+
+/* 定时器队列, 以到期时间 expires 为键的红黑树, 最左边的定时器最先到期.
+   定时器只在 BSP 的时钟中断中到期, 但任何 cpu 都可以增删定时器 */
+static struct rb_root timer_queue;
+static struct rb_node* timer_leftmost;  // 缓存最先到期的定时器, 时钟中断中只需看它一个
+static struct spinlock timer_lock;      // 保护定时器队列
+
+/* 无滴答(tickless)空闲: 只剩 idle 可运行时, 把 8253 改成单次定时,
+   直接定到下一个定时器到期的时刻, 中间不再产生周期性时钟中断 */
+static bool tick_stopped;        // 当前是否处于单次定时模式
+static uint32_t oneshot_ticks;   // 单次定时到期时应补记的嘀嗒数
+static uint32_t oneshot_cycles;  // 单次定时装入的计数初值
+static uint32_t oneshot_skew;    // 进入单次定时时, 当前这个周期已经走过的计数值
+
+/* ticks 会回绕, 按差值的符号比较先后, a 在 b 之前时返回 true */
+static bool time_before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
 /* 把操作的计数器 counter_no 、 读写锁属性rwl、计数器模式
 counter_mode 写入模式控制寄存器并赋予初始值 counter_value */
 // 计数器的端口号、所使用的计数器号、读写锁存方式、计数器工作模式、计数初值
@@ -30,40 +77,329 @@ static void frequency_set(uint8_t counter_port,
     /*先写入 counter_value 的低 8 位*/
     outb(counter_port, (uint8_t) counter_value);
     /*再写入 counter_value 的高 8 位 */
-    outb(counter_port, (uint8_t) counter_value >> 8);
+    outb(counter_port, (uint8_t) (counter_value >> 8));
 }
 
-/* 时钟的中断处理函数 */
-static void intr_timer_handler(void) {
-    struct task_struct* cur_thread = running_thread();
-    ASSERT(cur_thread->stack_magic == 0x19870916);  // 检查栈是否溢出
+/* 锁存并读出计数器 counter_no 的当前计数值 */
+static uint16_t counter_read(uint8_t counter_port, uint8_t counter_no) {
+    outb(PIT_CONTROL_PORT, (uint8_t) (counter_no << 6 | COUNTER_LATCH << 4));
+    uint8_t low = inb(counter_port);
+    uint8_t high = inb(counter_port);
+    return (uint16_t) (high << 8 | low);
+}
 
-    cur_thread->elapsed_ticks++;  // 记录此线程占用的 cpu 时间
-    ticks++;  // 从内核第一次处理时间中断后开始至今的嘀嗒数，内核态和用户态总共的嘀嗒数
+/* 用 cpuid 查询 cpu 是否支持 rdtsc 指令 */
+static bool cpu_has_tsc(void) {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+    return (edx & (1 << 4)) != 0;
+}
 
-    if (cur_thread->ticks == 0) {
-        schedule();  // 若进程时间片用完，就开始调度新的进程上 cpu
-    } else {
-        cur_thread->ticks--;  // 将当前进程的时间片-1, 之后当前线程 cur_thread 继续执行
+/* 打开计数器2 的门控并关掉扬声器, 返回端口 B 原来的值 */
+static uint8_t pit2_gate_on(void) {
+    uint8_t port_b = inb(PORT_B);
+    outb(PORT_B, (port_b & ~PORT_B_SPEAKER) | PORT_B_GATE2);
+    return port_b;
+}
+
+/* 让计数器2 从 latch 开始单次倒数. 方式0 下写入初值后输出变低, 计数到 0 时输出变高 */
+static void pit2_start(uint16_t latch) {
+    frequency_set(COUNTER2_PORT, COUNTER2_NO, READ_WRITE_LATCH, COUNTER_MODE_ONESHOT, latch);
+}
+
+/* 等待计数器2 数到 0, 迟迟等不到时返回 false */
+static bool pit2_wait(void) {
+    uint32_t loops = 0;
+    while (!(inb(PORT_B) & PORT_B_OUT2)) {
+        if (++loops == CALIBRATE_MAX_LOOPS) {
+            return false;
+        }
     }
+    return true;
 }
 
-/* 以 tick 为单位的 sleep ，任何时间形式的 sleep 会转换此 ticks 形式 */
-static void ticks_to_sleep(uint32_t sleep_ticks) {
-    uint32_t start_tick = ticks;
-    
-    while (ticks - start_tick < sleep_ticks) {
-        thread_yield();
+/* 忙等 u_seconds 微秒, 不依赖时钟中断, 可在开中断之前使用 */
+void udelay(uint32_t u_seconds) {
+    uint8_t port_b = pit2_gate_on();
+    while (u_seconds > 0) {
+        /* 计数器是 16 位的, 每次最多等约 54ms */
+        uint32_t us = u_seconds > 50000 ? 50000 : u_seconds;
+        uint32_t latch = us * (INPUT_FREQUENCY / 1000) / 1000;
+        pit2_start(latch > 0 ? latch : 1);
+        pit2_wait();
+        u_seconds -= us;
+    }
+    outb(PORT_B, port_b);
+}
+
+/* 用 8253 的计数器2 单次定时 10ms, 数出这段时间内 TSC 走过的周期数, 得到 TSC 的频率 */
+static void tsc_calibrate(void) {
+    if (!cpu_has_tsc()) {
+        put_str("   no tsc, clock falls back to ticks\n");
+        return;
+    }
+    uint8_t port_b = pit2_gate_on();
+    pit2_start(CALIBRATE_LATCH);
+    uint64_t start = rdtsc();
+    bool expired = pit2_wait();
+    uint64_t end = rdtsc();
+    outb(PORT_B, port_b);
+
+    if (!expired) {
+        put_str("   tsc calibration timed out, clock falls back to ticks\n");
+        return;
+    }
+    /* 实际定时为 CALIBRATE_LATCH / INPUT_FREQUENCY 秒, 按此换算成每毫秒的周期数 */
+    uint32_t khz = div_u64((end - start) * INPUT_FREQUENCY, CALIBRATE_LATCH * 1000);
+    if (khz < 1000) {
+        put_str("   tsc too slow, clock falls back to ticks\n");
+        return;  // 低于 1MHz 时 tsc_mult 会溢出, 也没有比嘀嗒更高的精度了
+    }
+    tsc_mult = div_u64((uint64_t) NSEC_PER_MSEC << TSC_SHIFT, khz);
+    tsc_base = end;
+    tsc_khz = khz;
+    put_str("   tsc khz: 0x");
+    put_int(tsc_khz);
+    put_char('\n');
+}
+
+/* 把 TSC 周期数换算成纳秒. 64 位乘 32 位会溢出, 故拆成高低两半分别计算 */
+static uint64_t cycles_to_ns(uint64_t cycles) {
+    uint32_t low = (uint32_t) cycles;
+    uint32_t high = (uint32_t) (cycles >> 32);
+    return ((uint64_t) high * tsc_mult << (32 - TSC_SHIFT)) + ((uint64_t) low * tsc_mult >> TSC_SHIFT);
+}
+
+/* 返回开机以来的单调时间, 单位纳秒 */
+uint64_t clock_monotonic_ns(void) {
+    if (tsc_khz == 0) {
+        return (uint64_t) ticks * (NSEC_PER_SEC / HZ);
+    }
+    return cycles_to_ns(rdtsc() - tsc_base);
+}
+
+/* 读取 clock_id 指定的时钟, 目前只支持 CLOCK_MONOTONIC. 成功返回 0, 失败返回 -1 */
+int32_t sys_clock_gettime(uint32_t clock_id, struct timespec* tp) {
+    if (clock_id != CLOCK_MONOTONIC || tp == NULL) {
+        return -1;
+    }
+    uint32_t nsec;
+    tp->tv_sec = (uint32_t) div_u64_rem(clock_monotonic_ns(), NSEC_PER_SEC, &nsec);
+    tp->tv_nsec = nsec;
+    return 0;
+}
+
+/* 恢复周期性时钟中断, 第一个周期只数 first 个计数, 使之后的中断仍落在原来的嘀嗒边界上.
+   方式2 下计数过程中写入的新初值要到本周期结束时才装入, 所以随后写入的 COUNTER0_VALUE 从第二个周期起生效 */
+static void tick_restart(uint16_t first) {
+    if (first < 2) {
+        first = 2;  // 方式2 的初值不能为 1
+    }
+    frequency_set(COUNTER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, COUNTER_MODE, first);
+    if (first != COUNTER0_VALUE) {
+        outb(COUNTER0_PORT, (uint8_t) COUNTER0_VALUE);
+        outb(COUNTER0_PORT, (uint8_t) (COUNTER0_VALUE >> 8));
+    }
+    tick_stopped = false;
+}
+
+/* idle 即将 hlt 前调用, 必须处于关中断状态.
+   若近期没有到期的定时器, 就把 8253 改为单次定时到下一个定时器到期的时刻 */
+void tick_nohz_idle_enter(void) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    ASSERT(!tick_stopped);
+    /* ticks 是全局时钟, 有其他 cpu 在运行时 BSP 的周期中断不能停 */
+    if (nr_cpus_online > 1) {
+        return;
+    }
+    uint32_t sleep_ticks = NOHZ_MAX_TICKS;
+    if (timer_leftmost != NULL) {
+        struct timer_list* timer = rb_entry(struct timer_list, node, timer_leftmost);
+        if (!time_before(ticks + 1, timer->expires)) {
+            return;  // 下个嘀嗒就要到期, 保持周期中断即可
+        }
+        if (timer->expires - ticks < sleep_ticks) {
+            sleep_ticks = timer->expires - ticks;
+        }
     }
+    if (sleep_ticks <= 1) {
+        return;
+    }
+
+    /* 单次定时从当前周期已走过的位置算起, 到期时刻与周期中断的边界对齐, 不会累积误差 */
+    uint16_t remain = counter_read(COUNTER0_PORT, COUNTER0_NO);
+    if (remain == 0 || remain > COUNTER0_VALUE) {
+        remain = COUNTER0_VALUE;
+    }
+    oneshot_skew = COUNTER0_VALUE - remain;
+    oneshot_ticks = sleep_ticks;
+    oneshot_cycles = (sleep_ticks - 1) * COUNTER0_VALUE + remain;
+    frequency_set(COUNTER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, COUNTER_MODE_ONESHOT, oneshot_cycles);
+    tick_stopped = true;
+}
+
+/* idle 被中断唤醒后调用. 若是被其他中断提前唤醒,
+   按计数器实际走过的值补记嘀嗒, 再恢复周期性时钟中断.
+   不足一个嘀嗒的零头不丢弃: 恢复后的第一个周期只数完当前嘀嗒剩下的部分 */
+void tick_nohz_idle_exit(void) {
+    enum intr_status old_status = intr_disable();
+    if (tick_stopped) {
+        uint16_t remain = counter_read(COUNTER0_PORT, COUNTER0_NO);
+        uint32_t elapsed_ticks = oneshot_ticks;
+        uint32_t first = COUNTER0_VALUE;
+        /* 计数到 0 后会回绕到 0xffff 继续减, 此时认为已整段睡完, 正好在嘀嗒边界上 */
+        if (remain <= oneshot_cycles) {
+            uint32_t consumed = oneshot_cycles - remain + oneshot_skew;  // 上一个嘀嗒边界以来走过的计数
+            elapsed_ticks = consumed / COUNTER0_VALUE;
+            first = COUNTER0_VALUE - consumed % COUNTER0_VALUE;
+        }
+        ticks += elapsed_ticks;
+        vdso_update();
+        running_thread()->elapsed_ticks += elapsed_ticks;
+        tick_restart(first);
+    }
+    intr_set_status(old_status);
+}
+
+/* 初始化定时器 timer, 到期后调用 function(data) */
+void init_timer(struct timer_list* timer, timer_func* function, void* data) {
+    timer->expires = 0;
+    timer->function = function;
+    timer->data = data;
+    timer->pending = false;
+}
+
+/* 将 timer 加入定时器队列, 调用前需设置好 timer->expires */
+void add_timer(struct timer_list* timer) {
+    enum intr_status old_status = spin_lock_irqsave(&timer_lock);
+    ASSERT(!timer->pending);
+    struct rb_node** link = &timer_queue.node;
+    struct rb_node* parent = NULL;
+    bool leftmost = true;
+
+    while (*link != NULL) {
+        parent = *link;
+        struct timer_list* entry = rb_entry(struct timer_list, node, parent);
+        if (time_before(timer->expires, entry->expires)) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+    if (leftmost) {
+        timer_leftmost = &timer->node;
+    }
+    rb_link_node(&timer->node, parent, link);
+    rb_insert_color(&timer->node, &timer_queue);
+    timer->pending = true;
+    spin_unlock_irqrestore(&timer_lock, old_status);
+}
+
+/* 摘除未到期的 timer ,此时 timer 还在队列中返回 true, 已到期或未加入过返回 false */
+bool del_timer(struct timer_list* timer) {
+    enum intr_status old_status = spin_lock_irqsave(&timer_lock);
+    bool was_pending = timer->pending;
+    if (was_pending) {
+        if (timer_leftmost == &timer->node) {
+            timer_leftmost = rb_next(&timer->node);
+        }
+        rb_erase(&timer->node, &timer_queue);
+        timer->pending = false;
+    }
+    spin_unlock_irqrestore(&timer_lock, old_status);
+    return was_pending;
+}
+
+/* 在时钟中断中处理所有已到期的定时器 */
+static void run_timers(void) {
+    spin_lock(&timer_lock);
+    while (timer_leftmost != NULL) {
+        struct timer_list* timer = rb_entry(struct timer_list, node, timer_leftmost);
+        if (time_before(ticks, timer->expires)) {
+            break;  // 最早的定时器都还没到期
+        }
+        timer_leftmost = rb_next(&timer->node);
+        rb_erase(&timer->node, &timer_queue);
+        timer->pending = false;
+        /* function 中可以重新 add_timer 来实现周期定时, 故调用时不能持锁 */
+        spin_unlock(&timer_lock);
+        timer->function(timer->data);
+        spin_lock(&timer_lock);
+    }
+    spin_unlock(&timer_lock);
+}
+
+/* 时钟的中断处理函数, 8253 只接在 BSP 上, 其他 cpu 由 local APIC 定时器驱动调度 */
+static void intr_timer_handler(void) {
+    uint32_t nr_ticks = 1;
+    if (tick_stopped) {
+        // 单次定时到期, 补记这段时间内省掉的嘀嗒, 恢复周期中断
+        nr_ticks = oneshot_ticks;
+        tick_restart(COUNTER0_VALUE);
+    }
+    ticks += nr_ticks;  // 从内核第一次处理时间中断后开始至今的嘀嗒数，内核态和用户态总共的嘀嗒数
+    vdso_update();
+
+    run_timers();  // 唤醒到期的睡眠者, 执行到期的内核定时器
+
+    sched_tick(nr_ticks);  // 给当前任务记账, 时间片用完就调度
+}
+
+/* 睡眠定时器到期, 唤醒睡眠的线程 */
+static void process_timeout(void* data) {
+    thread_unblock((struct task_struct*)data);
+}
+
+/* 以 tick 为单位的 sleep ，任何时间形式的 sleep 会转换此 ticks 形式.
+   睡眠期间线程阻塞, 不再参与调度, 由定时器到期时唤醒 */
+static void ticks_to_sleep(uint32_t sleep_ticks) {
+    struct timer_list timer;
+    init_timer(&timer, process_timeout, running_thread());
+
+    /* 先置为阻塞态再加入定时器, 定时器可能随即在 BSP 上到期并来唤醒自己 */
+    enum intr_status old_status = intr_disable();
+    running_thread()->status = TASK_BLOCKED;
+    timer.expires = ticks + sleep_ticks;
+    add_timer(&timer);
+    schedule();
+    intr_set_status(old_status);
+}
+
+/* 把毫秒数换算成嘀嗒数, 向上取整. 整秒和零头分开算, 避免 m_seconds * HZ 溢出 */
+uint32_t msecs_to_ticks(uint32_t m_seconds) {
+    return m_seconds / 1000 * HZ + DIV_ROUND_UP(m_seconds % 1000 * HZ, 1000);
 }
 
 /* 以毫秒为单位的 sleep 1秒＝1000毫秒 */
 void mtime_sleep(uint32_t m_seconds) {
-    uint32_t sleep_ticks = DIV_ROUND_UP(m_seconds, mil_seconds_per_intr);
+    uint32_t sleep_ticks = msecs_to_ticks(m_seconds);
     ASSERT(sleep_ticks > 0);
     ticks_to_sleep(sleep_ticks);
 }
 
+/* 睡眠 req 指定的时间, 按时钟嘀嗒向上取整.
+   睡眠不会被提前打断, 若 rem 不为空则将剩余时间置为 0. 成功返回 0, 参数非法返回 -1 */
+int32_t sys_nanosleep(const struct timespec* req, struct timespec* rem) {
+    if (req == NULL || req->tv_nsec >= NSEC_PER_SEC) {
+        return -1;
+    }
+    /* 防止秒数换算成嘀嗒时溢出, 100Hz 时最长只睡约 497 天 */
+    uint32_t max_sec = (0xffffffff - HZ) / HZ;
+    uint32_t sec = req->tv_sec > max_sec ? max_sec : req->tv_sec;
+    /* 纳秒先取整到微秒, 使乘以 HZ 时不溢出 */
+    uint32_t sleep_ticks = sec * HZ + DIV_ROUND_UP(DIV_ROUND_UP(req->tv_nsec, 1000) * HZ, 1000000);
+    if (sleep_ticks > 0) {
+        ticks_to_sleep(sleep_ticks);
+    } else {
+        thread_yield();
+    }
+    if (rem != NULL) {
+        rem->tv_sec = rem->tv_nsec = 0;
+    }
+    return 0;
+}
+
 /**
  * 初始化PIT 8253.
  */ 
@@ -71,6 +407,11 @@ void timer_init() {
     put_str("timer_init start.\n");
     /*设置 8253 的定时周期，也就是发中断的周期*/
     frequency_set(COUNTER0_PORT, COUNTER0_NO, READ_WRITE_LATCH, COUNTER_MODE, COUNTER0_VALUE);
+    tsc_calibrate();
+    spin_lock_init(&timer_lock);
+    rb_root_init(&timer_queue);
+    timer_leftmost = NULL;
+    tick_stopped = false;
     register_handler(0x20, intr_timer_handler);
     put_str("timer_init done.\n");
 }
@@ -1,5 +1,53 @@
 #ifndef __DEVICE_TIME_H
 #define __DEVICE_TIME_H
 #include "stdint.h"
+#include "kernel/rbtree.h"
+
+/* 定时器到期时在时钟中断中调用的函数, 此时处于关中断状态, 不可阻塞 */
+typedef void timer_func(void* arg);
+
+/* 内核定时器 */
+struct timer_list {
+    uint32_t expires;          // 到期时的 ticks
+    timer_func* function;      // 到期后调用的函数
+    void* data;                // 传给 function 的参数
+    bool pending;              // 是否已加入定时器队列且尚未到期
+    struct rb_node node;       // 用于定时器队列红黑树中的结点
+};
+
+/* clock_gettime 支持的时钟 */
+#define CLOCK_MONOTONIC 1          // 开机以来的单调时间, 纳秒精度
+
+/* 用户进程 nanosleep 和 clock_gettime 使用的时间结构 */
+struct timespec {
+    uint32_t tv_sec;           // 秒
+    uint32_t tv_nsec;          // 纳秒, 取值 0 ~ 999999999
+};
+
+#define TSC_SHIFT 22               // 周期数换算成纳秒时乘数的定点小数位数
+
+extern uint32_t ticks;
+extern uint32_t tsc_khz;
+extern uint64_t tsc_base;
+extern uint32_t tsc_mult;
+
+/* 读取 cpu 的时间戳计数器 */
+static inline uint64_t rdtsc(void) {
+    uint32_t low, high;
+    asm volatile ("rdtsc" : "=a" (low), "=d" (high));
+    return (uint64_t) high << 32 | low;
+}
+
 void timer_init(void);
-#endif
\ No newline at end of file
+void init_timer(struct timer_list* timer, timer_func* function, void* data);
+void add_timer(struct timer_list* timer);
+bool del_timer(struct timer_list* timer);
+void tick_nohz_idle_enter(void);
+void tick_nohz_idle_exit(void);
+uint32_t msecs_to_ticks(uint32_t m_seconds);
+void mtime_sleep(uint32_t m_seconds);
+int32_t sys_nanosleep(const struct timespec* req, struct timespec* rem);
+uint64_t clock_monotonic_ns(void);
+void udelay(uint32_t u_seconds);
+int32_t sys_clock_gettime(uint32_t clock_id, struct timespec* tp);
+#endif
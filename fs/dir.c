@@ -10,6 +10,7 @@
 #include "string.h"
 #include "interrupt.h"
 #include "super_block.h"
+#include "blk.h"
 
 struct dir root_dir;             // 根目录
 
@@ -28,9 +29,8 @@ struct dir* dir_open(struct partition* part, uint32_t inode_no) {
     return pdir;
 }
 
-/* 在part分区内的pdir目录内寻找名为name的文件或目录，
-   找到后返回true并将其目录项存入dir_e ，否则返回false  */
-bool search_dir_entry(struct partition* part, struct dir* pdir, const char* name, struct dir_entry* dir_e) {
+/* search_dir_entry 的实现, 调用时持有 pdir->inode 的读锁 */
+static bool search_dir_entry_locked(struct partition* part, struct dir* pdir, const char* name, struct dir_entry* dir_e) {
     uint32_t block_cnt = 140;  // 12个直接块＋128 个一级间接块＝140块                   
     uint32_t* all_blocks = (uint32_t*)sys_malloc(48 + 512);
     if (all_blocks == NULL) {
@@ -47,7 +47,7 @@ bool search_dir_entry(struct partition* part, struct dir* pdir, const char* name
 
     // 若含有一级间接块表
     if (pdir->inode->i_sectors[12] != 0) {
-        ide_read(part->my_disk, pdir->inode->i_sectors[12], all_blocks + 12, 1);
+        blk_read(part->my_disk, pdir->inode->i_sectors[12], all_blocks + 12, 1);
     }
     // 至此，all_blocks 存储的是该文件或目录的所有扇区地址
 
@@ -64,7 +64,7 @@ bool search_dir_entry(struct partition* part, struct dir* pdir, const char* name
             block_idx++;
             continue;
         }
-        ide_read(part->my_disk, all_blocks[block_idx], buf, 1);
+        blk_read(part->my_disk, all_blocks[block_idx], buf, 1);
 
         uint32_t dir_entry_idx = 0;
         // 遍历扇区中所有目录项
@@ -88,6 +88,15 @@ bool search_dir_entry(struct partition* part, struct dir* pdir, const char* name
     return false;
 }
 
+/* 在part分区内的pdir目录内寻找名为name的文件或目录，
+   找到后返回true并将其目录项存入dir_e ，否则返回false  */
+bool search_dir_entry(struct partition* part, struct dir* pdir, const char* name, struct dir_entry* dir_e) {
+    rw_read_acquire(&pdir->inode->i_rwlock);
+    bool found = search_dir_entry_locked(part, pdir, name, dir_e);
+    rw_read_release(&pdir->inode->i_rwlock);
+    return found;
+}
+
 /* 关闭目录 */
 void dir_close(struct dir* dir) {
     /* 根目录自打开后就不应该关闭，否则还需要再次open_root_dir();
@@ -107,8 +116,8 @@ void create_dir_entry(char* filename, uint32_t inode_no, uint8_t file_type, stru
     p_de->f_type = file_type;
 }
 
-/* 将目录项 p_de 写入父目录 parent_dir 中 ， io_buf 由主调函数提供 */
-bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf) {
+/* sync_dir_entry 的实现, 调用时持有 parent_dir->inode 的写锁 */
+static bool sync_dir_entry_locked(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf) {
     struct inode* dir_inode = parent_dir->inode;
     uint32_t dir_size = dir_inode->i_size;  // 目录项总大小
     uint32_t dir_entry_size = cur_part->sb->dir_entry_size;  // 单个目录项大小
@@ -159,7 +168,7 @@ bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf
                 // 发生错误归还上一个申请的块
                 if (block_lba == -1) {
                     block_bitmap_idx = dir_inode->i_sectors[12] - cur_part->sb->data_start_lba;
-                    bitmap_set(&cur_part->block_bitmap, block_bitmap_idx, 0);
+                    block_bitmap_free(cur_part, block_bitmap_idx);
                     dir_inode->i_sectors[12] = 0;
                     printk("alloc block bitmap for sync_dir_entry failed\n");
                     return false;
@@ -171,21 +180,21 @@ bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf
 
                 all_blocks[12] = block_lba;  // 第一个间接块
                 // 把新分配的第0个间接块地址写入一级间接块表
-                ide_write(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1); 
+                blk_write(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1); 
             } else {  // 若是间接块未分配
                 all_blocks[block_idx] = block_lba;
                 // 把新分配的第（block_idx-12）个间接块地址写入一级间接块表
-                ide_write(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
+                blk_write(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
             }
             // 再将新目录项 p_de 写入新分配的间接块
             memset(io_buf, 0, 512);
             memcpy(io_buf, p_de, dir_entry_size);
-            ide_write(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
+            blk_write(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
             dir_inode->i_size += dir_entry_size;
             return true;
         }
         /* 第 block_idx 块已存在，将其读进内存, 然后在该块中查找空目录项 */
-        ide_read(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
+        blk_read(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
         // 在扇区内查找空目录项
         uint8_t dir_entry_idx = 0;
         while (dir_entry_idx < dir_entrys_per_sec) {
@@ -193,7 +202,7 @@ bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf
                 /*  FT_ONKNOWN 为 0 ，无论是初始化，或是删除文件后，
                     都会将 f_type 置为 FT_UNKNOWN */ 
                 memcpy(dir_e + dir_entry_idx, p_de, dir_entry_size);
-                ide_write(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
+                blk_write(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
                 dir_inode->i_size += dir_entry_size;
                 return true;
             }
@@ -205,8 +214,16 @@ bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf
     return false;
 }
 
-/* 把分区 part 目录 pdir 中编号为 inode_no 的目录项删除 */
-bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_no, void* io_buf) {
+/* 将目录项 p_de 写入父目录 parent_dir 中 ， io_buf 由主调函数提供 */
+bool sync_dir_entry(struct dir* parent_dir, struct dir_entry* p_de, void* io_buf) {
+    rw_write_acquire(&parent_dir->inode->i_rwlock);
+    bool ret = sync_dir_entry_locked(parent_dir, p_de, io_buf);
+    rw_write_release(&parent_dir->inode->i_rwlock);
+    return ret;
+}
+
+/* delete_dir_entry 的实现, 调用时持有 pdir->inode 的写锁 */
+static bool delete_dir_entry_locked(struct partition* part, struct dir* pdir, uint32_t inode_no, void* io_buf) {
     struct inode* dir_inode = pdir->inode;
     uint32_t block_idx = 0, all_blocks[140] = {0};
     while (block_idx < 12) {
@@ -214,7 +231,7 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
         block_idx++;
     }    
     if (dir_inode->i_sectors[12]) {
-        ide_read(part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
+        blk_read(part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
     }
 
     // 目录项在存储时保证不会跨扇区
@@ -237,7 +254,7 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
         dir_entry_idx = dir_entry_cnt = 0;
         memset(io_buf, 0, SECTOR_SIZE);
         // 读取扇区，获得目录项
-        ide_read(part->my_disk, all_blocks[block_idx], io_buf, 1);
+        blk_read(part->my_disk, all_blocks[block_idx], io_buf, 1);
 
         // 遍历所有的目录项，统计该扇区的目录项数量及是否有待删除的目录项
         while (dir_entry_idx < dir_entry_per_sec) {
@@ -267,7 +284,7 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
         if (dir_entry_cnt == 1 && !is_dir_first_block) {
             /* a 在块位图中回收该块 */
             uint32_t block_bitmap_idx = all_blocks[block_idx] - part->sb->data_start_lba;
-            bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
+            block_bitmap_free(part, block_bitmap_idx);
             bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
 
             /* b 将块地址从数组 i_sectors 或索引表中去掉 */
@@ -288,11 +305,11 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
                 // 间接索引表中还包括其他间接块，仅在索引表中擦除当前这个间接块地址
                 if (indirect_blocks > 1) {
                     all_blocks[block_idx] = 0;
-                    ide_write(part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
+                    blk_write(part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
                 // 间接索引表中就当前这1个间接块, 直接把间接索引表所在的块回收，然后擦除间接索引表块地址
                 } else {
                     block_bitmap_idx = dir_inode->i_sectors[12] - part->sb->data_start_lba;
-                    bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
+                    block_bitmap_free(part, block_bitmap_idx);
                     bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
                     dir_inode->i_sectors[12] = 0;  // 将间接索引表地址清 0
                 }
@@ -300,7 +317,7 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
         // 仅将该目录项清空
         } else {
             memset(dir_entry_found, 0, dir_entry_size);
-            ide_write(part->my_disk, all_blocks[block_idx], io_buf, 1);
+            blk_write(part->my_disk, all_blocks[block_idx], io_buf, 1);
         }
         // 更新 i 结点信息并同步到硬盘
         ASSERT(dir_inode->i_size >= dir_entry_size);
@@ -314,8 +331,16 @@ bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_n
     return false;
 }
 
-/* 读取目录，成功返回 1 个目录项，失败返回 NULL */
-struct dir_entry* dir_read(struct dir* dir) {
+/* 把分区 part 目录 pdir 中编号为 inode_no 的目录项删除 */
+bool delete_dir_entry(struct partition* part, struct dir* pdir, uint32_t inode_no, void* io_buf) {
+    rw_write_acquire(&pdir->inode->i_rwlock);
+    bool ret = delete_dir_entry_locked(part, pdir, inode_no, io_buf);
+    rw_write_release(&pdir->inode->i_rwlock);
+    return ret;
+}
+
+/* dir_read 的实现, 调用时持有 dir->inode 的读锁 */
+static struct dir_entry* dir_read_locked(struct dir* dir) {
     struct dir_entry* dir_e = (struct dir_entry*)dir->dir_buf;
     struct inode* dir_inode = dir->inode;
     uint32_t all_blocks[140] = {0}, block_cnt = 12;
@@ -326,7 +351,7 @@ struct dir_entry* dir_read(struct dir* dir) {
         block_idx++;
     }
     if (dir_inode->i_sectors[12] != 0) {
-        ide_read(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
+        blk_read(cur_part->my_disk, dir_inode->i_sectors[12], all_blocks + 12, 1);
         block_cnt = 140;
     }
     block_idx = 0;
@@ -345,7 +370,7 @@ struct dir_entry* dir_read(struct dir* dir) {
             continue;
         }
         memset(dir_e, 0, SECTOR_SIZE);
-        ide_read(cur_part->my_disk, all_blocks[block_idx], dir_e, 1);
+        blk_read(cur_part->my_disk, all_blocks[block_idx], dir_e, 1);
         dir_entry_idx = 0;
         // 遍历扇区内所有目录项
         while (dir_entry_idx < dir_entrys_per_sec) {
@@ -368,6 +393,14 @@ struct dir_entry* dir_read(struct dir* dir) {
     return NULL;
 }
 
+/* 读取目录，成功返回 1 个目录项，失败返回 NULL */
+struct dir_entry* dir_read(struct dir* dir) {
+    rw_read_acquire(&dir->inode->i_rwlock);
+    struct dir_entry* dir_e = dir_read_locked(dir);
+    rw_read_release(&dir->inode->i_rwlock);
+    return dir_e;
+}
+
 /* 判断目录是否为空 */
 bool dir_is_empty(struct dir* dir) {
     struct inode* dir_inode = dir->inode;
@@ -9,10 +9,13 @@
 #include "string.h"
 #include "thread.h"
 #include "global.h"
+#include "spinlock.h"
+#include "blk.h"
 
 #define DEFAULT_SECS 1
 
 struct file file_table[MAX_FILE_OPEN];  // 文件表 
+static struct spinlock write_deny_lock;  // 保护各 inode 的 write_deny, 全零即为未上锁
 
 
 /* 从文件表 file_table 中获取一个空闲位，成功返回下标，失败返回 -1 */ 
@@ -34,7 +37,7 @@ int32_t get_free_slot_in_global(void) {
 /* 将全局描述符下标安装到进程或线程自己的文件描述符数组 fd_table 中，
    成功返回下标，失败返回-1 */
 int32_t pcb_fd_install(int32_t global_fd_idx) {
-    struct task_struct* cur = running_thread();
+    struct task_struct* cur = running_thread()->group_leader;  // 同一进程的线程共用主线程的 fd_table
     uint8_t local_fd_idx = 3;
     while (local_fd_idx < MAX_FILES_OPEN_PER_PROC) {  // =8
         if (cur->fd_table[local_fd_idx] == -1) {
@@ -52,24 +55,43 @@ int32_t pcb_fd_install(int32_t global_fd_idx) {
 
 /* 位图中分配一个i结点，返回i结点号 */
 int32_t inode_bitmap_alloc(struct partition* part) {
+    lock_acquire(&part->alloc_lock);
     int32_t bit_idx = bitmap_scan(&part->inode_bitmap, 1);
-    if (bit_idx == -1) {
-        return -1;
+    if (bit_idx != -1) {
+        bitmap_set(&part->inode_bitmap, bit_idx, 1);
     }
-    bitmap_set(&part->inode_bitmap, bit_idx, 1);
+    lock_release(&part->alloc_lock);
     return bit_idx;
 }
 
 /* 分配 1 个扇区，返回其扇区地址 */
 int32_t block_bitmap_alloc(struct partition* part) {
+    lock_acquire(&part->alloc_lock);
     int32_t bit_idx = bitmap_scan(&part->block_bitmap, 1);
+    if (bit_idx != -1) {
+        bitmap_set(&part->block_bitmap, bit_idx, 1);
+    }
+    lock_release(&part->alloc_lock);
     if (bit_idx == -1) {
         return -1;
     }
-    bitmap_set(&part->block_bitmap, bit_idx, 1);
     return (part->sb->data_start_lba + bit_idx);
 }
 
+/* 在内存中的 inode 位图里归还 i 结点 inode_no, 需要时由调用者再 bitmap_sync */
+void inode_bitmap_free(struct partition* part, uint32_t inode_no) {
+    lock_acquire(&part->alloc_lock);
+    bitmap_set(&part->inode_bitmap, inode_no, 0);
+    lock_release(&part->alloc_lock);
+}
+
+/* 在内存中的块位图里归还第 bit_idx 块, 需要时由调用者再 bitmap_sync */
+void block_bitmap_free(struct partition* part, uint32_t bit_idx) {
+    lock_acquire(&part->alloc_lock);
+    bitmap_set(&part->block_bitmap, bit_idx, 0);
+    lock_release(&part->alloc_lock);
+}
+
 /* 将内存中 bitmap 第 bit_idx 位所在的 512 字节同步到硬盘 */
 void bitmap_sync(struct partition* part, uint32_t bit_idx, uint8_t btmp) {
     // 索引相对于位图的扇区偏移量, 一个扇区有4096位
@@ -89,7 +111,10 @@ void bitmap_sync(struct partition* part, uint32_t bit_idx, uint8_t btmp) {
             bitmap_off = part->block_bitmap.bits + off_size;
             break;
     }
-    ide_write(part->my_disk, sec_lba, bitmap_off, 1);
+    // 写盘期间位图不能变, 否则可能把别人的修改覆盖成旧值
+    lock_acquire(&part->alloc_lock);
+    blk_write(part->my_disk, sec_lba, bitmap_off, 1);
+    lock_release(&part->alloc_lock);
 }
 
 /* 创建文件，若成功则返回文件描述符，否则返回-1  */
@@ -150,7 +175,9 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
     memset(io_buf, 0, 1024);
 
     /* b 将父目录 i 结点的内容同步到硬盘 */
+    rw_read_acquire(&parent_dir->inode->i_rwlock);
     inode_sync(cur_part, parent_dir->inode, io_buf);
+    rw_read_release(&parent_dir->inode->i_rwlock);
     memset(io_buf, 0, 1024);
 
     /* c 将新创建文件的 i 结点内容同步到硬盘 */
@@ -158,10 +185,10 @@ int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag) {
 
     /* d 将 inode_bitmap 位图同步到硬盘 */
     bitmap_sync(cur_part, inode_no, INODE_BITMAP);
+    ide_flush(cur_part->my_disk);  // 元信息可能还在硬盘的写缓存中, 刷到盘片上
 
     /* e 将创建的文件 i 结点添加到 open_inodes 链表 */
-    list_push(&cur_part->open_inodes, &new_file_inode->inode_tag);
-    new_file_inode->i_open_cnts = 1;
+    inode_add_open(cur_part, new_file_inode);
 
     sys_free(io_buf);
     return pcb_fd_install(fd_idx);
@@ -174,7 +201,7 @@ rollback:
         case 2:
             sys_free(new_file_inode);
         case 1:
-            bitmap_set(&cur_part->inode_bitmap, inode_no, 0);
+            inode_bitmap_free(cur_part, inode_no);
             break;
     }
     sys_free(io_buf);
@@ -198,15 +225,15 @@ int32_t file_open(uint32_t inode_no, uint8_t flag) {
     /* 只要是关于写文件，判断是否有其他进程正写此文件
        若是读文件，不考虑 write_deny */
     if (flag & O_WRONLY || flag & O_RDWR) {
-        // 以下进入临界区前先关中断
-        enum intr_status old_status = intr_disable();
+        // 以下进入临界区前先关中断并持锁, 其他 cpu 上的进程可能同时在打开此文件
+        enum intr_status old_status = spin_lock_irqsave(&write_deny_lock);
         // 若当前没有其他进程写该文件，将其占用
         if (!(*write_deny)) {
             *write_deny = true;  // 置为 true ，避免多个进程同时写此文件
-            intr_set_status(old_status);  // 恢复中断
+            spin_unlock_irqrestore(&write_deny_lock, old_status);  // 恢复中断
         // 直接失败返回
         } else {
-            intr_set_status(old_status);
+            spin_unlock_irqrestore(&write_deny_lock, old_status);
             printk("file can't be written now, try again later\n");
             return -1;
         }
@@ -226,8 +253,8 @@ int32_t file_close(struct file* file) {
     return 0;
 }
 
-/* 把buf中的count个字节写入file, 成功则返回写入的字节数，失败则返回-1 */
-int32_t file_write(struct file* file, const void* buf, uint32_t count) {
+/* file_write 的实现, 调用时持有文件 inode 的写锁 */
+static int32_t file_write_locked(struct file* file, const void* buf, uint32_t count) {
     // 文件目前最大只支持 512*140=71680 字节
     if ((file->fd_inode->i_size + count) > (BLOCK_SIZE * 140)) {
         printk("exceed max file_size 71680 bytes, write file failed\n");
@@ -292,7 +319,7 @@ int32_t file_write(struct file* file, const void* buf, uint32_t count) {
         } else {
             ASSERT(file->fd_inode->i_sectors[12] != 0);
             indirect_block_table = file->fd_inode->i_sectors[12];
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
+            blk_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
         }
     // 若有增量，便涉及到分配新扇区及是否分配一级间接块表，下面要分三种情况处理
     } else {
@@ -360,14 +387,14 @@ int32_t file_write(struct file* file, const void* buf, uint32_t count) {
                 block_idx++;  // 下一个新扇区
             }
             // 同步一级间接块表到硬盘
-            ide_write(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
+            blk_write(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
         // 第三种情况：新数据占据间接块
         } else if (file_has_used_blocks > 12) {
             // 已经具备了一级间接块表
             ASSERT(file->fd_inode->i_sectors[12] != 0);
             indirect_block_table = file->fd_inode->i_sectors[12];
             // 获取所有间接块地址
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
+            blk_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
             // 第一个未使用的间接块，即已经使用的间接块的下一块
             block_idx = file_has_used_blocks; 
 
@@ -383,7 +410,7 @@ int32_t file_write(struct file* file, const void* buf, uint32_t count) {
                 bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
             }
             // 同步一级间接块表到硬盘
-            ide_write(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
+            blk_write(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
         }
     }
 
@@ -400,11 +427,11 @@ int32_t file_write(struct file* file, const void* buf, uint32_t count) {
         // 判断此次写入硬盘的数据大小
         chunk_size = size_left < sec_left_bytes ? size_left : sec_left_bytes;
         if (first_write_block) {
-            ide_read(cur_part->my_disk, sec_lba, io_buf, 1);
+            blk_read(cur_part->my_disk, sec_lba, io_buf, 1);
             first_write_block = false;
         }
         memcpy(io_buf + sec_off_bytes, src, chunk_size);
-        ide_write(cur_part->my_disk, sec_lba, io_buf, 1);
+        blk_write(cur_part->my_disk, sec_lba, io_buf, 1);
         printk("file write at lba 0x%x\n", sec_lba);
         src += chunk_size;  // 将指针推移到下个新数据
         file->fd_inode->i_size += chunk_size;  // 更新文件大小
@@ -413,34 +440,55 @@ int32_t file_write(struct file* file, const void* buf, uint32_t count) {
         size_left -= chunk_size;
     }
     inode_sync(cur_part, file->fd_inode, io_buf);
+    ide_flush(cur_part->my_disk);  // 新分配的块和 inode 都要落盘
     sys_free(all_blocks);
     sys_free(io_buf);
     return bytes_written;
 }
 
-/* 从文件 file 中读取 count 个字节写入 buf, 返回读出的字节数，若到文件尾则返回-1 */
-int32_t file_read(struct file* file, void* buf, uint32_t count) {
+/* 把buf中的count个字节写入file, 成功则返回写入的字节数，失败则返回-1 */
+int32_t file_write(struct file* file, const void* buf, uint32_t count) {
+    rw_write_acquire(&file->fd_inode->i_rwlock);
+    int32_t ret = file_write_locked(file, buf, count);
+    rw_write_release(&file->fd_inode->i_rwlock);
+    return ret;
+}
+
+/* file_read 的实现, 调用时持有文件 inode 的读锁, 其他任务可同时读此文件 */
+static int32_t file_read_locked(struct file* file, void* buf, uint32_t count) {
     uint8_t* buf_dst = (uint8_t*)buf;
-    uint32_t size = count, size_left = size;
+    uint32_t size = count;
 
     /* 若要读取的字节数超过了文件可读的剩余量，
        就用剩余量作为待读取的字节数 */
     if ((file->fd_pos + count) > file->fd_inode->i_size) {
         size = file->fd_inode->i_size - file->fd_pos;
-        size_left = size;
         if (size == 0) {
             return -1;  // 若到文件尾，则返回-1
         }
     }
+    if (size == 0) {
+        return 0;
+    }
 
-    uint8_t* io_buf = sys_malloc(BLOCK_SIZE);
+    uint32_t sec_first = file->fd_pos / BLOCK_SIZE;  // 要读的第一个块在文件中的下标
+    uint32_t sec_cnt = (file->fd_pos + size - 1) / BLOCK_SIZE - sec_first + 1;  // 涉及的块数
+    uint8_t* io_buf = sys_malloc(sec_cnt * BLOCK_SIZE);
     if (io_buf == NULL) {
         printk("file_read: sys_malloc for io_buf failed\n");
         return -1;
     }
+    struct blk_request* reqs = blk_alloc_requests(sec_cnt);
+    if (reqs == NULL) {
+        printk("file_read: blk_alloc_requests failed\n");
+        sys_free(io_buf);
+        return -1;
+    }
     uint32_t* all_blocks = (uint32_t*)sys_malloc(BLOCK_SIZE + 48);
     if (all_blocks == NULL) {
         printk("file_read: sys_malloc for all_blocks failed\n");
+        blk_free_requests(reqs, sec_cnt);
+        sys_free(io_buf);
         return -1;
     }
 
@@ -464,7 +512,7 @@ int32_t file_read(struct file* file, void* buf, uint32_t count) {
         // 若用到了一级间接块表，需要将表中间接块读进来
         } else {
             indirect_block_table = file->fd_inode->i_sectors[12];
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
+            blk_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
         }
     // 若要读多个块
     } else {
@@ -486,34 +534,36 @@ int32_t file_read(struct file* file, void* buf, uint32_t count) {
             ASSERT(file->fd_inode->i_sectors[12] != 0);
             // 再将间接块地址写入 all_blocks
             indirect_block_table = file->fd_inode->i_sectors[12];
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
+            blk_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
         // 第三种情况：数据在间接块中
         } else {
             ASSERT(file->fd_inode->i_sectors[12] != 0);
             indirect_block_table = file->fd_inode->i_sectors[12];
-            ide_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
+            blk_read(cur_part->my_disk, indirect_block_table, all_blocks + 12, 1);
         }
     }
     // 用到的块地址已经收集到 all_blocks 中，下面开始读数据
-    uint32_t sec_idx, sec_lba, sec_off_bytes, sec_left_bytes, chunk_size;
-    uint32_t bytes_read = 0;
-    while (bytes_read < size) {
-        sec_idx = file->fd_pos / BLOCK_SIZE;
-        sec_lba = all_blocks[sec_idx];
-        sec_off_bytes = file->fd_pos % BLOCK_SIZE;
-        sec_left_bytes = BLOCK_SIZE - sec_off_bytes;
-        chunk_size = size_left < sec_left_bytes ? size_left : sec_left_bytes;  // 待读入的数据大小
-
-        memset(io_buf, 0, BLOCK_SIZE);
-        ide_read(cur_part->my_disk, sec_lba, io_buf, 1);
-        memcpy(buf_dst, io_buf + sec_off_bytes, chunk_size);
-
-        buf_dst += chunk_size;
-        file->fd_pos += chunk_size;
-        bytes_read += chunk_size;
-        size_left -= chunk_size;
+    /* 先把所有块的读请求一起提交再统一等待, 块设备层会把盘上相邻的块合并成一条命令 */
+    uint32_t sec_idx;
+    for (sec_idx = 0; sec_idx < sec_cnt; sec_idx++) {
+        blk_request_init(&reqs[sec_idx], cur_part->my_disk, all_blocks[sec_first + sec_idx],
+                         io_buf + sec_idx * BLOCK_SIZE, 1, false);
+        blk_submit(&reqs[sec_idx]);
     }
+    blk_wait_all(reqs, sec_cnt);
+
+    memcpy(buf_dst, io_buf + file->fd_pos % BLOCK_SIZE, size);
+    file->fd_pos += size;
     sys_free(all_blocks);
+    blk_free_requests(reqs, sec_cnt);
     sys_free(io_buf);   
-    return bytes_read;
-}
\ No newline at end of file
+    return size;
+}
+
+/* 从文件 file 中读取 count 个字节写入 buf, 返回读出的字节数，若到文件尾则返回-1 */
+int32_t file_read(struct file* file, void* buf, uint32_t count) {
+    rw_read_acquire(&file->fd_inode->i_rwlock);
+    int32_t ret = file_read_locked(file, buf, count);
+    rw_read_release(&file->fd_inode->i_rwlock);
+    return ret;
+}
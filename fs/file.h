@@ -32,6 +32,8 @@ extern struct file file_table[MAX_FILE_OPEN];
 
 int32_t inode_bitmap_alloc(struct partition* part);
 int32_t block_bitmap_alloc(struct partition* part);
+void inode_bitmap_free(struct partition* part, uint32_t inode_no);
+void block_bitmap_free(struct partition* part, uint32_t bit_idx);
 int32_t file_create(struct dir* parent_dir, char* filename, uint8_t flag);
 void bitmap_sync(struct partition* part, uint32_t bit_idx, uint8_t btmp);
 int32_t get_free_slot_in_global(void);
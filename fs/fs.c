@@ -7,6 +7,7 @@
 #include "list.h"
 #include "string.h"
 #include "ide.h"
+#include "blk.h"
 #include "global.h"
 #include "debug.h"
 #include "memory.h"
@@ -40,7 +41,7 @@ static bool mount_partition(struct list_elem *pelem, int arg)
 
         /* 读入超级块 */
         memset(sb_buf, 0, SECTOR_SIZE);
-        ide_read(hd, cur_part->start_lba + 1, sb_buf, 1);
+        blk_read(hd, cur_part->start_lba + 1, sb_buf, 1);
 
         /* 把sb_buf中超级块的信息复制到分区的超级块sb中。*/
         memcpy(cur_part->sb, sb_buf, sizeof(struct super_block));
@@ -53,7 +54,7 @@ static bool mount_partition(struct list_elem *pelem, int arg)
         }
         cur_part->block_bitmap.btmp_bytes_len = sb_buf->block_bitmap_sects * SECTOR_SIZE;
         /* 从硬盘上读入块位图到分区的block_bitmap.bits */
-        ide_read(hd, sb_buf->block_bitmap_lba, cur_part->block_bitmap.bits, sb_buf->block_bitmap_sects);
+        blk_read(hd, sb_buf->block_bitmap_lba, cur_part->block_bitmap.bits, sb_buf->block_bitmap_sects);
         /*************************************************************/
 
         /**********     将硬盘上的inode位图读入到内存    ************/
@@ -64,10 +65,11 @@ static bool mount_partition(struct list_elem *pelem, int arg)
         }
         cur_part->inode_bitmap.btmp_bytes_len = sb_buf->inode_bitmap_sects * SECTOR_SIZE;
         /* 从硬盘上读入inode位图到分区的inode_bitmap.bits */
-        ide_read(hd, sb_buf->inode_bitmap_lba, cur_part->inode_bitmap.bits, sb_buf->inode_bitmap_sects);
+        blk_read(hd, sb_buf->inode_bitmap_lba, cur_part->inode_bitmap.bits, sb_buf->inode_bitmap_sects);
         /*************************************************************/
 
         list_init(&cur_part->open_inodes);
+        lock_init(&cur_part->alloc_lock);
         printk("mount %s done!\n", part->name);
 
         /* 此处返回true是为了迎合主调函数list_traversal的实现,与函数本身功能无关。
@@ -84,7 +86,7 @@ static void partition_format(struct partition *part)
     uint32_t boot_sector_sects = 1;
     uint32_t super_block_sects = 1;
     uint32_t inode_bitmap_sects = DIV_ROUND_UP(MAX_FILES_PER_PART, BITS_PER_SECTOR); // I结点位图占用的扇区数.最多支持4096个文件
-    uint32_t inode_table_sects = DIV_ROUND_UP(((sizeof(struct inode) * MAX_FILES_PER_PART)), SECTOR_SIZE);
+    uint32_t inode_table_sects = DIV_ROUND_UP(((INODE_DISK_SIZE * MAX_FILES_PER_PART)), SECTOR_SIZE);
     uint32_t used_sects = boot_sector_sects + super_block_sects + inode_bitmap_sects + inode_table_sects;
     uint32_t free_sects = part->sec_cnt - used_sects;
 
@@ -123,7 +125,7 @@ static void partition_format(struct partition *part)
     /*******************************
  * 1 将超级块写入本分区的1扇区 *
  ******************************/
-    ide_write(hd, part->start_lba + 1, &sb, 1);
+    blk_write(hd, part->start_lba + 1, &sb, 1);
     printk("   super_block_lba:0x%x\n", part->start_lba + 1);
 
     /* 找出数据量最大的元信息,用其尺寸做存储缓冲区*/
@@ -149,7 +151,7 @@ static void partition_format(struct partition *part)
     {
         buf[block_bitmap_last_byte] &= ~(1 << bit_idx++);
     }
-    ide_write(hd, sb.block_bitmap_lba, buf, sb.block_bitmap_sects);
+    blk_write(hd, sb.block_bitmap_lba, buf, sb.block_bitmap_sects);
 
     /***************************************
  * 3 将inode位图初始化并写入sb.inode_bitmap_lba *
@@ -161,7 +163,7 @@ static void partition_format(struct partition *part)
     * 即inode_bitmap_sects等于1, 所以位图中的位全都代表inode_table中的inode,
     * 无须再像block_bitmap那样单独处理最后一扇区的剩余部分,
     * inode_bitmap所在的扇区中没有多余的无效位 */
-    ide_write(hd, sb.inode_bitmap_lba, buf, sb.inode_bitmap_sects);
+    blk_write(hd, sb.inode_bitmap_lba, buf, sb.inode_bitmap_sects);
 
     /***************************************
  * 4 将inode数组初始化并写入sb.inode_table_lba *
@@ -172,7 +174,7 @@ static void partition_format(struct partition *part)
     i->i_size = sb.dir_entry_size * 2;   // .和..
     i->i_no = 0;                         // 根目录占inode数组中第0个inode
     i->i_sectors[0] = sb.data_start_lba; // 由于上面的memset,i_sectors数组的其它元素都初始化为0
-    ide_write(hd, sb.inode_table_lba, buf, sb.inode_table_sects);
+    blk_write(hd, sb.inode_table_lba, buf, sb.inode_table_sects);
 
     /***************************************
  * 5 将根目录初始化并写入sb.data_start_lba
@@ -193,9 +195,10 @@ static void partition_format(struct partition *part)
     p_de->f_type = FT_DIRECTORY;
 
     /* sb.data_start_lba已经分配给了根目录,里面是根目录的目录项 */
-    ide_write(hd, sb.data_start_lba, buf, 1);
+    blk_write(hd, sb.data_start_lba, buf, 1);
 
     printk("   root_dir_lba:0x%x\n", sb.data_start_lba);
+    ide_flush(hd); // 元信息须全部落盘, 否则断电后分区处于半格式化状态
     printk("%s format done\n", part->name);
     sys_free(buf);
 }
@@ -400,7 +403,7 @@ int32_t sys_open(const char *pathname, uint8_t flags)
 /* 将文件描述符转化为文件表的下标 */
 uint32_t fd_local2global(uint32_t local_fd)
 {
-    struct task_struct *cur = running_thread();
+    struct task_struct *cur = running_thread()->group_leader; // 同一进程的线程共用主线程的fd_table
     int32_t global_fd = cur->fd_table[local_fd];
     ASSERT(global_fd >= 0 && global_fd < MAX_FILE_OPEN);
     return (uint32_t)global_fd;
@@ -427,7 +430,7 @@ int32_t sys_close(int32_t fd)
         {
             ret = file_close(&file_table[global_fd]);
         }
-        running_thread()->fd_table[fd] = -1; // 使该文件描述符位可用
+        running_thread()->group_leader->fd_table[fd] = -1; // 使该文件描述符位可用
     }
     return ret;
 }
@@ -692,7 +695,7 @@ int32_t sys_mkdir(const char *pathname)
     memcpy(p_de->filename, "..", 2);
     p_de->i_no = parent_dir->inode->i_no;
     p_de->f_type = FT_DIRECTORY;
-    ide_write(cur_part->my_disk, new_dir_inode.i_sectors[0], io_buf, 1);
+    blk_write(cur_part->my_disk, new_dir_inode.i_sectors[0], io_buf, 1);
 
     new_dir_inode.i_size = 2 * cur_part->sb->dir_entry_size;
 
@@ -710,7 +713,9 @@ int32_t sys_mkdir(const char *pathname)
 
     /* 父目录的inode同步到硬盘 */
     memset(io_buf, 0, SECTOR_SIZE * 2);
+    rw_read_acquire(&parent_dir->inode->i_rwlock);
     inode_sync(cur_part, parent_dir->inode, io_buf);
+    rw_read_release(&parent_dir->inode->i_rwlock);
 
     /* 将新创建目录的inode同步到硬盘 */
     memset(io_buf, 0, SECTOR_SIZE * 2);
@@ -718,6 +723,7 @@ int32_t sys_mkdir(const char *pathname)
 
     /* 将inode位图同步到硬盘 */
     bitmap_sync(cur_part, inode_no, INODE_BITMAP);
+    ide_flush(cur_part->my_disk);  // 元信息可能还在硬盘的写缓存中, 刷到盘片上
 
     sys_free(io_buf);
 
@@ -730,7 +736,7 @@ rollback: // 因为某步骤操作失败而回滚
     switch (rollback_step)
     {
     case 2:
-        bitmap_set(&cur_part->inode_bitmap, inode_no, 0); // 如果新文件的inode创建失败,之前位图中分配的inode_no也要恢复
+        inode_bitmap_free(cur_part, inode_no); // 如果新文件的inode创建失败,之前位图中分配的inode_no也要恢复
     case 1:
         /* 关闭所创建目录的父目录 */
         dir_close(searched_record.parent_dir);
@@ -847,7 +853,7 @@ static uint32_t get_parent_dir_inode_nr(uint32_t child_inode_nr, void *io_buf)
     uint32_t block_lba = child_dir_inode->i_sectors[0];
     ASSERT(block_lba >= cur_part->sb->data_start_lba);
     inode_close(child_dir_inode);
-    ide_read(cur_part->my_disk, block_lba, io_buf, 1);
+    blk_read(cur_part->my_disk, block_lba, io_buf, 1);
     struct dir_entry *dir_e = (struct dir_entry *)io_buf;
     /* 第0个目录项是".",第1个目录项是".." */
     ASSERT(dir_e[1].i_no < 4096 && dir_e[1].f_type == FT_DIRECTORY);
@@ -869,7 +875,7 @@ static int get_child_dir_name(uint32_t p_inode_nr, uint32_t c_inode_nr, char *pa
     }
     if (parent_dir_inode->i_sectors[12])
     { // 若包含了一级间接块表,将共读入all_blocks.
-        ide_read(cur_part->my_disk, parent_dir_inode->i_sectors[12], all_blocks + 12, 1);
+        blk_read(cur_part->my_disk, parent_dir_inode->i_sectors[12], all_blocks + 12, 1);
         block_cnt = 140;
     }
     inode_close(parent_dir_inode);
@@ -883,7 +889,7 @@ static int get_child_dir_name(uint32_t p_inode_nr, uint32_t c_inode_nr, char *pa
     {
         if (all_blocks[block_idx])
         { // 如果相应块不为空则读入相应块
-            ide_read(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
+            blk_read(cur_part->my_disk, all_blocks[block_idx], io_buf, 1);
             uint8_t dir_e_idx = 0;
             /* 遍历每个目录项 */
             while (dir_e_idx < dir_entrys_per_sec)
@@ -1016,6 +1022,25 @@ int32_t sys_stat(const char *path, struct stat *buf)
     return ret;
 }
 
+/* 文件系统直接读写硬盘, 没有自己的缓存, 只需把各硬盘的写缓存刷到盘片上.
+   成功返回0,有硬盘刷新失败时返回-1 */
+int32_t sys_sync(void)
+{
+    int32_t ret = 0;
+    uint8_t channel_no, dev_no;
+    for (channel_no = 0; channel_no < channel_cnt; channel_no++)
+    {
+        for (dev_no = 0; dev_no < 2; dev_no++)
+        {
+            if (ide_flush(&channels[channel_no].devices[dev_no]) == -1)
+            {
+                ret = -1;
+            }
+        }
+    }
+    return ret;
+}
+
 /* 向屏幕输出一个字符 */
 void sys_putchar(char char_asci)
 {
@@ -1035,6 +1060,8 @@ void sys_help(void)
        pwd: show current work directory\n\
        ps: show process information\n\
        clear: clear screen\n\
+       strace: count system calls, e.g. strace -c ls -l\n\
+       sync: flush disk write caches\n\
  shortcut key:\n\
        ctrl+l: clear screen\n\
        ctrl+u: clear input\n\n");
@@ -1081,7 +1108,7 @@ void filesys_init()
                     memset(sb_buf, 0, SECTOR_SIZE);
 
                     /* 读出分区的超级块,根据魔数是否正确来判断是否存在文件系统 */
-                    ide_read(hd, part->start_lba + 1, sb_buf, 1);
+                    blk_read(hd, part->start_lba + 1, sb_buf, 1);
 
                     /* 只支持自己的文件系统.若磁盘上已经有文件系统就不再格式化了 */
                     if (sb_buf->magic == 0x19590318)
@@ -72,6 +72,7 @@ int32_t sys_rmdir(const char* pathname);
 char* sys_getcwd(char* buf, uint32_t size);
 int32_t sys_chdir(const char* path);
 int32_t sys_stat(const char* path, struct stat* buf);
+int32_t sys_sync(void);
 void sys_putchar(char char_asci);
 uint32_t fd_local2global(uint32_t local_fd);
 void sys_help(void);
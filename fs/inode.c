@@ -9,7 +9,11 @@
 #include "kernel/stdio-kernel.h"
 #include "string.h"
 #include "super_block.h"
+#include "spinlock.h"
+#include "blk.h"
 
+/* 保护各分区的 open_inodes 链表和其中 inode 的 i_open_cnts, 全零即为未上锁 */
+static struct spinlock open_inodes_lock;
 
 // 用来存储 inode 位置
 struct inode_position {
@@ -24,7 +28,7 @@ static void inode_locate(struct partition* part, uint32_t inode_no, struct inode
     ASSERT(inode_no < 4096);
     uint32_t inode_table_lba = part->sb->inode_table_lba;
 
-    uint32_t inode_size = sizeof(struct inode);
+    uint32_t inode_size = INODE_DISK_SIZE;
     // 第 inode_no 号 I 结点相对于 inode_table_lba 的字节偏移量
     uint32_t off_size = inode_no * inode_size;
     // 第 inode_no 号 I 结点相对于 inode_table_lba 的扇区偏移量
@@ -56,7 +60,7 @@ void inode_sync(struct partition* part, struct inode* inode, void* io_buf) {
     /* 硬盘中的 inode 中的成员inode_tag 和 i_open_cnts 是不需要的，
        它们只在内存中记录链表位置和被多少进程共享 */
     struct inode pure_inode;
-    memcpy(&pure_inode, inode, sizeof(struct inode));
+    memcpy(&pure_inode, inode, INODE_DISK_SIZE);
 
     /* 以下 inode 的三个成员只存在于内存中，
        现在将 inode 同步到硬盘，清掉这三项即可 */
@@ -65,33 +69,47 @@ void inode_sync(struct partition* part, struct inode* inode, void* io_buf) {
     pure_inode.inode_tag.prev = pure_inode.inode_tag.next = NULL;
 
     char* inode_buf = (char*)io_buf;
+    // 一个扇区中有多个 inode, 读改写期间不能让别人改同一扇区
+    lock_acquire(&part->alloc_lock);
     // 若是跨了两个扇区，就要读出两个扇区再写入两个扇区
     if (inode_pos.two_sec) {
         /* 读写硬盘是以扇区为单位，若写入的数据小于一扇区，
            要将原硬盘上的内容先读出来再和新数据拼成一扇区后再写入 */
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
-        memcpy((inode_buf + inode_pos.off_size), &pure_inode, sizeof(struct inode));
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
+        blk_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
+        memcpy((inode_buf + inode_pos.off_size), &pure_inode, INODE_DISK_SIZE);
+        blk_write(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
     } else {
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
-        memcpy((inode_buf + inode_pos.off_size), &pure_inode, sizeof(struct inode));
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+        blk_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+        memcpy((inode_buf + inode_pos.off_size), &pure_inode, INODE_DISK_SIZE);
+        blk_write(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
     }
+    lock_release(&part->alloc_lock);
 }
 
-/* 根据 i 结点号返回相应的 i 结点 */
-struct inode* inode_open(struct partition* part, uint32_t inode_no) {
-    // 先在已打开的 inode 链表中找 inode ，此链表是为提速创建的缓冲区
+/* 在分区 part 已打开的 inode 中找编号为 inode_no 的, 找到则增加其打开数.
+   调用时持有 open_inodes_lock */
+static struct inode* inode_find_open(struct partition* part, uint32_t inode_no) {
     struct list_elem* elem = part->open_inodes.head.next;
-    struct inode* inode_found;
     while (elem != &part->open_inodes.tail) {
-        inode_found = elem2entry(struct inode, inode_tag, elem);
-        if (inode_found->i_no == inode_no) {
-            inode_found->i_open_cnts++;
-            return inode_found;
+        struct inode* inode = elem2entry(struct inode, inode_tag, elem);
+        if (inode->i_no == inode_no) {
+            inode->i_open_cnts++;
+            return inode;
         }
         elem = elem->next;
     }
+    return NULL;
+}
+
+/* 根据 i 结点号返回相应的 i 结点 */
+struct inode* inode_open(struct partition* part, uint32_t inode_no) {
+    // 先在已打开的 inode 链表中找 inode ，此链表是为提速创建的缓冲区
+    enum intr_status old_status = spin_lock_irqsave(&open_inodes_lock);
+    struct inode* inode_found = inode_find_open(part, inode_no);
+    spin_unlock_irqrestore(&open_inodes_lock, old_status);
+    if (inode_found != NULL) {
+        return inode_found;
+    }
 
     // 由于 open_inodes 链表中找不到，下面从硬盘上读入此 inode 并加入到此链表
     struct inode_position inode_pos;
@@ -104,33 +122,60 @@ struct inode* inode_open(struct partition* part, uint32_t inode_no) {
     struct task_struct* cur = running_thread();
     uint32_t* cur_pagedir_bak = cur->pgdir;
     cur->pgdir = NULL;
-    inode_found = (struct inode*)sys_malloc(sizeof(struct inode));
+    struct inode* new_inode = (struct inode*)sys_malloc(sizeof(struct inode));
     cur->pgdir = cur_pagedir_bak;
 
     char* inode_buf;
     if (inode_pos.two_sec) {
         inode_buf = (char*)sys_malloc(1024);
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
+        blk_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
     } else {
         inode_buf = (char*)sys_malloc(512);
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+        blk_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
     }
-    memcpy(inode_found, inode_buf + inode_pos.off_size, sizeof(struct inode));
+    memcpy(new_inode, inode_buf + inode_pos.off_size, INODE_DISK_SIZE);
+    rwlock_init(&new_inode->i_rwlock);
+    sys_free(inode_buf);
 
-    // 因为一会很可能要用到此 inode ，故将其插入到队首便于提前检索到
-    list_push(&part->open_inodes, &inode_found->inode_tag);
-    inode_found->i_open_cnts = 1;
+    /* 读硬盘期间别人可能已打开了同一个 inode, 那就用它的, 丢掉自己读的 */
+    old_status = spin_lock_irqsave(&open_inodes_lock);
+    inode_found = inode_find_open(part, inode_no);
+    if (inode_found == NULL) {
+        // 因为一会很可能要用到此 inode ，故将其插入到队首便于提前检索到
+        list_push(&part->open_inodes, &new_inode->inode_tag);
+        new_inode->i_open_cnts = 1;
+        inode_found = new_inode;
+        new_inode = NULL;
+    }
+    spin_unlock_irqrestore(&open_inodes_lock, old_status);
 
-    sys_free(inode_buf);
+    if (new_inode != NULL) {
+        cur->pgdir = NULL;
+        sys_free(new_inode);
+        cur->pgdir = cur_pagedir_bak;
+    }
     return inode_found;
 }
 
+/* 把新建文件的 inode 加入分区 part 的已打开 inode 链表, 打开数为 1 */
+void inode_add_open(struct partition* part, struct inode* inode) {
+    enum intr_status old_status = spin_lock_irqsave(&open_inodes_lock);
+    list_push(&part->open_inodes, &inode->inode_tag);
+    inode->i_open_cnts = 1;
+    spin_unlock_irqrestore(&open_inodes_lock, old_status);
+}
+
 /* 关闭 inode 或减少 inode 的打开数 */
 void inode_close(struct inode* inode) {
     // 若没有进程再打开此文件，将此 inode 去掉并释放空间
-    enum intr_status old_status = intr_disable();
-    if (--inode->i_open_cnts == 0) {
+    enum intr_status old_status = spin_lock_irqsave(&open_inodes_lock);
+    bool last = (--inode->i_open_cnts == 0);
+    if (last) {
         list_remove(&inode->inode_tag);  // 将I结点从part->open_inodes中去掉
+    }
+    spin_unlock_irqrestore(&open_inodes_lock, old_status);
+
+    if (last) {
         /* inode_open 时为实现 inode 被所有进程共享，
            已经在 sys_malloc 为 inode 分配了内核空间，
            释放inode时也要确保释放的是内核内存池 */
@@ -140,7 +185,6 @@ void inode_close(struct inode* inode) {
         sys_free(inode);
         cur->pgdir = cur_pagedir_bak;
     }
-    intr_set_status(old_status);
 }
 
 /* 将硬盘分区 part 上的 inode 清空 */
@@ -151,17 +195,19 @@ void inode_delete(struct partition* part, uint32_t inode_no, void* io_buf) {
     ASSERT(inode_pos.sec_lba <= (part->start_lba + part->sec_cnt));
 
     char* inode_buf = (char*)io_buf;
+    lock_acquire(&part->alloc_lock);
     // inode 跨扇区，读入 2 个扇区
     if (inode_pos.two_sec) {
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
-        memset((inode_buf + inode_pos.off_size), 0, sizeof(struct inode));
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 2);  // 清0后覆盖
+        blk_read(part->my_disk, inode_pos.sec_lba, inode_buf, 2);
+        memset((inode_buf + inode_pos.off_size), 0, INODE_DISK_SIZE);
+        blk_write(part->my_disk, inode_pos.sec_lba, inode_buf, 2);  // 清0后覆盖
     // 未跨扇区，只读入 1 个扇区就好
     } else {
-        ide_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
-        memset((inode_buf + inode_pos.off_size), 0, sizeof(struct inode));
-        ide_write(part->my_disk, inode_pos.sec_lba, inode_buf, 1);  // 清0后覆盖
+        blk_read(part->my_disk, inode_pos.sec_lba, inode_buf, 1);
+        memset((inode_buf + inode_pos.off_size), 0, INODE_DISK_SIZE);
+        blk_write(part->my_disk, inode_pos.sec_lba, inode_buf, 1);  // 清0后覆盖
     }
+    lock_release(&part->alloc_lock);
 }
 
 /* 回收inode的数据块和inode本身 */
@@ -183,13 +229,13 @@ void inode_release(struct partition* part, uint32_t inode_no) {
     /* b 如果一级间接块表存在，将其 128 个间接块读到 all_blocks[12~]，
          并释放一级间接块表所占的扇区 */
     if (inode_to_del->i_sectors[12] != 0) {
-        ide_read(part->my_disk, inode_to_del->i_sectors[12], all_blocks + 12, 1);
+        blk_read(part->my_disk, inode_to_del->i_sectors[12], all_blocks + 12, 1);
         block_cnt = 140;
 
         // 回收一级间接块表占用的扇区
         block_bitmap_idx = inode_to_del->i_sectors[12] - part->sb->data_start_lba;
         ASSERT(block_bitmap_idx > 0);
-        bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
+        block_bitmap_free(part, block_bitmap_idx);
         bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
     }
 
@@ -200,14 +246,14 @@ void inode_release(struct partition* part, uint32_t inode_no) {
             block_bitmap_idx = 0;
             block_bitmap_idx = all_blocks[block_idx] - part->sb->data_start_lba;
             ASSERT(block_bitmap_idx > 0);
-            bitmap_set(&part->block_bitmap, block_bitmap_idx, 0);
+            block_bitmap_free(part, block_bitmap_idx);
             bitmap_sync(cur_part, block_bitmap_idx, BLOCK_BITMAP);
         }
         block_idx++;
     }
 
     /* 2 回收该 inode 所占用的 inode */
-    bitmap_set(&part->inode_bitmap, inode_no, 0);
+    inode_bitmap_free(part, inode_no);
     bitmap_sync(cur_part, inode_no, INODE_BITMAP);
 
     /* 以下 inode_delete 是调试用的 
@@ -219,6 +265,9 @@ void inode_release(struct partition* part, uint32_t inode_no) {
     sys_free(io_buf);
     /****/
 
+    /* 删除文件和目录都到这里为止, 把删目录项和回收 inode、块时的写入一起刷到盘片上 */
+    ide_flush(part->my_disk);
+
     inode_close(inode_to_del);
 }
 
@@ -228,6 +277,7 @@ void inode_init(uint32_t inode_no, struct inode* new_inode) {
     new_inode->i_size = 0;
     new_inode->i_open_cnts = 0;
     new_inode->write_deny = false;
+    rwlock_init(&new_inode->i_rwlock);
 
     // 初始化块索引数组 i_sector
     uint8_t sec_idx = 0;
@@ -3,6 +3,7 @@
 
 #include "stdint.h"
 #include "kernel/list.h"
+#include "sync.h"
 
 // inode
 struct inode {
@@ -16,6 +17,22 @@ struct inode {
     /* i_sectors[0-11］是直接块， i_sectors[12]用来存储一级间接块指针 */
     uint32_t i_sectors[13];
     struct list_elem inode_tag;
+
+    /* 以下成员只在内存中, 不写入硬盘 */
+    struct rwlock i_rwlock;       // 读文件或目录时持读锁, 修改其内容和 inode 时持写锁
 };
 
+/* 硬盘上 inode 的大小, 即 i_rwlock 之前的部分 */
+#define INODE_DISK_SIZE ((uint32_t)offset(struct inode, i_rwlock))
+
+struct partition;
+
+void inode_sync(struct partition* part, struct inode* inode, void* io_buf);
+struct inode* inode_open(struct partition* part, uint32_t inode_no);
+void inode_add_open(struct partition* part, struct inode* inode);
+void inode_close(struct inode* inode);
+void inode_delete(struct partition* part, uint32_t inode_no, void* io_buf);
+void inode_release(struct partition* part, uint32_t inode_no);
+void inode_init(uint32_t inode_no, struct inode* new_inode);
+
 #endif
\ No newline at end of file
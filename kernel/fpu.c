@@ -0,0 +1,212 @@
+#include "fpu.h"
+#include "global.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "string.h"
+#include "thread.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "kernel/print.h"
+
+#define NM_VECTOR 0x07             // #NM 设备不可用异常
+
+#define CR0_MP 0x00000002          // 与 TS 配合, 使 wait/fwait 也触发 #NM
+#define CR0_EM 0x00000004          // 置位时所有 FPU 指令都触发 #NM, 须清除
+#define CR0_TS 0x00000008          // 任务切换标志, 置位时 FPU 指令触发 #NM
+#define CR0_NE 0x00000020          // 浮点错误以 #MF 异常报告
+#define CR4_OSFXSR 0x00000200      // 允许 FXSAVE/FXRSTOR 和 SSE 指令
+#define CR4_OSXMMEXCPT 0x00000400  // SSE 浮点错误以 #XM 异常报告
+
+#define CPUID_FXSR (1 << 24)
+#define CPUID_SSE (1 << 25)
+
+/* 空闲的 FXSAVE 区域链在一起, 从内核页中按 FPU_STATE_SIZE 切分出来, 用完不归还 */
+struct fpu_area {
+    struct fpu_area* next;
+};
+
+static bool fpu_enabled;           // cpu 支持 FXSAVE 时才启用 FPU
+static struct fpu_area* free_areas;
+static struct spinlock area_lock;
+/* fninit 之后的初始状态, 任务第一次使用 FPU 时从这里装入 */
+static uint8_t fpu_init_state[FPU_STATE_SIZE] __attribute__ ((aligned (16)));
+
+static inline uint32_t read_cr0(void) {
+    uint32_t cr0;
+    asm volatile ("movl %%cr0, %0" : "=r" (cr0));
+    return cr0;
+}
+
+static inline void write_cr0(uint32_t cr0) {
+    asm volatile ("movl %0, %%cr0" : : "r" (cr0) : "memory");
+}
+
+/* 清除 CR0.TS, 此后执行 FPU 指令不再触发 #NM */
+static inline void clts(void) {
+    asm volatile ("clts" : : : "memory");
+}
+
+/* 置位 CR0.TS, 下一条 FPU 指令将触发 #NM */
+static inline void stts(void) {
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+static inline void fxsave(void* area) {
+    asm volatile ("fxsave %0" : "=m" (*(uint8_t(*)[FPU_STATE_SIZE])area));
+}
+
+static inline void fxrstor(void* area) {
+    asm volatile ("fxrstor %0" : : "m" (*(uint8_t(*)[FPU_STATE_SIZE])area));
+}
+
+/* 分配一块 FXSAVE 区域, 空闲链表为空时申请一页切分. 可能睡眠, 失败返回 NULL */
+static void* fpu_area_alloc(void) {
+    enum intr_status old_status = spin_lock_irqsave(&area_lock);
+    if (free_areas == NULL) {
+        spin_unlock_irqrestore(&area_lock, old_status);
+        uint8_t* page = get_kernel_pages(1);
+        if (page == NULL) {
+            return NULL;
+        }
+        old_status = spin_lock_irqsave(&area_lock);
+        uint32_t offset;
+        for (offset = 0; offset < PG_SIZE; offset += FPU_STATE_SIZE) {
+            struct fpu_area* area = (struct fpu_area*)(page + offset);
+            area->next = free_areas;
+            free_areas = area;
+        }
+    }
+    struct fpu_area* area = free_areas;
+    free_areas = area->next;
+    spin_unlock_irqrestore(&area_lock, old_status);
+    return area;
+}
+
+static void fpu_area_free(void* ptr) {
+    struct fpu_area* area = ptr;
+    enum intr_status old_status = spin_lock_irqsave(&area_lock);
+    area->next = free_areas;
+    free_areas = area;
+    spin_unlock_irqrestore(&area_lock, old_status);
+}
+
+/* #NM 处理程序: 当前任务要用 FPU, 而 FPU 中还是别的任务的状态 */
+static void intr_nm_handler(void) {
+    struct task_struct* cur = running_thread();
+    if (cur->fpu_state == NULL) {
+        // 分配时可能睡眠, 醒来后可能已换了 cpu, 所以之后再取 this_cpu
+        void* area = fpu_area_alloc();
+        if (area == NULL) {
+            PANIC("intr_nm_handler: no memory for fpu state\n");
+        }
+        memcpy(area, fpu_init_state, FPU_STATE_SIZE);
+        cur->fpu_state = area;
+    }
+
+    struct cpu* c = this_cpu();
+    clts();
+    if (c->fpu_owner != cur) {
+        if (c->fpu_owner != NULL) {
+            fxsave(c->fpu_owner->fpu_state);
+        }
+        fxrstor(cur->fpu_state);
+        c->fpu_owner = cur;
+    }
+}
+
+/* 任务切换时在 schedule 中调用, 此时持有本 cpu 的 rq->lock.
+   FPU 中恰好是 next 的状态时不必再陷入 #NM */
+void fpu_switch(struct cpu* c, struct task_struct* prev, struct task_struct* next) {
+    if (!fpu_enabled) {
+        return;
+    }
+    /* 退出的任务即将被回收, 它的状态不用再保存 */
+    if (c->fpu_owner == prev && (prev->status == TASK_HANGING || prev->status == TASK_DIED)) {
+        c->fpu_owner = NULL;
+    }
+    if (c->fpu_owner == next) {
+        clts();
+    } else {
+        stts();
+    }
+}
+
+/* fork 时复制父进程 parent 的 FPU 状态给子进程 child, 成功返回 0, 失败返回 -1 */
+int32_t fpu_fork(struct task_struct* child, struct task_struct* parent) {
+    child->fpu_state = NULL;
+    if (parent->fpu_state == NULL) {
+        return 0;
+    }
+    void* area = fpu_area_alloc();
+    if (area == NULL) {
+        return -1;
+    }
+    /* 父进程的最新状态可能还在 FPU 中, fxsave 不改变 FPU 中的内容 */
+    enum intr_status old_status = intr_disable();
+    if (this_cpu()->fpu_owner == parent) {
+        clts();
+        fxsave(parent->fpu_state);
+    }
+    intr_set_status(old_status);
+    memcpy(area, parent->fpu_state, FPU_STATE_SIZE);
+    child->fpu_state = area;
+    return 0;
+}
+
+/* 释放 pthread 的 FPU 状态, 任务退出或 execv 时调用.
+   pthread 是当前任务时先放弃本 cpu 的 FPU; 其他任务都已在换下 cpu 时放弃了 */
+void fpu_free(struct task_struct* pthread) {
+    if (pthread->fpu_state == NULL) {
+        return;
+    }
+    enum intr_status old_status = intr_disable();
+    struct cpu* c = this_cpu();
+    if (c->fpu_owner == pthread) {
+        c->fpu_owner = NULL;
+        stts();
+    }
+    intr_set_status(old_status);
+    fpu_area_free(pthread->fpu_state);
+    pthread->fpu_state = NULL;
+}
+
+/* 为当前 cpu 打开 FPU 和 SSE, 并置位 TS 等待第一次使用 */
+void fpu_init_cpu(void) {
+    if (!fpu_enabled) {
+        return;
+    }
+    write_cr0((read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE);
+    uint32_t cr4;
+    asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    asm volatile ("movl %0, %%cr4" : : "r" (cr4) : "memory");
+    stts();
+}
+
+/* 检测 FXSAVE 支持, 记录 FPU 的初始状态并注册 #NM 处理程序 */
+void fpu_init(void) {
+    put_str("fpu_init start\n");
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+    if (!(edx & CPUID_FXSR)) {
+        put_str("   fxsave not supported, fpu disabled\n");
+        return;
+    }
+    fpu_enabled = true;
+    spin_lock_init(&area_lock);
+    fpu_init_cpu();
+
+    /* 在干净的 FPU 上记下初始状态, 之后的任务都从这个状态开始 */
+    clts();
+    asm volatile ("fninit");
+    if (edx & CPUID_SSE) {
+        uint32_t mxcsr = 0x1f80;  // 屏蔽所有 SSE 浮点异常
+        asm volatile ("ldmxcsr %0" : : "m" (mxcsr));
+    }
+    fxsave(fpu_init_state);
+    stts();
+
+    register_handler(NM_VECTOR, intr_nm_handler);
+    put_str("fpu_init done\n");
+}
@@ -0,0 +1,21 @@
+#ifndef __KERNEL_FPU_H
+#define __KERNEL_FPU_H
+
+#include "stdint.h"
+#include "global.h"
+
+#define FPU_STATE_SIZE 512         // FXSAVE 区域的大小, 须 16 字节对齐
+
+struct task_struct;
+struct cpu;
+
+/* FPU/SSE 采用惰性切换: 换任务时只置 CR0.TS, 新任务第一次用到 FPU 时触发 #NM,
+   才把上一个使用者的状态存回它的 FXSAVE 区域, 再装入当前任务的. 从不用 FPU 的任务没有任何开销.
+   每个 cpu 的 FPU 中存放的是 cpu->fpu_owner 的状态, 这样的任务不能被其他 cpu 偷走 */
+void fpu_init(void);
+void fpu_init_cpu(void);
+void fpu_switch(struct cpu* c, struct task_struct* prev, struct task_struct* next);
+int32_t fpu_fork(struct task_struct* child, struct task_struct* parent);
+void fpu_free(struct task_struct* pthread);
+
+#endif
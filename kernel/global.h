@@ -41,9 +41,12 @@
 #define SELECTOR_K_DATA	   ((2 << 3) + (TI_GDT << 2) + RPL0)
 #define SELECTOR_K_STACK   SELECTOR_K_DATA 
 #define SELECTOR_K_GS	   ((3 << 3) + (TI_GDT << 2) + RPL0)
-/* 第3个段描述符是显存,第4个是tss */
-#define SELECTOR_U_CODE	   ((5 << 3) + (TI_GDT << 2) + RPL3)
-#define SELECTOR_U_DATA	   ((6 << 3) + (TI_GDT << 2) + RPL3)
+/* 第3个段描述符是显存,第4个是tss.
+   sysenter/sysexit 要求 0 级代码段、0 级数据段、3 级代码段、3 级数据段依次相邻,
+   故第5、6个描述符是内核代码段和数据段的副本, 其后才是用户段 */
+#define SELECTOR_SYSENTER_CS ((5 << 3) + (TI_GDT << 2) + RPL0)
+#define SELECTOR_U_CODE	   ((7 << 3) + (TI_GDT << 2) + RPL3)
+#define SELECTOR_U_DATA	   ((8 << 3) + (TI_GDT << 2) + RPL3)
 #define SELECTOR_U_STACK   SELECTOR_U_DATA
 
 
@@ -128,6 +131,14 @@ struct gdt_desc {
 
 #define PG_SIZE 4096
 
+/* 时钟中断频率, 编译时可用 make HZ=... 指定, 8253 计数初值为 16 位, 故不能低于 19 */
+#ifndef HZ
+#define HZ 100
+#endif
+#if HZ < 19 || HZ > 1000
+#error "HZ must be between 19 and 1000"
+#endif
+
 #define UNUSED __attribute__ ((unused))
 
 #endif
\ No newline at end of file
@@ -9,7 +9,15 @@
 #include "tss.h"
 #include "syscall-init.h"
 #include "ide.h"
+#include "blk.h"
+#include "md.h"
 #include "fs.h"
+#include "smp.h"
+#include "workqueue.h"
+#include "futex.h"
+#include "fpu.h"
+#include "vdso.h"
+#include "scstat.h"
 
 
 /* 负责初始化所有模块 */
@@ -19,11 +27,19 @@ void init_all() {
     mem_init();      // 内存管理初始化
     thread_init();   // 内核线程+用户进程初始化
     timer_init();    // 初始化PIT
+    workqueue_init();  // 中断下半部的工作线程, 须在各设备注册中断处理程序之前创建
     console_init();  // 控制台初始化最好放在开中断之前
     keyboard_init();  // 键盘初始化
     tss_init();       // tss初始化
+    fpu_init();       // FPU/SSE 惰性切换
     syscall_init();   // 系统调用初始化
+    futex_init();     // 用户态同步所用的 futex 等待队列
+    vdso_init();      // 只读映射进每个进程的时间页
     intr_enable();    // 后面的ide_init需要打开中断
     ide_init();	      // 初始化硬盘
+    blk_init();       // 每块硬盘的请求队列和分派线程
+    md_init();        // 由多个分区组成的 md 设备
     filesys_init();   // 初始化文件系统
+    smp_init();       // 最后启动其他 cpu, 此前的初始化都只在 BSP 上进行
+    scstat_init();    // 按 cpu 分配系统调用统计, 需知道 cpu 的个数
 }
\ No newline at end of file
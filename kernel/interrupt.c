@@ -162,12 +162,15 @@ void idt_init() {
     idt_desc_init();   // 初始化中断描述符表
     exception_init();  // 异常名初始化并注册通常的中断处理函数
     pic_init();        // 初始化 8259A
+    idt_load();
+    put_str("idt_init done\n");
+}
 
-    /* 加载 idt */
+/* 加载 idt, 所有 cpu 共用同一张 idt, 其他 cpu 启动时也要加载一次 */
+void idt_load(void) {
     // lidt 会取出前 48 位数据做操作数
     uint64_t idt_operand = ((sizeof(idt) - 1) | ((uint64_t)(uint32_t)idt << 16));
     asm volatile("lidt %0"::"m"(idt_operand));  // idt_operand被当作内存寻址
-    put_str("idt_init done\n");
 }
 
 /*开中断并返回开中断前的状态*/
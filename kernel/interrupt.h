@@ -19,5 +19,7 @@ enum intr_status intr_get_status(void);
 enum intr_status intr_set_status(enum intr_status);
 enum intr_status intr_enable(void);
 enum intr_status intr_disable(void);
+void register_handler(uint8_t vector_no, intr_handler function);
+void idt_load(void);
 
 # endif
@@ -7,6 +7,7 @@
 #include "string.h"
 #include "sync.h"
 #include "interrupt.h"
+#include "thread.h"
 
 /* 内存位图的地址
 因为 0xc009f000 是内核主线程栈顶， 0xc009e000 是内核主线程的 pcb。
@@ -69,8 +70,8 @@ static void *vaddr_get(enum pool_flags pf, uint32_t pg_cnt)
       vaddr_start = kernel_vaddr.vaddr_start + bit_idx_start * PG_SIZE;
    }
    else
-   { // 用户内存池
-      struct task_struct *cur = running_thread();
+   { // 用户内存池, 同一进程的线程共用主线程的虚拟地址池
+      struct task_struct *cur = running_thread()->group_leader;
       bit_idx_start = bitmap_scan(&cur->userprog_vaddr.vaddr_bitmap, pg_cnt);
       if (bit_idx_start == -1)
       {
@@ -212,6 +213,10 @@ void *get_kernel_pages(uint32_t pg_cnt)
 {
    lock_acquire(&kernel_pool.lock);
    void *vaddr = malloc_page(PF_KERNEL, pg_cnt);
+   if (vaddr == NULL && task_cache_shrink() > 0)
+   { // 内存不足时先收回缓存的pcb页再试一次
+      vaddr = malloc_page(PF_KERNEL, pg_cnt);
+   }
    if (vaddr != NULL)
    { // 若分配的地址不为空,将页框清0后返回
       memset(vaddr, 0, pg_cnt * PG_SIZE);
@@ -233,6 +238,14 @@ void *get_user_pages(uint32_t pg_cnt)
    return vaddr;
 }
 
+/* 释放get_user_pages申请的pg_cnt个用户页 */
+void free_user_pages(void *vaddr, uint32_t pg_cnt)
+{
+   lock_acquire(&user_pool.lock);
+   mfree_page(PF_USER, vaddr, pg_cnt);
+   lock_release(&user_pool.lock);
+}
+
 /* 将地址vaddr与pf池中的物理地址关联,仅支持一页空间分配 */
 void *get_a_page(enum pool_flags pf, uint32_t vaddr)
 {
@@ -246,9 +259,10 @@ void *get_a_page(enum pool_flags pf, uint32_t vaddr)
    /* 若当前是用户进程申请用户内存,就修改用户进程自己的虚拟地址位图 */
    if (cur->pgdir != NULL && pf == PF_USER)
    {
-      bit_idx = (vaddr - cur->userprog_vaddr.vaddr_start) / PG_SIZE;
+      struct virtual_addr *user_vaddr = &cur->group_leader->userprog_vaddr;
+      bit_idx = (vaddr - user_vaddr->vaddr_start) / PG_SIZE;
       ASSERT(bit_idx >= 0);
-      bitmap_set(&cur->userprog_vaddr.vaddr_bitmap, bit_idx, 1);
+      bitmap_set(&user_vaddr->vaddr_bitmap, bit_idx, 1);
    }
    else if (cur->pgdir == NULL && pf == PF_KERNEL)
    {
@@ -289,6 +303,17 @@ void *get_a_page_without_opvaddrbitmap(enum pool_flags pf, uint32_t vaddr)
    return (void *)vaddr;
 }
 
+/* 在当前页表中把用户地址vaddr只读地映射到已有的物理页page_phyaddr,
+ * 用于多个进程共享内核维护的页, 不改动虚拟地址位图 */
+void page_map_user_ro(uint32_t vaddr, uint32_t page_phyaddr)
+{
+   lock_acquire(&kernel_pool.lock); // 页表不存在时要从内核池中分配
+   page_table_add((void *)vaddr, (void *)page_phyaddr);
+   lock_release(&kernel_pool.lock);
+   *pte_ptr(vaddr) &= ~PG_RW_W;
+   asm volatile("invlpg %0" : : "m"(*(uint8_t *)vaddr) : "memory");
+}
+
 /* 得到虚拟地址映射到的物理地址 */
 uint32_t addr_v2p(uint32_t vaddr)
 {
@@ -332,7 +357,7 @@ void *sys_malloc(uint32_t size)
       PF = PF_USER;
       pool_size = user_pool.pool_size;
       mem_pool = &user_pool;
-      descs = cur_thread->u_block_desc;
+      descs = cur_thread->group_leader->u_block_desc;
    }
 
    /* 若申请的内存不在内存池容量范围内则直接返回NULL */
@@ -463,7 +488,7 @@ static void vaddr_remove(enum pool_flags pf, void *_vaddr, uint32_t pg_cnt)
    }
    else
    { // 用户虚拟内存池
-      struct task_struct *cur_thread = running_thread();
+      struct task_struct *cur_thread = running_thread()->group_leader;
       bit_idx_start = (vaddr - cur_thread->userprog_vaddr.vaddr_start) / PG_SIZE;
       while (cnt < pg_cnt)
       {
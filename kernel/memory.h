@@ -40,6 +40,9 @@ struct mem_block_desc {
 # define PG_US_S 0  // 第2位US=0，表示此页内存只允许特权级0、1、2的程序访问
 # define PG_US_U 4  // 第2位US=1，表示此页内存允许所有特权级访问
 
+# define PG_PWT_1 8   // 第3位PWT=1，表示此页采用写透方式
+# define PG_PCD_1 16  // 第4位PCD=1，表示此页不缓存，用于映射设备寄存器
+
 extern struct pool kernel_pool, user_pool;
 void mem_init(void);
 void* get_kernel_pages(uint32_t pg_cnt);
@@ -49,7 +52,9 @@ uint32_t* pte_ptr(uint32_t vaddr);
 uint32_t* pde_ptr(uint32_t vaddr);
 uint32_t addr_v2p(uint32_t vaddr);
 void* get_a_page(enum pool_flags pf, uint32_t vaddr);
+void page_map_user_ro(uint32_t vaddr, uint32_t page_phyaddr);
 void* get_user_pages(uint32_t pg_cnt);
+void free_user_pages(void* vaddr, uint32_t pg_cnt);
 void block_desc_init(struct mem_block_desc* desc_array);
 void* sys_malloc(uint32_t size);
 void mfree_page(enum pool_flags pf, void* _vaddr, uint32_t pg_cnt);
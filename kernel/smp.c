@@ -0,0 +1,191 @@
+#include "smp.h"
+#include "global.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "string.h"
+#include "memory.h"
+#include "lapic.h"
+#include "tss.h"
+#include "fpu.h"
+#include "kernel/print.h"
+
+/* 低端 1MB 物理内存映射在内核空间的起始处 */
+#define P2V_LOW(addr) ((void*)((uint32_t)(addr) + 0xc0000000))
+
+/* MP 浮动指针结构, 由 BIOS 放在低端内存中, 以 "_MP_" 开头 */
+struct mp_fp {
+    char signature[4];
+    uint32_t config_addr;      // MP 配置表的物理地址
+    uint8_t length;            // 以 16 字节为单位的长度
+    uint8_t spec_rev;
+    uint8_t checksum;          // 所有字节相加为 0
+    uint8_t feature[5];        // feature[0] 非 0 表示使用默认配置, 没有配置表
+} __attribute__ ((packed));
+
+/* MP 配置表表头, 以 "PCMP" 开头, 其后紧跟各个表项 */
+struct mp_config {
+    char signature[4];
+    uint16_t length;           // 表头和表项的总长度
+    uint8_t spec_rev;
+    uint8_t checksum;
+    char oem_id[8];
+    char product_id[12];
+    uint32_t oem_table;
+    uint16_t oem_size;
+    uint16_t entry_cnt;        // 表项个数
+    uint32_t lapic_addr;       // local APIC 寄存器的物理地址
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+} __attribute__ ((packed));
+
+/* 处理器表项 */
+struct mp_proc {
+    uint8_t type;              // 为 MP_PROC
+    uint8_t apic_id;
+    uint8_t apic_ver;
+    uint8_t flags;             // 位0 表示可用, 位1 表示是 BSP
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+} __attribute__ ((packed));
+
+#define MP_PROC 0              // 处理器表项 20 字节, 其余类型的表项都是 8 字节
+#define MP_PROC_ENABLED 0x1
+#define MP_PROC_BSP 0x2
+
+struct cpu cpus[NR_CPUS];
+uint8_t nr_cpus = 1;
+uint8_t nr_cpus_online = 1;
+
+/* trampoline.S 中的 AP 启动代码, 运行前要复制到 AP_TRAMPOLINE_BASE */
+extern char ap_trampoline[], ap_trampoline_end[];
+/* AP 进入保护模式后使用的栈顶, 即其 idle 线程 pcb 页的顶端 */
+uint32_t ap_boot_stack;
+
+/* 从 addr 开始对 len 个字节求和 */
+static uint8_t sum(const uint8_t* addr, uint32_t len) {
+    uint8_t s = 0;
+    uint32_t i;
+    for (i = 0; i < len; i++) {
+        s += addr[i];
+    }
+    return s;
+}
+
+/* 在物理地址 phy_addr 开始的 len 字节中以 16 字节为步长寻找 MP 浮动指针 */
+static struct mp_fp* mp_search_range(uint32_t phy_addr, uint32_t len) {
+    uint8_t* addr = P2V_LOW(phy_addr);
+    uint8_t* end = addr + len;
+    for (; addr < end; addr += sizeof(struct mp_fp)) {
+        if (memcmp(addr, "_MP_", 4) == 0 && sum(addr, sizeof(struct mp_fp)) == 0) {
+            return (struct mp_fp*)addr;
+        }
+    }
+    return NULL;
+}
+
+/* 按 MP 规范依次在 EBDA 的第一个 1KB、常规内存的最后 1KB 和 BIOS ROM 中查找浮动指针 */
+static struct mp_fp* mp_search(void) {
+    struct mp_fp* mp;
+    uint32_t ebda = (uint32_t)*(uint16_t*)P2V_LOW(0x40e) << 4;
+    if (ebda != 0 && (mp = mp_search_range(ebda, 1024)) != NULL) {
+        return mp;
+    }
+    uint32_t base_mem = (uint32_t)*(uint16_t*)P2V_LOW(0x413) * 1024;
+    if ((mp = mp_search_range(base_mem - 1024, 1024)) != NULL) {
+        return mp;
+    }
+    return mp_search_range(0xf0000, 0x10000);
+}
+
+/* 解析 MP 配置表, 填好 cpus 中各 cpu 的 APIC ID, 返回 local APIC 的物理地址, 失败返回 0 */
+static uint32_t mp_config_parse(void) {
+    struct mp_fp* mp = mp_search();
+    /* 只支持放在低端 1MB 中的配置表, 默认配置不带配置表, 也不支持 */
+    if (mp == NULL || mp->config_addr == 0 || mp->config_addr >= 0x100000) {
+        return 0;
+    }
+    struct mp_config* conf = P2V_LOW(mp->config_addr);
+    if (memcmp(conf->signature, "PCMP", 4) != 0 || \
+        (conf->spec_rev != 1 && conf->spec_rev != 4) || \
+        sum((uint8_t*)conf, conf->length) != 0) {
+        return 0;
+    }
+
+    uint8_t* entry = (uint8_t*)(conf + 1);
+    uint8_t* end = (uint8_t*)conf + conf->length;
+    nr_cpus = 1;  // cpus[0] 留给 BSP
+    while (entry < end) {
+        if (*entry != MP_PROC) {
+            entry += 8;
+            continue;
+        }
+        struct mp_proc* proc = (struct mp_proc*)entry;
+        if (proc->flags & MP_PROC_ENABLED) {
+            if (proc->flags & MP_PROC_BSP) {
+                cpus[0].apic_id = proc->apic_id;
+            } else if (nr_cpus < NR_CPUS) {
+                cpus[nr_cpus].apic_id = proc->apic_id;
+                nr_cpus++;
+            }
+        }
+        entry += sizeof(struct mp_proc);
+    }
+    return conf->lapic_addr;
+}
+
+/* 通知 cpu c 重新调度, 它若在 hlt 中会被唤醒 */
+void smp_send_reschedule(struct cpu* c) {
+    if (c->online) {
+        lapic_send_ipi(c->apic_id, RESCHEDULE_VECTOR);
+    }
+}
+
+/* AP 在 trampoline.S 中开启分页后跳到这里, 此时已在自己的 idle 线程栈上 */
+void ap_main(void) {
+    struct cpu* c = this_cpu();
+    idt_load();
+    tss_init();
+    fpu_init_cpu();
+    lapic_init(false);
+    put_str("   cpu 0x");
+    put_int(c->id);
+    put_str(" online\n");
+    nr_cpus_online++;
+    c->online = true;  // BSP 等到这个标志后才会去启动下一个 AP
+    cpu_idle();
+}
+
+/* 发现并启动其他 cpu */
+void smp_init(void) {
+    put_str("smp_init start\n");
+    uint32_t lapic_addr = lapic_present() ? mp_config_parse() : 0;
+    if (lapic_addr == 0) {
+        put_str("   no mp configuration found, running on one cpu\n");
+        return;
+    }
+    lapic_map(lapic_addr);
+    lapic_init(true);
+    cpus[0].apic_id = lapic_id();
+
+    memcpy(P2V_LOW(AP_TRAMPOLINE_BASE), ap_trampoline, ap_trampoline_end - ap_trampoline);
+
+    uint8_t cpu_id;
+    for (cpu_id = 1; cpu_id < nr_cpus; cpu_id++) {
+        struct cpu* c = &cpus[cpu_id];
+        /* AP 一启动就以 idle 线程的身份运行, 它不经过 switch_to 上 cpu */
+        struct task_struct* idle = idle_thread_create(c);
+        idle->status = TASK_RUNNING;
+        idle->on_cpu = true;
+        c->rq.curr = idle;
+        ap_boot_stack = (uint32_t)idle + PG_SIZE;
+
+        if (!lapic_start_ap(c->apic_id, AP_TRAMPOLINE_BASE, &c->online)) {
+            put_str("   cpu 0x");
+            put_int(cpu_id);
+            put_str(" failed to start\n");
+        }
+    }
+    put_str("smp_init done\n");
+}
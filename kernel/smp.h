@@ -0,0 +1,34 @@
+#ifndef __KERNEL_SMP_H
+#define __KERNEL_SMP_H
+
+#include "stdint.h"
+#include "thread.h"
+
+#define NR_CPUS 8                  // 最多支持的 cpu 数
+#define AP_TRAMPOLINE_BASE 0x70000 // AP 实模式启动代码的物理地址, 原是加载内核文件的缓冲区, 开机后已空闲
+
+/* 每个 cpu 私有的数据 */
+struct cpu {
+    uint8_t id;                    // 逻辑编号, BSP 为 0
+    uint8_t apic_id;               // local APIC ID, 发送处理器间中断时用
+    volatile bool online;          // 是否已启动完毕, 可以参与调度
+    struct run_queue rq;           // 本 cpu 的就绪队列
+    struct task_struct* idle;      // 本 cpu 的 idle 线程
+    struct task_struct* prev;      // 正在被换下 cpu 的任务, 由 schedule_tail 收尾
+    struct task_struct* fpu_owner; // FPU 中存放的是哪个任务的状态, 只由本 cpu 修改
+};
+
+extern struct cpu cpus[NR_CPUS];
+extern uint8_t nr_cpus;            // 发现的 cpu 数
+extern uint8_t nr_cpus_online;     // 已启动的 cpu 数
+
+/* 当前 cpu 的私有数据. 任务换到哪个 cpu 上运行时由 schedule 更新其 cpu 字段 */
+static inline struct cpu* this_cpu(void) {
+    return running_thread()->cpu;
+}
+
+void smp_init(void);
+void smp_send_reschedule(struct cpu* c);
+void ap_main(void);
+
+#endif
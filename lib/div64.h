@@ -0,0 +1,27 @@
+#ifndef __LIB_DIV64_H
+#define __LIB_DIV64_H
+
+#include "stdint.h"
+
+/* 64 位被除数除以 32 位除数, 商通过返回值给出, 余数存入 remainder.
+   我们没有链接 libgcc, 不能直接对 64 位数做除法和取模(会引用 __udivdi3),
+   所以分高低两次用 divl 来做: 先除高 32 位, 再带着余数除低 32 位 */
+static inline uint64_t div_u64_rem(uint64_t dividend, uint32_t divisor, uint32_t* remainder) {
+    uint32_t high = (uint32_t)(dividend >> 32);
+    uint32_t low = (uint32_t)dividend;
+    uint32_t quot_high = high / divisor;
+    uint32_t quot_low, rem;
+    high %= divisor;  // 余数小于除数, 下面 divl 的商不会溢出
+    asm ("divl %4" : "=a"(quot_low), "=d"(rem) : "a"(low), "d"(high), "rm"(divisor));
+    if (remainder != (uint32_t*)0) {
+        *remainder = rem;
+    }
+    return ((uint64_t)quot_high << 32) | quot_low;
+}
+
+/* 64 位被除数除以 32 位除数, 只要商 */
+static inline uint64_t div_u64(uint64_t dividend, uint32_t divisor) {
+    return div_u64_rem(dividend, divisor, (uint32_t*)0);
+}
+
+#endif
@@ -0,0 +1,300 @@
+#include "rbtree.h"
+#include "global.h"
+
+/* 初始化一棵空树 */
+void rb_root_init(struct rb_root* root) {
+    root->node = NULL;
+}
+
+/* 以 node 为支点左旋 */
+static void rb_rotate_left(struct rb_node* node, struct rb_root* root) {
+    struct rb_node* right = node->right;
+
+    node->right = right->left;
+    if (right->left != NULL) {
+        right->left->parent = node;
+    }
+    right->left = node;
+
+    right->parent = node->parent;
+    if (node->parent != NULL) {
+        if (node == node->parent->left) {
+            node->parent->left = right;
+        } else {
+            node->parent->right = right;
+        }
+    } else {
+        root->node = right;
+    }
+    node->parent = right;
+}
+
+/* 以 node 为支点右旋 */
+static void rb_rotate_right(struct rb_node* node, struct rb_root* root) {
+    struct rb_node* left = node->left;
+
+    node->left = left->right;
+    if (left->right != NULL) {
+        left->right->parent = node;
+    }
+    left->right = node;
+
+    left->parent = node->parent;
+    if (node->parent != NULL) {
+        if (node == node->parent->right) {
+            node->parent->right = left;
+        } else {
+            node->parent->left = left;
+        }
+    } else {
+        root->node = left;
+    }
+    node->parent = left;
+}
+
+/* 新挂上的红色结点 node 可能破坏"红结点的孩子必为黑"的性质, 在此修复 */
+void rb_insert_color(struct rb_node* node, struct rb_root* root) {
+    struct rb_node* parent;
+    struct rb_node* gparent;
+    struct rb_node* uncle;
+    struct rb_node* tmp;
+
+    while ((parent = node->parent) != NULL && parent->color == RB_RED) {
+        gparent = parent->parent;  // 父结点为红, 必不是根, 所以祖父结点一定存在
+
+        if (parent == gparent->left) {
+            uncle = gparent->right;
+            /* 叔结点为红: 父、叔变黑, 祖父变红, 问题上移到祖父 */
+            if (uncle != NULL && uncle->color == RB_RED) {
+                uncle->color = RB_BLACK;
+                parent->color = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+            /* 叔结点为黑且 node 是右孩子: 先左旋成左孩子的情形 */
+            if (parent->right == node) {
+                rb_rotate_left(parent, root);
+                tmp = parent;
+                parent = node;
+                node = tmp;
+            }
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            rb_rotate_right(gparent, root);
+        } else {
+            uncle = gparent->left;
+            if (uncle != NULL && uncle->color == RB_RED) {
+                uncle->color = RB_BLACK;
+                parent->color = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+            if (parent->left == node) {
+                rb_rotate_right(parent, root);
+                tmp = parent;
+                parent = node;
+                node = tmp;
+            }
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            rb_rotate_left(gparent, root);
+        }
+    }
+    root->node->color = RB_BLACK;
+}
+
+/* 删除黑结点后, 以 parent 为父的 node 一侧少了一个黑结点, 在此修复.
+   node 可能为 NULL, 所以单独传入 parent */
+static void rb_erase_color(struct rb_node* node, struct rb_node* parent, struct rb_root* root) {
+    struct rb_node* other;
+
+    while ((node == NULL || node->color == RB_BLACK) && node != root->node) {
+        if (parent->left == node) {
+            other = parent->right;
+            if (other->color == RB_RED) {
+                other->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_left(parent, root);
+                other = parent->right;
+            }
+            if ((other->left == NULL || other->left->color == RB_BLACK) &&
+                (other->right == NULL || other->right->color == RB_BLACK)) {
+                other->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+            } else {
+                if (other->right == NULL || other->right->color == RB_BLACK) {
+                    other->left->color = RB_BLACK;
+                    other->color = RB_RED;
+                    rb_rotate_right(other, root);
+                    other = parent->right;
+                }
+                other->color = parent->color;
+                parent->color = RB_BLACK;
+                if (other->right != NULL) {
+                    other->right->color = RB_BLACK;
+                }
+                rb_rotate_left(parent, root);
+                node = root->node;
+                break;
+            }
+        } else {
+            other = parent->left;
+            if (other->color == RB_RED) {
+                other->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_right(parent, root);
+                other = parent->left;
+            }
+            if ((other->left == NULL || other->left->color == RB_BLACK) &&
+                (other->right == NULL || other->right->color == RB_BLACK)) {
+                other->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+            } else {
+                if (other->left == NULL || other->left->color == RB_BLACK) {
+                    other->right->color = RB_BLACK;
+                    other->color = RB_RED;
+                    rb_rotate_left(other, root);
+                    other = parent->left;
+                }
+                other->color = parent->color;
+                parent->color = RB_BLACK;
+                if (other->left != NULL) {
+                    other->left->color = RB_BLACK;
+                }
+                rb_rotate_right(parent, root);
+                node = root->node;
+                break;
+            }
+        }
+    }
+    if (node != NULL) {
+        node->color = RB_BLACK;
+    }
+}
+
+/* 将 node 从树中摘除 */
+void rb_erase(struct rb_node* node, struct rb_root* root) {
+    struct rb_node* child;
+    struct rb_node* parent;
+    uint8_t color;
+
+    if (node->left == NULL) {
+        child = node->right;
+    } else if (node->right == NULL) {
+        child = node->left;
+    } else {
+        /* 有两个孩子: 用右子树中最小的结点 succ 顶替 node 的位置 */
+        struct rb_node* old = node;
+        struct rb_node* left;
+
+        node = node->right;
+        while ((left = node->left) != NULL) {
+            node = left;
+        }
+
+        if (old->parent != NULL) {
+            if (old->parent->left == old) {
+                old->parent->left = node;
+            } else {
+                old->parent->right = node;
+            }
+        } else {
+            root->node = node;
+        }
+
+        child = node->right;
+        parent = node->parent;
+        color = node->color;
+
+        if (parent == old) {
+            parent = node;
+        } else {
+            if (child != NULL) {
+                child->parent = parent;
+            }
+            parent->left = child;
+
+            node->right = old->right;
+            old->right->parent = node;
+        }
+
+        node->parent = old->parent;
+        node->color = old->color;
+        node->left = old->left;
+        old->left->parent = node;
+
+        if (color == RB_BLACK) {
+            rb_erase_color(child, parent, root);
+        }
+        return;
+    }
+
+    /* 至多一个孩子: 直接用孩子顶替 node */
+    parent = node->parent;
+    color = node->color;
+
+    if (child != NULL) {
+        child->parent = parent;
+    }
+    if (parent != NULL) {
+        if (parent->left == node) {
+            parent->left = child;
+        } else {
+            parent->right = child;
+        }
+    } else {
+        root->node = child;
+    }
+
+    if (color == RB_BLACK) {
+        rb_erase_color(child, parent, root);
+    }
+}
+
+/* 返回树中最小的结点, 空树返回 NULL */
+struct rb_node* rb_first(struct rb_root* root) {
+    struct rb_node* n = root->node;
+    if (n == NULL) {
+        return NULL;
+    }
+    while (n->left != NULL) {
+        n = n->left;
+    }
+    return n;
+}
+
+/* 返回树中最大的结点, 空树返回 NULL */
+struct rb_node* rb_last(struct rb_root* root) {
+    struct rb_node* n = root->node;
+    if (n == NULL) {
+        return NULL;
+    }
+    while (n->right != NULL) {
+        n = n->right;
+    }
+    return n;
+}
+
+/* 返回中序遍历中 node 的后继, 没有则返回 NULL */
+struct rb_node* rb_next(struct rb_node* node) {
+    struct rb_node* parent;
+
+    /* 有右子树, 后继是右子树中最左的结点 */
+    if (node->right != NULL) {
+        node = node->right;
+        while (node->left != NULL) {
+            node = node->left;
+        }
+        return node;
+    }
+
+    /* 否则向上找到第一个"自己位于其左子树中"的祖先 */
+    while ((parent = node->parent) != NULL && node == parent->right) {
+        node = parent;
+    }
+    return parent;
+}
@@ -0,0 +1,43 @@
+#ifndef __LIB_KERNEL_RBTREE_H
+#define __LIB_KERNEL_RBTREE_H
+
+#include "global.h"
+#include "kernel/list.h"
+
+#define RB_RED   0
+#define RB_BLACK 1
+
+/* 红黑树结点, 和 list_elem 一样嵌入到宿主结构中使用 */
+struct rb_node {
+    struct rb_node* parent;
+    struct rb_node* left;
+    struct rb_node* right;
+    uint8_t color;
+};
+
+/* 红黑树的根 */
+struct rb_root {
+    struct rb_node* node;
+};
+
+/* 将指针 node_ptr 转换成宿主结构 struct_type 的指针, 原理同 elem2entry */
+#define rb_entry(struct_type, struct_member_name, node_ptr) \
+    (elem2entry(struct_type, struct_member_name, node_ptr))
+
+/* 插入时先由调用者按自己的键值从根向下找到插入位置 link,
+   再调用 rb_link_node 挂上结点, 最后调用 rb_insert_color 重新平衡 */
+static inline void rb_link_node(struct rb_node* node, struct rb_node* parent, struct rb_node** link) {
+    node->parent = parent;
+    node->left = node->right = NULL;
+    node->color = RB_RED;
+    *link = node;
+}
+
+void rb_root_init(struct rb_root* root);
+void rb_insert_color(struct rb_node* node, struct rb_root* root);
+void rb_erase(struct rb_node* node, struct rb_root* root);
+struct rb_node* rb_first(struct rb_root* root);
+struct rb_node* rb_last(struct rb_root* root);
+struct rb_node* rb_next(struct rb_node* node);
+
+#endif
@@ -0,0 +1,81 @@
+#include "mutex.h"
+#include "syscall.h"
+
+#define FUTEX_WAKE_ALL 0xffffffff
+
+/* 若 *ptr 等于 old 则写入 new, 返回 *ptr 原来的值 */
+static inline uint32_t cmpxchg(volatile uint32_t* ptr, uint32_t old, uint32_t new) {
+    uint32_t prev;
+    asm volatile ("lock cmpxchgl %2, %1" : "=a" (prev), "+m" (*ptr) : "r" (new), "0" (old) : "memory");
+    return prev;
+}
+
+/* 把 val 写入 *ptr, 返回 *ptr 原来的值 */
+static inline uint32_t xchg(volatile uint32_t* ptr, uint32_t val) {
+    asm volatile ("xchgl %0, %1" : "+r" (val), "+m" (*ptr) : : "memory");
+    return val;
+}
+
+/* 给 *ptr 原子地加 1 */
+static inline void atomic_inc(volatile uint32_t* ptr) {
+    asm volatile ("lock incl %0" : "+m" (*ptr) : : "memory");
+}
+
+void mutex_init(struct mutex* m) {
+    m->state = 0;
+}
+
+/* 加锁. 抢不到时把状态置为 2 再睡, 使解锁者知道要去唤醒 */
+void mutex_lock(struct mutex* m) {
+    uint32_t c = cmpxchg(&m->state, 0, 1);
+    if (c == 0) {
+        return;  // 无竞争, 不进内核
+    }
+    if (c != 2) {
+        c = xchg(&m->state, 2);
+    }
+    while (c != 0) {
+        futex_wait((uint32_t*)&m->state, 2);
+        c = xchg(&m->state, 2);
+    }
+}
+
+/* 尝试加锁, 成功返回 true */
+bool mutex_trylock(struct mutex* m) {
+    return cmpxchg(&m->state, 0, 1) == 0;
+}
+
+/* 解锁. 只有状态为 2 即可能有等待者时才进内核唤醒一个 */
+void mutex_unlock(struct mutex* m) {
+    if (xchg(&m->state, 0) == 2) {
+        futex_wake((uint32_t*)&m->state, 1);
+    }
+}
+
+void cond_init(struct cond* c) {
+    c->seq = 0;
+}
+
+/* 释放 m 并等待 c 上的通知, 返回前重新持有 m. 可能被虚假唤醒, 调用者须在循环中重新检查条件 */
+void cond_wait(struct cond* c, struct mutex* m) {
+    uint32_t seq = c->seq;
+    mutex_unlock(m);
+    /* 解锁后若有人 signal, seq 已经变了, futex_wait 立即返回, 不会丢失通知 */
+    futex_wait((uint32_t*)&c->seq, seq);
+    /* 被唤醒时其他等待者可能也在抢锁, 直接按有竞争处理 */
+    while (xchg(&m->state, 2) != 0) {
+        futex_wait((uint32_t*)&m->state, 2);
+    }
+}
+
+/* 唤醒一个等待者 */
+void cond_signal(struct cond* c) {
+    atomic_inc(&c->seq);
+    futex_wake((uint32_t*)&c->seq, 1);
+}
+
+/* 唤醒所有等待者 */
+void cond_broadcast(struct cond* c) {
+    atomic_inc(&c->seq);
+    futex_wake((uint32_t*)&c->seq, FUTEX_WAKE_ALL);
+}
@@ -0,0 +1,29 @@
+#ifndef __LIB_USER_MUTEX_H
+#define __LIB_USER_MUTEX_H
+
+#include "stdint.h"
+#include "global.h"
+
+/* 用户态互斥锁. 无竞争时只需一条原子指令, 有竞争时才用 futex 陷入内核睡眠 */
+struct mutex {
+    volatile uint32_t state;  // 0 未上锁, 1 已上锁且无人等待, 2 已上锁且可能有人等待
+};
+
+/* 用户态条件变量 */
+struct cond {
+    volatile uint32_t seq;    // 每次 signal 或 broadcast 加 1, 等待者据此判断是否错过了通知
+};
+
+#define MUTEX_INITIALIZER {0}
+#define COND_INITIALIZER {0}
+
+void mutex_init(struct mutex* m);
+void mutex_lock(struct mutex* m);
+bool mutex_trylock(struct mutex* m);
+void mutex_unlock(struct mutex* m);
+void cond_init(struct cond* c);
+void cond_wait(struct cond* c, struct mutex* m);
+void cond_signal(struct cond* c);
+void cond_broadcast(struct cond* c);
+
+#endif
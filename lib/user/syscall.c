@@ -1,16 +1,65 @@
 #include "syscall.h"
 #include "thread.h"
+#include "vdso.h"
+#include "div64.h"
+
+#define VDSO_DATA ((const struct vdso_data*)VDSO_DATA_VADDR)
+#define VDSO_PROC ((const struct vdso_proc*)VDSO_PROC_VADDR)
+
+/* cpu 是否支持 sysenter: 1 为支持, 0 为不支持, -1 表示还没检测 */
+static int8_t sysenter_state = -1;
+
+/* 调用者是否运行在 3 特权级. 内核线程也会直接调用这些函数, 它们没有映射 vdso 页 */
+static inline bool in_user_mode(void) {
+   uint32_t cs;
+   asm volatile ("mov %%cs, %0" : "=r" (cs));
+   return (cs & 3) == 3;
+}
+
+/* 能否用 sysenter 进入内核. cpu 要支持, 且调用者须在 3 特权级, 因为 sysexit 只能返回用户态,
+ * 内核线程直接调用这些函数时只能用 int 0x80. 检测 cpuid 较慢, 结果缓存起来 */
+static bool use_sysenter(void) {
+   if (!in_user_mode()) {
+      return false;
+   }
+   if (sysenter_state < 0) {
+      uint32_t eax, ebx, ecx, edx;
+      asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+      uint32_t family = (eax >> 8) & 0xf, model = (eax >> 4) & 0xf, stepping = eax & 0xf;
+      /* 早期的 Pentium Pro 虽置了 SEP 位却不支持 sysenter, 与内核 tss.c 中的判断一致 */
+      sysenter_state = (edx & (1 << 11)) && !(family == 6 && model < 3 && stepping < 3);
+   }
+   return sysenter_state;
+}
+
+/* sysenter 的调用序列: 用户栈存入 ebp, 返回地址存入 esi, 参数寄存器与 int 0x80 相同.
+ * 内核用 sysexit 返回时把返回地址和用户栈放在 edx 和 ecx 中, 故这两个寄存器会被改写 */
+#define SYSENTER_ASM             \
+   "push %%ebp\n\t"              \
+   "mov %%esp, %%ebp\n\t"        \
+   "movl $1f, %%esi\n\t"         \
+   "sysenter\n"                  \
+   "1:\n\t"                      \
+   "pop %%ebp"
 
 /* 无参数的系统调用 */
 // 大括号中最后一个语句的值会作为大括号代码块的返回值
 #define _syscall0(NUMBER) ({			   \
    int retval;					           \
-   asm volatile (					       \
-   "int $0x80"						       \
-   : "=a" (retval)					       \
-   : "a" (NUMBER)					       \
-   : "memory"						       \
-   );							           \
+   if (use_sysenter()) {                   \
+      asm volatile (SYSENTER_ASM           \
+      : "=a" (retval)                      \
+      : "a" (NUMBER)                       \
+      : "ecx", "edx", "esi", "memory"      \
+      );                                   \
+   } else {                                \
+      asm volatile (					   \
+      "int $0x80"						   \
+      : "=a" (retval)					   \
+      : "a" (NUMBER)					   \
+      : "memory"						   \
+      );							       \
+   }                                       \
    retval;						           \
 })
 
@@ -18,12 +67,20 @@
 /* 一个参数的系统调用 */
 #define _syscall1(NUMBER, ARG1) ({		   \
    int retval;					           \
-   asm volatile (					       \
-   "int $0x80"						       \
-   : "=a" (retval)					       \
-   : "a" (NUMBER), "b" (ARG1)			   \
-   : "memory"						       \
-   );							           \
+   if (use_sysenter()) {                   \
+      asm volatile (SYSENTER_ASM           \
+      : "=a" (retval)                      \
+      : "a" (NUMBER), "b" (ARG1)           \
+      : "ecx", "edx", "esi", "memory"      \
+      );                                   \
+   } else {                                \
+      asm volatile (					   \
+      "int $0x80"						   \
+      : "=a" (retval)					   \
+      : "a" (NUMBER), "b" (ARG1)		   \
+      : "memory"						   \
+      );							       \
+   }                                       \
    retval;						           \
 })
 
@@ -31,12 +88,21 @@
 /* 两个参数的系统调用 */
 #define _syscall2(NUMBER, ARG1, ARG2) ({   \
    int retval;						       \
-   asm volatile (					       \
-   "int $0x80"						       \
-   : "=a" (retval)					       \
-   : "a" (NUMBER), "b" (ARG1), "c" (ARG2)  \
-   : "memory"						       \
-   );							           \
+   if (use_sysenter()) {                   \
+      int arg2 = (int)(ARG2);              \
+      asm volatile (SYSENTER_ASM           \
+      : "=a" (retval), "+c" (arg2)         \
+      : "a" (NUMBER), "b" (ARG1)           \
+      : "edx", "esi", "memory"             \
+      );                                   \
+   } else {                                \
+      asm volatile (					   \
+      "int $0x80"						   \
+      : "=a" (retval)					   \
+      : "a" (NUMBER), "b" (ARG1), "c" (ARG2)  \
+      : "memory"						   \
+      );							       \
+   }                                       \
    retval;						           \
 })
 
@@ -44,18 +110,31 @@
 /* 三个参数的系统调用 */
 #define _syscall3(NUMBER, ARG1, ARG2, ARG3) ({		       \
    int retval;						                       \
-   asm volatile (					                       \
-      "int $0x80"					                       \
-      : "=a" (retval)					                   \
-      : "a" (NUMBER), "b" (ARG1), "c" (ARG2), "d" (ARG3)   \
-      : "memory"					                       \
-   );							                           \
+   if (use_sysenter()) {                                   \
+      int arg2 = (int)(ARG2), arg3 = (int)(ARG3);          \
+      asm volatile (SYSENTER_ASM                           \
+         : "=a" (retval), "+c" (arg2), "+d" (arg3)         \
+         : "a" (NUMBER), "b" (ARG1)                        \
+         : "esi", "memory"                                 \
+      );                                                   \
+   } else {                                                \
+      asm volatile (					                   \
+         "int $0x80"					                   \
+         : "=a" (retval)					               \
+         : "a" (NUMBER), "b" (ARG1), "c" (ARG2), "d" (ARG3)   \
+         : "memory"					                       \
+      );							                       \
+   }                                                       \
    retval;						                           \
 })
 
 
 /* 返回当前任务pid */
 uint32_t getpid() {
+   /* 单线程的进程直接读进程页, 不必陷入内核 */
+   if (in_user_mode() && !VDSO_PROC->threaded) {
+      return VDSO_PROC->pid;
+   }
    return _syscall0(SYS_GETPID);
 }
 
@@ -196,4 +275,115 @@ void fd_redirect(uint32_t old_local_fd, uint32_t new_local_fd) {
 /* 显示系统支持的命令 */
 void help(void) {
    _syscall0(SYS_HELP);
-}
\ No newline at end of file
+}
+
+/* 睡眠req指定的时间 */
+int32_t nanosleep(const struct timespec* req, struct timespec* rem) {
+   return _syscall2(SYS_NANOSLEEP, req, rem);
+}
+
+/* 睡眠seconds秒,返回未睡完的秒数 */
+uint32_t sleep(uint32_t seconds) {
+   struct timespec req = {seconds, 0};
+   struct timespec rem = {0, 0};
+   if (nanosleep(&req, &rem) == -1) {
+      return seconds;
+   }
+   return rem.tv_sec;
+}
+
+/* 读取clock_id指定的时钟, 目前只支持CLOCK_MONOTONIC */
+int32_t clock_gettime(uint32_t clock_id, struct timespec* tp) {
+   if (clock_id != CLOCK_MONOTONIC || tp == NULL || !in_user_mode()) {
+      return _syscall2(SYS_CLOCK_GETTIME, clock_id, tp);
+   }
+   /* 与内核的 clock_monotonic_ns 同样计算, 只是时钟参数取自时间页 */
+   const struct vdso_data* vd = VDSO_DATA;
+   uint64_t ns;
+   if (vd->tsc_khz == 0) {
+      ns = (uint64_t)vd->ticks * (1000000000 / vd->hz);
+   } else {
+      uint64_t cycles = rdtsc() - vd->tsc_base;
+      uint32_t low = (uint32_t)cycles, high = (uint32_t)(cycles >> 32);
+      ns = ((uint64_t)high * vd->tsc_mult << (32 - vd->tsc_shift)) + ((uint64_t)low * vd->tsc_mult >> vd->tsc_shift);
+   }
+   uint32_t nsec;
+   tp->tv_sec = (uint32_t)div_u64_rem(ns, 1000000000, &nsec);
+   tp->tv_nsec = nsec;
+   return 0;
+}
+
+/* 返回开机以来的时钟嘀嗒数, 每秒 HZ 个 */
+uint32_t uptime_ticks(void) {
+   if (in_user_mode()) {
+      return VDSO_DATA->ticks;
+   }
+   struct timespec ts;
+   _syscall2(SYS_CLOCK_GETTIME, CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec * HZ + ts.tv_nsec / (1000000000 / HZ);
+}
+
+/* 若*uaddr仍等于val则睡眠, 直到被futex_wake唤醒 */
+int32_t futex_wait(uint32_t* uaddr, uint32_t val) {
+   return _syscall2(SYS_FUTEX_WAIT, uaddr, val);
+}
+
+/* 唤醒最多nr_wake个在uaddr上睡眠的任务, 返回唤醒的个数 */
+int32_t futex_wake(uint32_t* uaddr, uint32_t nr_wake) {
+   return _syscall2(SYS_FUTEX_WAKE, uaddr, nr_wake);
+}
+
+/* 创建与本进程共享地址空间的线程, 它在用户态从entry(func, arg)开始执行 */
+pid_t clone(void* entry, void* func, void* arg) {
+   return _syscall3(SYS_CLONE, entry, func, arg);
+}
+
+/* 结束当前线程, value留给join它的线程 */
+void uthread_exit(void* value) {
+   _syscall1(SYS_THREAD_EXIT, value);
+}
+
+/* 等待本进程的线程tid结束, 将其返回值存入*value */
+int32_t uthread_join(pid_t tid, void** value) {
+   return _syscall2(SYS_THREAD_JOIN, tid, value);
+}
+
+/* 获取任务pid的调度统计, 存入buf */
+int32_t schedstat(pid_t pid, struct schedstat* buf) {
+   return _syscall2(SYS_SCHEDSTAT, pid, buf);
+}
+
+/* 把任务pid设为实时任务, attr->runtime为0时恢复为普通任务, pid为0指自己 */
+int32_t sched_setdl(pid_t pid, const struct sched_dl_attr* attr) {
+   return _syscall2(SYS_SCHED_SETDL, pid, attr);
+}
+
+/* 建立提交队列项数为entries的异步队列, 返回与内核共享的队列 */
+struct uring* uring_setup(uint32_t entries) {
+   return (struct uring*)_syscall1(SYS_URING_SETUP, entries);
+}
+
+/* 通知内核有to_submit个新提交项, 并等到至少有min_complete个完成项, 返回可收取的完成项数 */
+int32_t uring_enter(uint32_t to_submit, uint32_t min_complete) {
+   return _syscall2(SYS_URING_ENTER, to_submit, min_complete);
+}
+
+/* 系统调用统计的控制与读取, cmd见enum scstat_cmd, buf须能容纳NR_SYSCALLS项 */
+int32_t scstat(int32_t pid, uint32_t cmd, struct syscall_stat* buf) {
+   return _syscall3(SYS_SCSTAT, pid, cmd, buf);
+}
+
+/* 把各硬盘写缓存中的数据刷到盘片上 */
+int32_t sync(void) {
+   return _syscall0(SYS_SYNC);
+}
+
+/* 按cfg组建md设备, 返回设备号 */
+int32_t md_create(const struct md_config* cfg) {
+   return _syscall1(SYS_MD_CREATE, cfg);
+}
+
+/* 绕过文件系统直接读写分区或md设备 */
+int32_t blkio(const struct blkio* io) {
+   return _syscall1(SYS_BLKIO, io);
+}
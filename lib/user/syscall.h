@@ -4,6 +4,10 @@
 #include "stdint.h"
 #include "fs.h"
 #include "thread.h"
+#include "timer.h"
+#include "uring.h"
+#include "scstat.h"
+#include "md.h"
 
 enum SYSCALL_NR {
    SYS_GETPID,
@@ -33,7 +37,22 @@ enum SYSCALL_NR {
    SYS_WAIT,
    SYS_PIPE,
    SYS_FD_REDIRECT,
-   SYS_HELP
+   SYS_HELP,
+   SYS_NANOSLEEP,
+   SYS_CLOCK_GETTIME,
+   SYS_FUTEX_WAIT,
+   SYS_FUTEX_WAKE,
+   SYS_CLONE,
+   SYS_THREAD_EXIT,
+   SYS_THREAD_JOIN,
+   SYS_SCHEDSTAT,
+   SYS_SCHED_SETDL,
+   SYS_URING_SETUP,
+   SYS_URING_ENTER,
+   SYS_SCSTAT,
+   SYS_SYNC,
+   SYS_MD_CREATE,
+   SYS_BLKIO
 };
 
 uint32_t getpid(void);
@@ -64,5 +83,22 @@ pid_t wait(int32_t* status);
 int32_t pipe(int32_t pipefd[2]);
 void fd_redirect(uint32_t old_local_fd, uint32_t new_local_fd);
 void help(void);
+int32_t nanosleep(const struct timespec* req, struct timespec* rem);
+uint32_t sleep(uint32_t seconds);
+int32_t clock_gettime(uint32_t clock_id, struct timespec* tp);
+uint32_t uptime_ticks(void);
+int32_t futex_wait(uint32_t* uaddr, uint32_t val);
+int32_t futex_wake(uint32_t* uaddr, uint32_t nr_wake);
+pid_t clone(void* entry, void* func, void* arg);
+void uthread_exit(void* value);
+int32_t uthread_join(pid_t tid, void** value);
+int32_t schedstat(pid_t pid, struct schedstat* buf);
+int32_t sched_setdl(pid_t pid, const struct sched_dl_attr* attr);
+struct uring* uring_setup(uint32_t entries);
+int32_t uring_enter(uint32_t to_submit, uint32_t min_complete);
+int32_t scstat(int32_t pid, uint32_t cmd, struct syscall_stat* buf);
+int32_t sync(void);
+int32_t md_create(const struct md_config* cfg);
+int32_t blkio(const struct blkio* io);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,13 @@
+#include "uthread.h"
+#include "syscall.h"
+
+/* 新线程在用户态的入口, 内核已在其用户栈上放好了 func 和 arg.
+   func 返回后以其返回值结束线程, 不会返回到这里的调用者 */
+static void uthread_entry(uthread_func* func, void* arg) {
+    uthread_exit(func(arg));
+}
+
+/* 创建与本进程共享地址空间的线程执行 func(arg), 成功返回线程 id, 失败返回 -1 */
+pid_t uthread_create(uthread_func* func, void* arg) {
+    return clone(uthread_entry, func, arg);
+}
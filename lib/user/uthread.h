@@ -0,0 +1,12 @@
+#ifndef __LIB_USER_UTHREAD_H
+#define __LIB_USER_UTHREAD_H
+
+#include "stdint.h"
+#include "syscall.h"
+
+/* 用户线程执行的函数, 返回值可由 uthread_join 取得 */
+typedef void* uthread_func(void*);
+
+pid_t uthread_create(uthread_func* func, void* arg);
+
+#endif
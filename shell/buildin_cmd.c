@@ -7,6 +7,7 @@
 #include "dir.h"
 #include "shell.h"
 #include "user/assert.h"
+#include "div64.h"
 
 /* 将路径old_abs_path中的..和.转换为实际路径后存入new_abs_path */
 static void wash_path(char* old_abs_path, char* new_abs_path) {
@@ -211,6 +212,17 @@ void buildin_clear(uint32_t argc, char** argv UNUSED) {
     clear();
 }
 
+/* sync命令内建函数 */
+void buildin_sync(uint32_t argc, char** argv UNUSED) {
+    if (argc != 1) {
+        printf("sync: no argument support!\n");
+        return;
+    }
+    if (sync() == -1) {
+        printf("sync: flush failed\n");
+    }
+}
+
 /* mkdir命令内建函数 */
 int32_t buildin_mkdir(uint32_t argc, char** argv) {
     int32_t ret = -1;
@@ -272,4 +284,172 @@ int32_t buildin_rm(uint32_t argc, char** argv) {
 /* 显示内建命令列表 */
 void buildin_help(uint32_t argc UNUSED, char** argv UNUSED) {
     help();
-}
\ No newline at end of file
+}
+
+/* 系统调用名, strace 打印时用 */
+static const char* syscall_names[NR_SYSCALLS] = {
+    [SYS_GETPID] = "getpid",
+    [SYS_WRITE] = "write",
+    [SYS_MALLOC] = "malloc",
+    [SYS_FREE] = "free",
+    [SYS_FORK] = "fork",
+    [SYS_READ] = "read",
+    [SYS_PUTCHAR] = "putchar",
+    [SYS_CLEAR] = "clear",
+    [SYS_GETCWD] = "getcwd",
+    [SYS_OPEN] = "open",
+    [SYS_CLOSE] = "close",
+    [SYS_LSEEK] = "lseek",
+    [SYS_UNLINK] = "unlink",
+    [SYS_MKDIR] = "mkdir",
+    [SYS_OPENDIR] = "opendir",
+    [SYS_CLOSEDIR] = "closedir",
+    [SYS_CHDIR] = "chdir",
+    [SYS_RMDIR] = "rmdir",
+    [SYS_READDIR] = "readdir",
+    [SYS_REWINDDIR] = "rewinddir",
+    [SYS_STAT] = "stat",
+    [SYS_PS] = "ps",
+    [SYS_EXECV] = "execv",
+    [SYS_EXIT] = "exit",
+    [SYS_WAIT] = "wait",
+    [SYS_PIPE] = "pipe",
+    [SYS_FD_REDIRECT] = "fd_redirect",
+    [SYS_HELP] = "help",
+    [SYS_NANOSLEEP] = "nanosleep",
+    [SYS_CLOCK_GETTIME] = "clock_gettime",
+    [SYS_FUTEX_WAIT] = "futex_wait",
+    [SYS_FUTEX_WAKE] = "futex_wake",
+    [SYS_CLONE] = "clone",
+    [SYS_THREAD_EXIT] = "thread_exit",
+    [SYS_THREAD_JOIN] = "thread_join",
+    [SYS_SCHEDSTAT] = "schedstat",
+    [SYS_SCHED_SETDL] = "sched_setdl",
+    [SYS_URING_SETUP] = "uring_setup",
+    [SYS_URING_ENTER] = "uring_enter",
+    [SYS_SCSTAT] = "scstat",
+    [SYS_SYNC] = "sync",
+    [SYS_MD_CREATE] = "md_create",
+    [SYS_BLKIO] = "blkio",
+};
+
+/* 把 val 按宽度 width 右对齐打印, val 须小于 2^31 */
+static void print_col(uint32_t val, uint32_t width) {
+    char buf[16];
+    sprintf(buf, "%d", val);
+    uint32_t len = strlen(buf);
+    while (len++ < width) {
+        putchar(' ');
+    }
+    printf("%s", buf);
+}
+
+/* 64 位的周期数截断到能用 %d 打印的范围 */
+static uint32_t clamp_cycles(uint64_t cycles) {
+    return cycles > 0x7fffffff ? 0x7fffffff : (uint32_t)cycles;
+}
+
+/* part 占 whole 的百分比, 两者先同步右移到 whole 能用 32 位除数 */
+static uint32_t percent(uint64_t part, uint64_t whole) {
+    while (whole > 0xffffffff) {
+        whole >>= 1;
+        part >>= 1;
+    }
+    return whole == 0 ? 0 : (uint32_t)div_u64(part * 100, (uint32_t)whole);
+}
+
+static bool strace_hist;  // strace -h: 同时打印延迟直方图
+
+/* 按总耗时从多到少打印 stats 中被调用过的系统调用 */
+static void strace_print(struct syscall_stat* stats) {
+    uint64_t grand_total = 0;
+    uint32_t nr, calls = 0;
+    for (nr = 0; nr < NR_SYSCALLS; nr++) {
+        grand_total += stats[nr].total_cycles;
+        calls += stats[nr].calls;
+    }
+    printf("   pct     calls  avg(cyc)  max(cyc)  syscall\n");
+    bool printed[NR_SYSCALLS] = {false};
+    while (1) {
+        int32_t top = -1;
+        for (nr = 0; nr < NR_SYSCALLS; nr++) {
+            if (!printed[nr] && stats[nr].calls != 0 &&
+                (top == -1 || stats[nr].total_cycles > stats[top].total_cycles)) {
+                top = nr;
+            }
+        }
+        if (top == -1) {
+            break;
+        }
+        printed[top] = true;
+        struct syscall_stat* st = &stats[top];
+        print_col(percent(st->total_cycles, grand_total), 6);
+        print_col(st->calls, 10);
+        print_col(clamp_cycles(div_u64(st->total_cycles, st->calls)), 10);
+        print_col(clamp_cycles(st->max_cycles), 10);
+        printf("  %s\n", syscall_names[top] != NULL ? syscall_names[top] : "?");
+        if (strace_hist) {
+            uint32_t b;
+            for (b = 0; b < SCSTAT_BUCKETS; b++) {
+                if (st->hist[b] != 0) {
+                    printf("        %s2^%d cyc: %d\n", b == SCSTAT_BUCKETS - 1 ? ">=" : "", b, st->hist[b]);
+                }
+            }
+        }
+    }
+    printf(" total calls: %d\n", calls);
+}
+
+/* strace命令内建函数. "strace -c [-h]" 打印全系统的统计;
+   "strace -c [-h] cmd [args]" 打开本进程的统计, 返回cmd在argv中的下标, 由shell执行cmd后调用strace_report.
+   出错或无需执行命令时返回-1 */
+int32_t buildin_strace(uint32_t argc, char** argv) {
+    uint32_t arg_idx = 1;
+    bool count = false;
+    strace_hist = false;
+    while (arg_idx < argc && argv[arg_idx][0] == '-') {
+        if (!strcmp("-c", argv[arg_idx])) {
+            count = true;
+        } else if (!strcmp("-h", argv[arg_idx])) {
+            strace_hist = true;
+        } else {
+            break;
+        }
+        arg_idx++;
+    }
+    if (!count) {
+        printf("usage: strace -c [-h] [cmd [args]]\n  -c count calls and cycles per syscall\n  -h also print log2 latency histograms\n");
+        return -1;
+    }
+
+    if (arg_idx == argc) {
+        struct syscall_stat* stats = malloc(NR_SYSCALLS * sizeof(struct syscall_stat));
+        if (stats == NULL) {
+            printf("strace: out of memory\n");
+            return -1;
+        }
+        scstat(SCSTAT_GLOBAL, SCSTAT_GET, stats);
+        strace_print(stats);
+        free(stats);
+        return -1;
+    }
+    if (scstat(0, SCSTAT_ENABLE, NULL) == -1) {
+        printf("strace: enable failed\n");
+        return -1;
+    }
+    return arg_idx;
+}
+
+/* 命令执行完毕后打印本进程及其已退出的子进程的统计, 然后关闭统计 */
+void strace_report(void) {
+    struct syscall_stat* stats = malloc(NR_SYSCALLS * sizeof(struct syscall_stat));
+    if (stats != NULL && scstat(0, SCSTAT_GET_ALL, stats) == 0) {
+        strace_print(stats);
+    } else {
+        printf("strace: cannot read statistics\n");
+    }
+    if (stats != NULL) {
+        free(stats);
+    }
+    scstat(0, SCSTAT_DISABLE, NULL);
+}
@@ -12,6 +12,9 @@ void make_clear_abs_path(char* path, char* wash_buf);
 void buildin_pwd(uint32_t argc, char** argv);
 void buildin_ps(uint32_t argc, char** argv);
 void buildin_clear(uint32_t argc, char** argv);
+void buildin_sync(uint32_t argc, char** argv);
 void buildin_help(uint32_t argc, char** argv);
+int32_t buildin_strace(uint32_t argc, char** argv);
+void strace_report(void);
 
 #endif
\ No newline at end of file
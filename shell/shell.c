@@ -149,8 +149,16 @@ static void cmd_execute(uint32_t argc, char** argv) {
         buildin_rmdir(argc, argv);
     } else if (!strcmp("rm", argv[0])) {
         buildin_rm(argc, argv);
+    } else if (!strcmp("sync", argv[0])) {
+        buildin_sync(argc, argv);
     } else if (!strcmp("help", argv[0])) {
         buildin_help(argc, argv);
+    } else if (!strcmp("strace", argv[0])) {
+        int32_t cmd_idx = buildin_strace(argc, argv);
+        if (cmd_idx > 0) {
+            cmd_execute(argc - cmd_idx, argv + cmd_idx);
+            strace_report();
+        }
     } else {      // 如果是外部命令,需要从磁盘上加载
         int32_t pid = fork();
         if (pid) {	   // 父进程
@@ -0,0 +1,104 @@
+#include "futex.h"
+#include "global.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "thread.h"
+#include "spinlock.h"
+#include "kernel/list.h"
+#include "kernel/print.h"
+
+#define FUTEX_HASH_SIZE 64  // 哈希桶个数, 须为 2 的幂
+
+/* 哈希桶, 物理地址散列到同一个桶的等待者都挂在这里 */
+struct futex_bucket {
+    struct spinlock lock;
+    struct list waiters;
+};
+
+/* 一个在 futex 上等待的任务, 在等待者的内核栈上分配 */
+struct futex_q {
+    struct list_elem elem;
+    uint32_t key;               // futex 的物理地址, 共享同一物理页的任务据此找到彼此
+    struct task_struct* task;
+};
+
+static struct futex_bucket futex_queues[FUTEX_HASH_SIZE];
+
+/* 将用户地址 uaddr 换算成物理地址作为 futex 的键, 地址非法或未映射时返回 0 */
+static uint32_t futex_key(uint32_t* uaddr) {
+    uint32_t vaddr = (uint32_t)uaddr;
+    if (vaddr == 0 || vaddr >= 0xc0000000 || (vaddr & 3) != 0) {
+        return 0;
+    }
+    /* 页目录项不存在时访问 pte 会缺页, 先检查 pde */
+    if (!(*pde_ptr(vaddr) & PG_P_1) || !(*pte_ptr(vaddr) & PG_P_1)) {
+        return 0;
+    }
+    return addr_v2p(vaddr);
+}
+
+static struct futex_bucket* futex_hash(uint32_t key) {
+    return &futex_queues[(key >> 2) & (FUTEX_HASH_SIZE - 1)];
+}
+
+/* 若 *uaddr 仍等于 val 就阻塞, 直到有人对同一地址 futex_wake.
+   判断和入队在桶锁下完成, 唤醒者改完 *uaddr 再 wake 时不会被漏掉.
+   被唤醒返回 0, *uaddr 已不等于 val 或地址非法返回 -1 */
+int32_t sys_futex_wait(uint32_t* uaddr, uint32_t val) {
+    uint32_t key = futex_key(uaddr);
+    if (key == 0) {
+        return -1;
+    }
+    struct futex_bucket* hb = futex_hash(key);
+    struct futex_q q;
+    q.key = key;
+    q.task = running_thread();
+
+    enum intr_status old_status = spin_lock_irqsave(&hb->lock);
+    if (*(volatile uint32_t*)uaddr != val) {
+        spin_unlock_irqrestore(&hb->lock, old_status);
+        return -1;
+    }
+    list_append(&hb->waiters, &q.elem);
+    q.task->status = TASK_BLOCKED;
+    spin_unlock(&hb->lock);
+    schedule();
+    intr_set_status(old_status);
+    return 0;
+}
+
+/* 唤醒最多 nr_wake 个在 uaddr 上等待的任务, 按等待的先后顺序, 返回唤醒的个数 */
+int32_t sys_futex_wake(uint32_t* uaddr, uint32_t nr_wake) {
+    uint32_t key = futex_key(uaddr);
+    if (key == 0) {
+        return -1;
+    }
+    struct futex_bucket* hb = futex_hash(key);
+    int32_t woken = 0;
+
+    enum intr_status old_status = spin_lock_irqsave(&hb->lock);
+    struct list_elem* elem = hb->waiters.head.next;
+    while (elem != &hb->waiters.tail && (uint32_t)woken < nr_wake) {
+        struct list_elem* next = elem->next;
+        struct futex_q* q = elem2entry(struct futex_q, elem, elem);
+        if (q->key == key) {
+            list_remove(elem);
+            thread_unblock(q->task);
+            woken++;
+        }
+        elem = next;
+    }
+    spin_unlock_irqrestore(&hb->lock, old_status);
+    return woken;
+}
+
+void futex_init(void) {
+    put_str("futex_init start\n");
+    uint32_t idx;
+    for (idx = 0; idx < FUTEX_HASH_SIZE; idx++) {
+        spin_lock_init(&futex_queues[idx].lock);
+        list_init(&futex_queues[idx].waiters);
+    }
+    put_str("futex_init done\n");
+}
@@ -0,0 +1,57 @@
+#ifndef __THREAD_SPINLOCK_H
+#define __THREAD_SPINLOCK_H
+
+#include "stdint.h"
+#include "interrupt.h"
+
+/* 自旋锁, 用于多处理器之间的互斥, 持锁时不可睡眠.
+   中断处理程序也会申请的锁, 必须在关中断下持有, 否则同一 cpu 上会自己等自己 */
+struct spinlock {
+    volatile uint32_t locked;  // 0 表示空闲, 1 表示已被持有
+};
+
+/* 自旋等待时提示 cpu 降低功耗, 同时作为编译器屏障使每次都重新读内存 */
+static inline void cpu_relax(void) {
+    asm volatile ("pause" : : : "memory");
+}
+
+static inline void spin_lock_init(struct spinlock* lock) {
+    lock->locked = 0;
+}
+
+/* 尝试获取自旋锁, 成功返回 true. xchg 自带 lock 前缀, 是原子操作 */
+static inline bool spin_trylock(struct spinlock* lock) {
+    uint32_t old = 1;
+    asm volatile ("xchgl %0, %1" : "+r" (old), "+m" (lock->locked) : : "memory");
+    return old == 0;
+}
+
+/* 获取自旋锁, 先只读地等锁被释放再去抢, 避免反复 xchg 争抢总线 */
+static inline void spin_lock(struct spinlock* lock) {
+    while (!spin_trylock(lock)) {
+        while (lock->locked) {
+            cpu_relax();
+        }
+    }
+}
+
+/* 释放自旋锁. x86 的写操作不会越过之前的读写, 只需阻止编译器重排 */
+static inline void spin_unlock(struct spinlock* lock) {
+    asm volatile ("" : : : "memory");
+    lock->locked = 0;
+}
+
+/* 关中断并获取自旋锁, 返回关中断前的状态 */
+static inline enum intr_status spin_lock_irqsave(struct spinlock* lock) {
+    enum intr_status old_status = intr_disable();
+    spin_lock(lock);
+    return old_status;
+}
+
+/* 释放自旋锁并恢复之前的中断状态 */
+static inline void spin_unlock_irqrestore(struct spinlock* lock, enum intr_status old_status) {
+    spin_unlock(lock);
+    intr_set_status(old_status);
+}
+
+#endif
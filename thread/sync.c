@@ -4,24 +4,46 @@
 #include "debug.h"
 #include "interrupt.h"
 
+#define PI_MAX_DEPTH 8  // 优先级沿"等待的锁 -> 持有者"链传递的最大深度
+
+/* 保护各锁的 holder、holder_elem 以及任务的 held_locks、blocked_on.
+   获取顺序在信号量的锁和就绪队列的锁之前 */
+static struct spinlock pi_lock;
 
 /* 初始化信号量 */
 void sema_init(struct semaphore* psema, uint8_t value) {
     psema->value = value;        // 为信号量赋初值
     list_init(&psema->waiters);  // 初始化信号量的等待队列
+    spin_lock_init(&psema->lock);
 }
 
 /* 初始化锁plock */
 void lock_init(struct lock* plock) {
     plock->holder = NULL;
     plock->holder_repeat_nr = 0;
+    plock->holder_elem.prev = plock->holder_elem.next = NULL;
     sema_init(&plock->semaphore, 1);  // 信号量初值为 1
 }
 
+/* 返回等待队列 waiters 中优先级最高的任务, 优先级相同时取先来的, 队列为空返回 NULL.
+   调用时持有信号量的锁 */
+static struct task_struct* highest_prio_waiter(struct list* waiters) {
+    struct task_struct* best = NULL;
+    struct list_elem* elem = waiters->head.next;
+    while (elem != &waiters->tail) {
+        struct task_struct* pthread = elem2entry(struct task_struct, general_tag, elem);
+        if (best == NULL || pthread->priority > best->priority) {
+            best = pthread;
+        }
+        elem = elem->next;
+    }
+    return best;
+}
+
 /* 信号量 down 操作 */
 void sema_down(struct semaphore* psema) {
-    /* 关中断来保证原子操作 */
-    enum intr_status old_status = intr_disable();
+    /* 关中断并持自旋锁来保证原子操作 */
+    enum intr_status old_status = spin_lock_irqsave(&psema->lock);
     // 若 value 为 0 ，表示已经被别人持有
     while (psema->value == 0) {
         ASSERT(!elem_find(&psema->waiters, &running_thread()->general_tag));
@@ -30,36 +52,108 @@ void sema_down(struct semaphore* psema) {
             PANIC("sema_down: thread blocked has been in waiters_lsit\n");
         }
         // 若信号量的值等于 0 ，则当前线程把自己加入该锁的等待队列，然后阻塞自己
+        // 先置为阻塞态再放开自旋锁, 其他 cpu 随即 sema_up 也能正确唤醒它
         list_append(&psema->waiters, &running_thread()->general_tag);
-        thread_block(TASK_BLOCKED);   // 阻塞线程，直到被唤醒
+        running_thread()->status = TASK_BLOCKED;
+        spin_unlock(&psema->lock);
+        schedule();   // 阻塞线程，直到被唤醒
+        spin_lock(&psema->lock);
     }
     // 若 value 为 1 或被唤醒后，会执行下面的代码，也就是获得了锁
     psema->value--;
     ASSERT(psema->value == 0);
-    intr_set_status(old_status);  // 恢复之前的中断状态
+    spin_unlock_irqrestore(&psema->lock, old_status);  // 恢复之前的中断状态
 }
 
 /* 信号量的 up 操作 */
 void sema_up(struct semaphore* psema) {
-    enum intr_status old_status = intr_disable();  // 关中断，保证原子操作
+    enum intr_status old_status = spin_lock_irqsave(&psema->lock);  // 关中断并持锁，保证原子操作
     ASSERT(psema->value == 0);
     if (!list_empty(&psema->waiters)) {
-        struct task_struct* thread_blocked = elem2entry(struct task_struct, general_tag, list_pop(&psema->waiters));
+        // 按优先级而不是先来先服务唤醒
+        struct task_struct* thread_blocked = highest_prio_waiter(&psema->waiters);
+        list_remove(&thread_blocked->general_tag);
         thread_unblock(thread_blocked);
     }
     psema->value++;
     ASSERT(psema->value == 1);
-    intr_set_status(old_status);  // 恢复之前的中断状态
+    spin_unlock_irqrestore(&psema->lock, old_status);  // 恢复之前的中断状态
+}
+
+/* cur 要等待 plock: 把 cur 的优先级沿着持有者链传下去, 使持有者尽快运行并释放锁.
+   调用时持有 pi_lock */
+static void pi_donate(struct lock* plock, struct task_struct* cur) {
+    cur->blocked_on = plock;
+    struct lock* l = plock;
+    uint32_t depth = 0;
+    while (l != NULL && l->holder != NULL && depth++ < PI_MAX_DEPTH) {
+        struct task_struct* holder = l->holder;
+        if (holder->priority >= cur->priority) {
+            break;
+        }
+        thread_set_priority(holder, cur->priority);
+        l = holder->blocked_on;
+    }
+}
+
+/* 按 pthread 自身的优先级和它所持各锁上等待者的最高优先级, 重新计算其优先级. 调用时持有 pi_lock */
+static void pi_update(struct task_struct* pthread) {
+    uint8_t prio = pthread->normal_prio;
+    struct list_elem* elem = pthread->held_locks.head.next;
+    while (elem != &pthread->held_locks.tail) {
+        struct lock* l = elem2entry(struct lock, holder_elem, elem);
+        spin_lock(&l->semaphore.lock);
+        struct task_struct* waiter = highest_prio_waiter(&l->semaphore.waiters);
+        if (waiter != NULL && waiter->priority > prio) {
+            prio = waiter->priority;
+        }
+        spin_unlock(&l->semaphore.lock);
+        elem = elem->next;
+    }
+    thread_set_priority(pthread, prio);
 }
 
 /* 获取锁 plock */
 void lock_acquire(struct lock* plock) {
     // 排除曾经自己已经持有锁但还未将其释放的情况
     if (plock->holder != running_thread()) {
-        sema_down(&plock->semaphore);  // 对信号量 P 操作，原子操作
-        plock->holder = running_thread();
+        struct task_struct* cur = running_thread();
+        /* thread_init 之前只有 main 一个执行流, 它的 pcb 还没初始化, 也不会有竞争 */
+        if (main_thread == NULL) {
+            sema_down(&plock->semaphore);
+            ASSERT(plock->holder_repeat_nr == 0);
+            plock->holder_repeat_nr = 1;
+            plock->holder = cur;
+            return;
+        }
+
+        /* 在 pi_lock 中取信号量并同时设置 holder, 这样等待者看到信号量被占时一定也能看到持有者.
+           等待者先进入 waiters 再传递优先级, 之后取得锁的任务在 pi_update 中也一定能看到它 */
+        enum intr_status old_status = spin_lock_irqsave(&pi_lock);
+        spin_lock(&plock->semaphore.lock);
+        while (plock->semaphore.value == 0) {
+            list_append(&plock->semaphore.waiters, &cur->general_tag);
+            pi_donate(plock, cur);
+            cur->status = TASK_BLOCKED;
+            cur->block_reason = BLOCK_LOCK;  // 等锁的时间单独统计
+            spin_unlock(&plock->semaphore.lock);
+            spin_unlock(&pi_lock);
+            schedule();
+            cur->block_reason = BLOCK_OTHER;
+            spin_lock(&pi_lock);
+            spin_lock(&plock->semaphore.lock);
+        }
+        plock->semaphore.value--;
+        spin_unlock(&plock->semaphore.lock);
+
         ASSERT(plock->holder_repeat_nr == 0);
         plock->holder_repeat_nr = 1;
+        /* 其余的等待者把优先级传给新的持有者 */
+        cur->blocked_on = NULL;
+        plock->holder = cur;
+        list_append(&cur->held_locks, &plock->holder_elem);
+        pi_update(cur);
+        spin_unlock_irqrestore(&pi_lock, old_status);
     } else {
         plock->holder_repeat_nr++;
     }
@@ -73,7 +167,95 @@ void lock_release(struct lock* plock) {
         return;
     }
     ASSERT(plock->holder_repeat_nr == 1);
-    plock->holder = NULL;        // 把锁的持有者置空放在 v 操作之前
+    if (plock->holder_elem.next != NULL) {
+        /* 不再持有此锁, 撤销因它而继承来的优先级 */
+        struct task_struct* cur = running_thread();
+        enum intr_status old_status = spin_lock_irqsave(&pi_lock);
+        list_remove(&plock->holder_elem);
+        plock->holder_elem.prev = plock->holder_elem.next = NULL;
+        plock->holder = NULL;        // 把锁的持有者置空放在 v 操作之前
+        pi_update(cur);
+        spin_unlock_irqrestore(&pi_lock, old_status);
+    } else {
+        plock->holder = NULL;
+    }
     plock->holder_repeat_nr = 0;
     sema_up(&plock->semaphore);  // 信号量的 V 操作，也是原子操作
 }
+
+/* 初始化读写锁 rw */
+void rwlock_init(struct rwlock* rw) {
+    spin_lock_init(&rw->lock);
+    rw->readers = 0;
+    rw->writer = NULL;
+    list_init(&rw->read_waiters);
+    list_init(&rw->write_waiters);
+}
+
+/* 把当前任务挂到 waiters 上阻塞, 调用时持有 rw->lock, 返回时已不再持有.
+   唤醒者会先替它取得锁, 所以醒来后无需再检查 */
+static void rw_wait(struct rwlock* rw, struct list* waiters) {
+    struct task_struct* cur = running_thread();
+    list_append(waiters, &cur->general_tag);
+    cur->status = TASK_BLOCKED;
+    cur->block_reason = BLOCK_LOCK;
+    spin_unlock(&rw->lock);
+    schedule();
+    cur->block_reason = BLOCK_OTHER;
+}
+
+/* 以读者身份获取 rw */
+void rw_read_acquire(struct rwlock* rw) {
+    enum intr_status old_status = spin_lock_irqsave(&rw->lock);
+    if (rw->writer != NULL || !list_empty(&rw->write_waiters)) {
+        rw_wait(rw, &rw->read_waiters);
+        intr_set_status(old_status);
+        return;
+    }
+    rw->readers++;
+    spin_unlock_irqrestore(&rw->lock, old_status);
+}
+
+/* 读者释放 rw, 最后一个读者离开时把锁交给一个等待的写者 */
+void rw_read_release(struct rwlock* rw) {
+    enum intr_status old_status = spin_lock_irqsave(&rw->lock);
+    ASSERT(rw->readers > 0 && rw->writer == NULL);
+    if (--rw->readers == 0 && !list_empty(&rw->write_waiters)) {
+        struct task_struct* pthread = elem2entry(struct task_struct, general_tag, list_pop(&rw->write_waiters));
+        rw->writer = pthread;
+        thread_unblock(pthread);
+    }
+    spin_unlock_irqrestore(&rw->lock, old_status);
+}
+
+/* 以写者身份获取 rw */
+void rw_write_acquire(struct rwlock* rw) {
+    enum intr_status old_status = spin_lock_irqsave(&rw->lock);
+    ASSERT(rw->writer != running_thread());
+    if (rw->writer != NULL || rw->readers > 0) {
+        rw_wait(rw, &rw->write_waiters);
+        intr_set_status(old_status);
+        return;
+    }
+    rw->writer = running_thread();
+    spin_unlock_irqrestore(&rw->lock, old_status);
+}
+
+/* 写者释放 rw, 有读者在等就把它们全部放行, 否则交给下一个写者 */
+void rw_write_release(struct rwlock* rw) {
+    enum intr_status old_status = spin_lock_irqsave(&rw->lock);
+    ASSERT(rw->writer == running_thread());
+    rw->writer = NULL;
+    if (!list_empty(&rw->read_waiters)) {
+        while (!list_empty(&rw->read_waiters)) {
+            struct task_struct* pthread = elem2entry(struct task_struct, general_tag, list_pop(&rw->read_waiters));
+            rw->readers++;
+            thread_unblock(pthread);
+        }
+    } else if (!list_empty(&rw->write_waiters)) {
+        struct task_struct* pthread = elem2entry(struct task_struct, general_tag, list_pop(&rw->write_waiters));
+        rw->writer = pthread;
+        thread_unblock(pthread);
+    }
+    spin_unlock_irqrestore(&rw->lock, old_status);
+}
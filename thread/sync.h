@@ -4,11 +4,13 @@
 #include "kernel/list.h"
 #include "stdint.h"
 #include "thread.h"
+#include "spinlock.h"
 
 // 信号量结构
 struct semaphore {
     uint8_t value;
     struct list waiters;
+    struct spinlock lock;  // 保护 value 和 waiters, 关中断只能挡住本 cpu
 };
 
 // 锁结构
@@ -16,6 +18,29 @@ struct lock {
     struct task_struct* holder;  // 锁的持有者
     struct semaphore semaphore;  // 用二元信号量实现锁
     uint32_t holder_repeat_nr;   // 锁的持有者重复申请锁的次数
+    struct list_elem holder_elem;  // 在持有者 held_locks 中的结点
 };
 
+/* 读写锁: 读者之间可以并行, 写者独占. 有写者在等时新来的读者也要等, 写者释放时
+   优先放行等着的读者, 这样读者和写者都不会饿死. 不可重复申请, 可能睡眠 */
+struct rwlock {
+    struct spinlock lock;        // 保护以下各项
+    uint32_t readers;            // 持有锁的读者数
+    struct task_struct* writer;  // 持有锁的写者
+    struct list read_waiters;    // 等待的读者
+    struct list write_waiters;   // 等待的写者
+};
+
+void sema_init(struct semaphore* psema, uint8_t value);
+void sema_down(struct semaphore* psema);
+void sema_up(struct semaphore* psema);
+void lock_init(struct lock* plock);
+void lock_acquire(struct lock* plock);
+void lock_release(struct lock* plock);
+void rwlock_init(struct rwlock* rw);
+void rw_read_acquire(struct rwlock* rw);
+void rw_read_release(struct rwlock* rw);
+void rw_write_acquire(struct rwlock* rw);
+void rw_write_release(struct rwlock* rw);
+
 #endif 
\ No newline at end of file
@@ -12,42 +12,135 @@
 #include "stdio.h"
 #include "file.h"
 #include "fs.h"
+#include "timer.h"
+#include "smp.h"
+#include "div64.h"
+#include "fpu.h"
 
-/* pid的位图,最大支持1024个pid */
-uint8_t pid_bitmap_bits[128] = {0};
+/* pid的位图,最大支持MAX_PID个pid */
+uint8_t pid_bitmap_bits[MAX_PID / 8] = {0};
 
 /* pid池 */
 struct pid_pool {
     struct bitmap pid_bitmap;  // pid位图
     uint32_t pid_start;	       // 起始pid
+    uint32_t next_idx;         // 下次分配从此位开始找, 刚释放的 pid 不会马上被重用
     struct lock pid_lock;      // 分配pid锁
 }pid_pool;
 
 struct task_struct* main_thread;
-struct task_struct* idle_thread;  // idle线程
-struct list thread_ready_list;
 struct list thread_all_list;
-static struct list_elem* thread_tag;
+struct lock thread_all_lock;  // 保护 thread_all_list、pid_table 及其中任务的父子关系, 可能睡眠
+
+/* 最近释放的 pcb 页的缓存, 创建任务时优先从这里取, 不必再走页分配器和清零.
+   pcb 和内核栈在同一页中, 新任务的 pcb 会由 init_thread 清零或由 fork 整页复制, 栈不需要清零 */
+#define TASK_CACHE_MAX 16          // 最多缓存的页数, 多出的直接还给内核内存池
+
+struct task_page {
+    struct task_page* next;
+};
+
+struct task_cache {
+    struct spinlock lock;          // 释放 pcb 时可能已关中断, 故用自旋锁
+    struct task_page* head;
+    uint32_t nr;
+};
+static struct task_cache task_cache;
+
+static struct spinlock dl_bw_lock;  // 保护各 cpu 的 rq->dl_bw 和任务的 dl_bw, 先于 rq->lock 获取
+
+/* 以 pid 为下标的任务表, 由 thread_all_lock 保护, 按 pid 查找任务时不必遍历 thread_all_list */
+static struct task_struct* pid_table[MAX_PID + 1];
 
 //struct lock pid_lock;
 
 extern void switch_to(struct task_struct* cur, struct task_struct* next);
 extern void init(void);
 
+/* 为新任务分配 pcb 页, 内容未定义. 失败返回 NULL */
+struct task_struct* alloc_task_struct(void) {
+    enum intr_status old_status = spin_lock_irqsave(&task_cache.lock);
+    struct task_page* page = task_cache.head;
+    if (page != NULL) {
+        task_cache.head = page->next;
+        task_cache.nr--;
+    }
+    spin_unlock_irqrestore(&task_cache.lock, old_status);
+    if (page != NULL) {
+        return (struct task_struct*)page;
+    }
+    return get_kernel_pages(1);
+}
+
+/* 释放任务的 pcb 页, 缓存未满时留着给下一个新任务用 */
+void free_task_struct(struct task_struct* pthread) {
+    struct task_page* page = (struct task_page*)pthread;
+    enum intr_status old_status = spin_lock_irqsave(&task_cache.lock);
+    if (task_cache.nr < TASK_CACHE_MAX) {
+        page->next = task_cache.head;
+        task_cache.head = page;
+        task_cache.nr++;
+        page = NULL;
+    }
+    spin_unlock_irqrestore(&task_cache.lock, old_status);
+    if (page != NULL) {
+        mfree_page(PF_KERNEL, page, 1);
+    }
+}
+
+/* 把缓存的 pcb 页全部还给内核内存池, 返回归还的页数. 内核内存不足时由 get_kernel_pages 调用 */
+uint32_t task_cache_shrink(void) {
+    enum intr_status old_status = spin_lock_irqsave(&task_cache.lock);
+    struct task_page* page = task_cache.head;
+    uint32_t nr = task_cache.nr;
+    task_cache.head = NULL;
+    task_cache.nr = 0;
+    spin_unlock_irqrestore(&task_cache.lock, old_status);
+    while (page != NULL) {
+        struct task_page* next = page->next;
+        mfree_page(PF_KERNEL, page, 1);
+        page = next;
+    }
+    return nr;
+}
+
 /* 初始化pid池 */
 static void pid_pool_init(void) { 
     pid_pool.pid_start = 1;
+    pid_pool.next_idx = 0;
     pid_pool.pid_bitmap.bits = pid_bitmap_bits;
-    pid_pool.pid_bitmap.btmp_bytes_len = 128;
+    pid_pool.pid_bitmap.btmp_bytes_len = MAX_PID / 8;
     bitmap_init(&pid_pool.pid_bitmap);
     lock_init(&pid_pool.pid_lock);
 }
 
-/* 分配pid */
+/* 分配pid. 从上次分配的位置往后找, 到末尾后回绕, 整字节已占满时一次跨过8位,
+   pid 没有回绕前每次分配都只看一位 */
 static pid_t allocate_pid(void) {
     lock_acquire(&pid_pool.pid_lock);
-    int32_t bit_idx = bitmap_scan(&pid_pool.pid_bitmap, 1);
+    uint32_t bits_len = pid_pool.pid_bitmap.btmp_bytes_len * 8;
+    uint32_t bit_idx = pid_pool.next_idx;
+    uint32_t scanned = 0;
+    while (scanned < bits_len) {
+        if (bit_idx >= bits_len) {
+            bit_idx = 0;
+        }
+        if (bit_idx % 8 == 0 && pid_bitmap_bits[bit_idx / 8] == 0xff) {
+            bit_idx += 8;
+            scanned += 8;
+            continue;
+        }
+        if (!bitmap_scan_test(&pid_pool.pid_bitmap, bit_idx)) {
+            break;
+        }
+        bit_idx++;
+        scanned++;
+    }
+    if (scanned >= bits_len) {
+        PANIC("allocate_pid: no free pid\n");
+    }
     bitmap_set(&pid_pool.pid_bitmap, bit_idx, 1);
+    pid_pool.next_idx = bit_idx + 1;
     lock_release(&pid_pool.pid_lock);
     return (bit_idx + pid_pool.pid_start);
 }
@@ -74,8 +167,546 @@ struct task_struct* running_thread() {
     return (struct task_struct*)(esp & 0xfffff000);
 }
 
+/* vruntime 按回绕安全的方式比较, a 在 b 之前时返回 true */
+static bool vruntime_before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+/* 把优先级换算成调度权重, 优先级为 NICE_0_PRIO 时权重为 NICE_0_LOAD */
+static uint32_t prio_to_weight(uint8_t prio) {
+    uint32_t weight = (uint32_t)prio * NICE_0_LOAD / NICE_0_PRIO;
+    return weight > 0 ? weight : 1;
+}
+
+/* 将任务 pthread 上次结算以来新跑的 elapsed_ticks 按权重折算进 vruntime */
+static void update_curr(struct task_struct* pthread) {
+    uint32_t delta = pthread->elapsed_ticks - pthread->exec_start;
+    pthread->exec_start = pthread->elapsed_ticks;
+    if (pthread->dl_runtime != 0) {
+        pthread->dl_budget -= delta;  // 实时任务只消耗预算, 不参与公平调度
+        return;
+    }
+    /* 权重越大 vruntime 涨得越慢, 因而能分到更多 cpu */
+    pthread->vruntime += delta * (NICE_0_LOAD * NICE_0_LOAD / pthread->weight);
+}
+
+/* 更新就绪队列的 min_vruntime, 它只增不减. 调用时持有 rq->lock */
+static void update_min_vruntime(struct cpu* c) {
+    struct run_queue* rq = &c->rq;
+    struct task_struct* cur = rq->curr;
+    uint32_t vruntime = rq->min_vruntime;
+    bool has_cur = (cur->status == TASK_RUNNING && cur != c->idle && cur->dl_runtime == 0);
+
+    if (has_cur) {
+        vruntime = cur->vruntime;
+    }
+    if (rq->leftmost != NULL) {
+        struct task_struct* left = rb_entry(struct task_struct, run_node, rq->leftmost);
+        if (!has_cur || vruntime_before(left->vruntime, vruntime)) {
+            vruntime = left->vruntime;
+        }
+    }
+    if (vruntime_before(rq->min_vruntime, vruntime)) {
+        rq->min_vruntime = vruntime;
+    }
+}
+
+/* 截止期限按回绕安全的方式比较, a 在 b 之前时返回 true */
+static bool dl_time_before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+/* 将实时任务 pthread 按绝对截止期限插入 rq 的实时队列, 调用时持有 rq->lock */
+static void enqueue_dl(struct run_queue* rq, struct task_struct* pthread) {
+    struct rb_node** link = &rq->dl_timeline.node;
+    struct rb_node* parent = NULL;
+    bool leftmost = true;
+
+    while (*link != NULL) {
+        parent = *link;
+        struct task_struct* entry = rb_entry(struct task_struct, run_node, parent);
+        if (dl_time_before(pthread->dl_abs_deadline, entry->dl_abs_deadline)) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+    if (leftmost) {
+        rq->dl_leftmost = &pthread->run_node;
+    }
+    rb_link_node(&pthread->run_node, parent, link);
+    rb_insert_color(&pthread->run_node, &rq->dl_timeline);
+
+    pthread->on_rq = true;
+    rq->nr_running++;
+    rq->dl_nr_running++;
+}
+
+/* 将实时任务 pthread 从 rq 的实时队列中摘除, 调用时持有 rq->lock */
+static void dequeue_dl(struct run_queue* rq, struct task_struct* pthread) {
+    if (rq->dl_leftmost == &pthread->run_node) {
+        rq->dl_leftmost = rb_next(&pthread->run_node);
+    }
+    rb_erase(&pthread->run_node, &rq->dl_timeline);
+
+    pthread->on_rq = false;
+    rq->nr_running--;
+    rq->dl_nr_running--;
+}
+
+/* 将 pthread 按 vruntime 插入就绪队列 rq, 实时任务则插入实时队列. 调用时持有 rq->lock */
+static void enqueue_task(struct run_queue* rq, struct task_struct* pthread) {
+    ASSERT(!pthread->on_rq);
+    if (pthread->dl_runtime != 0) {
+        enqueue_dl(rq, pthread);
+        return;
+    }
+    struct rb_node** link = &rq->tasks_timeline.node;
+    struct rb_node* parent = NULL;
+    bool leftmost = true;
+
+    /* vruntime 相同的任务排在已有任务的右边, 保证相同 vruntime 时先来先服务 */
+    while (*link != NULL) {
+        parent = *link;
+        struct task_struct* entry = rb_entry(struct task_struct, run_node, parent);
+        if (vruntime_before(pthread->vruntime, entry->vruntime)) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = false;
+        }
+    }
+    if (leftmost) {
+        rq->leftmost = &pthread->run_node;
+    }
+    rb_link_node(&pthread->run_node, parent, link);
+    rb_insert_color(&pthread->run_node, &rq->tasks_timeline);
+
+    pthread->on_rq = true;
+    rq->nr_running++;
+    rq->load_weight += pthread->weight;
+}
+
+/* 将 pthread 从就绪队列 rq 中摘除, 调用时持有 rq->lock */
+static void dequeue_task(struct run_queue* rq, struct task_struct* pthread) {
+    ASSERT(pthread->on_rq);
+    if (pthread->dl_runtime != 0) {
+        dequeue_dl(rq, pthread);
+        return;
+    }
+    if (rq->leftmost == &pthread->run_node) {
+        rq->leftmost = rb_next(&pthread->run_node);
+    }
+    rb_erase(&pthread->run_node, &rq->tasks_timeline);
+
+    pthread->on_rq = false;
+    rq->nr_running--;
+    rq->load_weight -= pthread->weight;
+}
+
+/* 锁住 pthread 所在的就绪队列. 任务只会在持有原队列锁时迁移,
+   所以拿到锁后 pthread->cpu 还没变, 锁的就是它所在的队列 */
+static struct run_queue* task_rq_lock(struct task_struct* pthread) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    while (1) {
+        struct run_queue* rq = &pthread->cpu->rq;
+        spin_lock(&rq->lock);
+        if (rq == &pthread->cpu->rq) {
+            return rq;
+        }
+        spin_unlock(&rq->lock);
+    }
+}
+
+/* 让 cpu c 尽快重新调度: 清空其当前任务的时间片, 若不是本 cpu 再发处理器间中断叫醒它 */
+static void resched_cpu(struct cpu* c) {
+    struct task_struct* curr = c->rq.curr;
+    curr->ticks = 0;
+    if (curr != running_thread()) {
+        smp_send_reschedule(c);
+    }
+}
+
+/* 找一个闲着的 cpu 叫它来偷任务, 使就绪任务不必排队等待忙碌的 cpu */
+static void kick_idle_cpu(struct cpu* busy) {
+    uint8_t cpu_id;
+    for (cpu_id = 0; cpu_id < nr_cpus; cpu_id++) {
+        struct cpu* c = &cpus[cpu_id];
+        if (c != busy && c->online && c->rq.curr == c->idle && c->rq.nr_running == 0) {
+            resched_cpu(c);
+            return;
+        }
+    }
+}
+
+/* 为新任务挑选负载最轻的 cpu, 负载按就绪任务数加上正在运行的任务算 */
+static struct cpu* select_task_cpu(void) {
+    struct cpu* best = &cpus[0];
+    uint32_t best_load = 0xffffffff;
+    uint8_t cpu_id;
+    for (cpu_id = 0; cpu_id < nr_cpus; cpu_id++) {
+        struct cpu* c = &cpus[cpu_id];
+        if (!c->online) {
+            continue;
+        }
+        uint32_t load = c->rq.nr_running + (c->rq.curr != NULL && c->rq.curr != c->idle);
+        if (load < best_load) {
+            best = c;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+/* 以下为实时调度类: 实时任务按最早截止期限优先(EDF)调度, 总是先于普通任务运行.
+   每个任务每周期有 dl_runtime 的预算, 用完就被节流到下个周期, 不会挤占其他任务的带宽.
+   实时任务在接纳时固定在某个 cpu 上, 不参与 idle_balance, 每个 cpu 的带宽之和不超过 DL_BW_LIMIT,
+   在截止期限等于周期时这保证了所有任务都能赶上截止期限 */
+
+/* 实时任务 pthread 在 cpu c 上就绪, 若它的截止期限早于 c 上正在运行的任务就抢占之. 调用时持有 c->rq.lock */
+static void dl_check_preempt(struct cpu* c, struct task_struct* pthread) {
+    struct task_struct* curr = c->rq.curr;
+    if (curr == NULL || curr == pthread) {
+        return;
+    }
+    if (curr == c->idle || curr->dl_runtime == 0 || \
+        dl_time_before(pthread->dl_abs_deadline, curr->dl_abs_deadline)) {
+        resched_cpu(c);
+    }
+}
+
+/* 从 now 开始一个新周期, 预算充满 */
+static void dl_new_period(struct task_struct* pthread, uint32_t now) {
+    pthread->dl_budget = pthread->dl_runtime;
+    pthread->dl_abs_deadline = now + pthread->dl_deadline;
+    pthread->dl_next_period = now + pthread->dl_period;
+}
+
+/* 到了下个周期, 补充预算, 上个周期超支的部分从中扣除. 补充后截止期限已经过了, 说明落后太多, 从 now 重新开始 */
+static void dl_replenish(struct task_struct* pthread, uint32_t now) {
+    while (pthread->dl_budget <= 0) {
+        pthread->dl_budget += pthread->dl_runtime;
+        pthread->dl_abs_deadline = pthread->dl_next_period + pthread->dl_deadline;
+        pthread->dl_next_period += pthread->dl_period;
+    }
+    if (!dl_time_before(now, pthread->dl_abs_deadline)) {
+        dl_new_period(pthread, now);
+    }
+}
+
+/* 实时任务 pthread 的预算已用完, 让它离开就绪队列直到下个周期. 调用时持有其所在队列的锁, 它不在队列中 */
+static void dl_throttle(struct task_struct* pthread) {
+    pthread->dl_throttled = true;
+    pthread->status = TASK_READY;
+    pthread->dl_timer.expires = pthread->dl_next_period;  // 已经到期的会在下个嘀嗒执行
+    add_timer(&pthread->dl_timer);
+}
+
+/* dl_timer 到期: 被节流的实时任务补充预算, 回到就绪队列. 在时钟中断中调用 */
+static void dl_timer_fn(void* data) {
+    struct task_struct* pthread = data;
+    struct run_queue* rq = task_rq_lock(pthread);
+    if (pthread->dl_throttled) {
+        pthread->dl_throttled = false;
+        dl_replenish(pthread, ticks);
+        pthread->last_queued = clock_monotonic_ns();  // 被节流的时间不算就绪等待
+        enqueue_task(rq, pthread);
+        dl_check_preempt(pthread->cpu, pthread);
+    }
+    spin_unlock(&rq->lock);
+}
+
+/* 阻塞的实时任务 pthread 被唤醒, 调用时持有 rq->lock. 按 CBS 的规则, 截止期限已过,
+   或者剩余预算在截止期限前用掉会超出它的带宽时, 从现在开始新周期; 本周期预算已用完的节流到下个周期 */
+static void dl_wakeup(struct run_queue* rq, struct task_struct* pthread) {
+    uint32_t now = ticks;
+    if (!dl_time_before(now, pthread->dl_abs_deadline)) {
+        dl_new_period(pthread, now);
+    } else if (pthread->dl_budget <= 0) {
+        dl_throttle(pthread);
+        return;
+    } else if ((uint64_t)pthread->dl_budget * pthread->dl_deadline > \
+               (uint64_t)(pthread->dl_abs_deadline - now) * pthread->dl_runtime) {
+        dl_new_period(pthread, now);
+    }
+    enqueue_task(rq, pthread);
+    pthread->status = TASK_READY;
+    dl_check_preempt(pthread->cpu, pthread);
+}
+
+/* 为新的实时任务挑选实时带宽最空闲且放得下 bw 的 cpu, 都放不下时返回 NULL. 调用时持有 dl_bw_lock */
+static struct cpu* dl_select_cpu(uint32_t bw) {
+    struct cpu* best = NULL;
+    uint8_t cpu_id;
+    for (cpu_id = 0; cpu_id < nr_cpus; cpu_id++) {
+        struct cpu* c = &cpus[cpu_id];
+        if (c->online && c->rq.dl_bw + bw <= DL_BW_LIMIT && \
+            (best == NULL || c->rq.dl_bw < best->rq.dl_bw)) {
+            best = c;
+        }
+    }
+    return best;
+}
+
+/* 修改 pthread 的实时调度参数, 先做接纳控制. pick_cpu 为 true 时 pthread 是还没入队的新任务,
+   可以放到任意 cpu 上; 否则不迁移, 只在它当前的 cpu 上接纳. 成功返回 0, 参数非法或带宽不足返回 -1 */
+static int32_t dl_setattr(struct task_struct* pthread, const struct sched_dl_attr* attr, bool pick_cpu) {
+    uint32_t runtime = 0, deadline = 0, period = 0, bw = 0;
+    if (attr->runtime != 0) {
+        if (attr->runtime > attr->deadline || attr->deadline > attr->period) {
+            return -1;
+        }
+        runtime = msecs_to_ticks(attr->runtime);
+        deadline = msecs_to_ticks(attr->deadline);
+        period = msecs_to_ticks(attr->period);
+        bw = (uint32_t)div_u64((uint64_t)runtime << DL_BW_SHIFT, period);
+    }
+
+    enum intr_status old_status = intr_disable();
+    spin_lock(&dl_bw_lock);
+    struct run_queue* rq = task_rq_lock(pthread);
+    struct cpu* c = pthread->cpu;
+    if (pick_cpu && bw != 0) {
+        c = dl_select_cpu(bw);
+    }
+    if (c == NULL || c->rq.dl_bw - pthread->dl_bw + bw > DL_BW_LIMIT) {
+        spin_unlock(&rq->lock);
+        spin_unlock(&dl_bw_lock);
+        intr_set_status(old_status);
+        return -1;
+    }
+    c->rq.dl_bw = c->rq.dl_bw - pthread->dl_bw + bw;
+
+    /* 按旧的调度类出队并结算已运行的时间, 改完参数再按新的调度类入队 */
+    bool queued = pthread->on_rq;
+    if (queued) {
+        dequeue_task(rq, pthread);
+    } else if (rq->curr == pthread) {
+        update_curr(pthread);
+    }
+    if (pthread->dl_throttled) {
+        del_timer(&pthread->dl_timer);
+        pthread->dl_throttled = false;
+        queued = true;
+    }
+    bool was_dl = (pthread->dl_runtime != 0);
+    pthread->dl_runtime = runtime;
+    pthread->dl_deadline = deadline;
+    pthread->dl_period = period;
+    pthread->dl_bw = bw;
+    if (runtime != 0) {
+        pthread->cpu = c;  // 只有还没入队的新任务会换 cpu
+        dl_new_period(pthread, ticks);
+    } else if (was_dl) {
+        pthread->vruntime = rq->min_vruntime;
+    }
+    if (queued) {
+        enqueue_task(rq, pthread);
+        if (runtime != 0) {
+            dl_check_preempt(c, pthread);
+        }
+    } else if (rq->curr == pthread) {
+        resched_cpu(c);  // 正在运行的按新的调度类重新调度
+    }
+    spin_unlock(&rq->lock);
+    spin_unlock(&dl_bw_lock);
+    intr_set_status(old_status);
+    return 0;
+}
+
+/* 修改任务 pthread 的实时调度参数, attr->runtime 为 0 时回到普通调度. 成功返回 0, 失败返回 -1 */
+int32_t thread_set_dl(struct task_struct* pthread, const struct sched_dl_attr* attr) {
+    return dl_setattr(pthread, attr, false);
+}
+
+/* fork 或 clone 出的子任务不继承实时调度参数, 总是从普通任务开始. 子任务此时还没入队 */
+void sched_dl_fork(struct task_struct* child) {
+    if (child->dl_runtime != 0) {
+        child->vruntime = 0;  // 父任务的 vruntime 在它成为实时任务后就不再更新了
+    }
+    child->dl_runtime = child->dl_deadline = child->dl_period = child->dl_bw = 0;
+    child->dl_budget = 0;
+    child->dl_throttled = false;
+    init_timer(&child->dl_timer, dl_timer_fn, child);
+}
+
+/* 任务退出时归还它占用的实时带宽 */
+static void dl_release(struct task_struct* pthread) {
+    if (pthread->dl_bw == 0) {
+        return;
+    }
+    enum intr_status old_status = spin_lock_irqsave(&dl_bw_lock);
+    pthread->cpu->rq.dl_bw -= pthread->dl_bw;
+    pthread->dl_bw = 0;
+    spin_unlock_irqrestore(&dl_bw_lock, old_status);
+    if (pthread->dl_throttled) {
+        del_timer(&pthread->dl_timer);
+    }
+}
+
+/* 以下几个函数记录调度统计, 时刻都取自 clock_monotonic_ns, 调用者持有任务所在队列的锁 */
+
+/* 任务 p 被换下 cpu: 时间片用完被放回就绪队列的算非自愿切换, 阻塞或让出 cpu 的算自愿切换 */
+static void sched_info_depart(struct task_struct* p, uint64_t now) {
+    if (p->status == TASK_RUNNING) {
+        p->stats.nr_involuntary++;
+        p->last_queued = now;
+    } else if (p->status == TASK_READY) {
+        /* 主动让出, 或在换下前就已被唤醒, 后者的入队时刻已由 thread_unblock 记下 */
+        p->stats.nr_voluntary++;
+        if (p->last_queued == 0) {
+            p->last_queued = now;
+        }
+    } else {
+        p->stats.nr_voluntary++;
+        p->block_start = now;
+    }
+}
+
+/* 任务 p 被选中上 cpu, 累计它在就绪队列中等待的时间 */
+static void sched_info_arrive(struct task_struct* p, uint64_t now) {
+    if (p->last_queued != 0 && now > p->last_queued) {
+        uint64_t delay = now - p->last_queued;
+        p->stats.run_delay += delay;
+        if (p->woken) {
+            p->stats.wakeup_latency += delay;
+            if (delay > p->stats.max_wakeup_latency) {
+                p->stats.max_wakeup_latency = delay;
+            }
+        }
+    }
+    p->last_queued = 0;
+    p->woken = false;
+    p->stats.nr_runs++;
+}
+
+/* 任务 p 被唤醒, 按阻塞原因累计它阻塞的时间 */
+static void sched_info_wakeup(struct task_struct* p, uint64_t now) {
+    if (p->block_start != 0 && now > p->block_start) {
+        uint64_t blocked = now - p->block_start;
+        switch (p->block_reason) {
+            case BLOCK_DISK:
+                p->stats.blocked_disk += blocked;
+                break;
+            case BLOCK_LOCK:
+                p->stats.blocked_lock += blocked;
+                break;
+            default:
+                p->stats.blocked_other += blocked;
+                break;
+        }
+    }
+    p->block_start = 0;
+    p->stats.nr_wakeups++;
+    p->woken = true;
+    p->last_queued = now;
+}
+
+/* 将新建的任务 pthread 加入负载最轻的 cpu 的就绪队列.
+   pthread->vruntime 是相对于 min_vruntime 的值, 入队时换算到目标队列上 */
+void sched_enqueue(struct task_struct* pthread) {
+    enum intr_status old_status = intr_disable();
+    /* 实时任务已在接纳时选好了 cpu */
+    bool is_dl = (pthread->dl_runtime != 0);
+    struct cpu* c = is_dl ? pthread->cpu : select_task_cpu();
+    struct run_queue* rq = &c->rq;
+    spin_lock(&rq->lock);
+    pthread->cpu = c;
+    pthread->on_cpu = false;
+    if (!is_dl) {
+        pthread->vruntime += rq->min_vruntime;
+    }
+    pthread->last_queued = clock_monotonic_ns();
+    enqueue_task(rq, pthread);
+    if (is_dl) {
+        dl_check_preempt(c, pthread);
+    } else if (rq->curr != NULL && rq->curr == c->idle) {
+        resched_cpu(c);
+    }
+    spin_unlock(&rq->lock);
+    intr_set_status(old_status);
+}
+
+/* 若 pthread 还在就绪队列中, 将其摘除 */
+void sched_dequeue(struct task_struct* pthread) {
+    enum intr_status old_status = intr_disable();
+    struct run_queue* rq = task_rq_lock(pthread);
+    if (pthread->on_rq) {
+        dequeue_task(rq, pthread);
+    }
+    spin_unlock(&rq->lock);
+    intr_set_status(old_status);
+}
+
+/* 本 cpu 没有就绪任务时, 从就绪任务最多的 cpu 上偷一个过来. 调用时持有本 cpu 的 rq->lock,
+   对方的锁只尝试获取, 两个 cpu 互相偷时不会死锁. 偷到返回 true */
+static bool idle_balance(struct cpu* this) {
+    struct cpu* busiest = NULL;
+    uint32_t max_running = 0;
+    uint8_t cpu_id;
+    for (cpu_id = 0; cpu_id < nr_cpus; cpu_id++) {
+        struct cpu* c = &cpus[cpu_id];
+        if (c != this && c->online && c->rq.nr_running > max_running) {
+            busiest = c;
+            max_running = c->rq.nr_running;
+        }
+    }
+    if (busiest == NULL || !spin_trylock(&busiest->rq.lock)) {
+        return false;
+    }
+
+    /* 从 vruntime 最小的开始找, 已被唤醒但还没从原 cpu 上换下的任务不能偷,
+       FPU 状态还留在原 cpu 上的任务也不能偷 */
+    struct task_struct* victim = NULL;
+    struct rb_node* node = busiest->rq.leftmost;
+    while (node != NULL) {
+        struct task_struct* pthread = rb_entry(struct task_struct, run_node, node);
+        if (!pthread->on_cpu && busiest->fpu_owner != pthread) {
+            victim = pthread;
+            break;
+        }
+        node = rb_next(node);
+    }
+    if (victim != NULL) {
+        dequeue_task(&busiest->rq, victim);
+        /* vruntime 保持相对于所在队列 min_vruntime 的领先量 */
+        victim->vruntime = victim->vruntime - busiest->rq.min_vruntime + this->rq.min_vruntime;
+        victim->cpu = this;
+        enqueue_task(&this->rq, victim);
+    }
+    spin_unlock(&busiest->rq.lock);
+    return victim != NULL;
+}
+
+/* 选出下一个上 cpu 的任务, 有就绪的实时任务时选截止期限最早的, 就绪队列为空时返回 NULL */
+static struct task_struct* pick_next_task(struct run_queue* rq) {
+    if (rq->dl_leftmost != NULL) {
+        return rb_entry(struct task_struct, run_node, rq->dl_leftmost);
+    }
+    struct rb_node* node = rq->leftmost;
+    if (node == NULL) {
+        return NULL;
+    }
+    struct task_struct* next = rb_entry(struct task_struct, run_node, node);
+    /* 刚让出 cpu 的任务即使 vruntime 最小, 也先让给次小的任务 */
+    if (next == rq->yield_skip && rb_next(node) != NULL) {
+        next = rb_entry(struct task_struct, run_node, rb_next(node));
+    }
+    rq->yield_skip = NULL;
+    return next;
+}
+
+/* 按 next 占就绪任务总权重的比例从调度周期中分出时间片 */
+static uint8_t sched_slice(struct run_queue* rq, struct task_struct* next) {
+    uint32_t load = rq->load_weight + next->weight;
+    uint32_t slice = SCHED_LATENCY_TICKS * next->weight / load;
+    return slice < SCHED_MIN_GRANULARITY ? SCHED_MIN_GRANULARITY : slice;
+}
+
 /* 由 kernel_thread 去执行 function(func_arg) */
 static void kernel_thread(thread_func* function, void* func_arg) {
+    schedule_tail();  // 新线程第一次上 cpu 时从这里开始, 替 schedule 收尾
     //执行 function 前要开中断，
     //避免后面的时钟中断被屏蔽，而无法调度其他线程
     intr_enable();
@@ -103,6 +734,9 @@ void thread_create(struct task_struct* pthread, thread_func function, void* func
 /* 初始化线程基本信息 */
 void init_thread(struct task_struct* pthread, char* name, int prio) {
     memset(pthread, 0, sizeof(*pthread));
+    list_init(&pthread->held_locks);  // 下面 allocate_pid 就要用锁
+    list_init(&pthread->children);
+    list_init(&pthread->threads);
     pthread->pid = allocate_pid();
     strcpy(pthread->name, name);
 
@@ -117,11 +751,27 @@ void init_thread(struct task_struct* pthread, char* name, int prio) {
     // self_kstack 是线程自己在内核态下使用的栈顶地址 
     pthread->self_kstack = (uint32_t*)((uint32_t)pthread + PG_SIZE);
     pthread->priority = prio;
+    pthread->normal_prio = prio;
     pthread->ticks = prio;
     pthread->elapsed_ticks = 0;
+    pthread->weight = prio_to_weight(prio);
+    pthread->vruntime = 0;  // 相对值, 入队时加上队列的 min_vruntime, 新任务从最小 vruntime 起步, 不会饿死已有任务
+    pthread->exec_start = 0;
+    pthread->on_rq = false;
+    pthread->cpu = &cpus[0];
+    pthread->on_cpu = false;
+    init_timer(&pthread->dl_timer, dl_timer_fn, pthread);
     pthread->pgdir = NULL;
     pthread->cwd_inode_nr = 0;          // 以根目录作为默认工作路径
     pthread->parent_pid = -1;            // -1表示没有父进程
+    pthread->group_leader = pthread;
+    pthread->nr_threads = 1;
+    pthread->ustack = NULL;
+    pthread->uring = NULL;
+    pthread->vdso = NULL;
+    pthread->sc_stats = NULL;
+    pthread->sc_child_stats = NULL;
+    pthread->joiner = NULL;
     pthread->stack_magic = 0x19870916;  // 自定义的魔数, 防止入栈擦写了低处的PCB数据
 
     // 预留标准输入输出
@@ -139,20 +789,16 @@ void init_thread(struct task_struct* pthread, char* name, int prio) {
 /* 创建一优先级为 prio 的线程，线程名为 name, 线程所执行的函数是 function(func_arg) */
 struct task_struct* thread_start(char* name, int prio, thread_func function, void* func_arg) {
     // pcb 都位于内核空间，包括用户进程的 pcb 也是在内核空间
-    struct task_struct* thread = get_kernel_pages(1);
+    struct task_struct* thread = alloc_task_struct();
 
     init_thread(thread, name, prio);
     thread_create(thread, function, func_arg);
 
-    // 确保之前不在队列中
-    ASSERT(!elem_find(&thread_ready_list, &thread->general_tag));
-    // 加入就绪线程队列
-    list_append(&thread_ready_list, &thread->general_tag);
-
-    // 确保之前不在队列中
-    ASSERT(!elem_find(&thread_all_list, &thread->all_list_tag));
     // 加入全部线程队列
-    list_append(&thread_all_list, &thread->all_list_tag);
+    thread_link(thread);
+
+    // 加入就绪队列
+    sched_enqueue(thread);
 
     /* ret 会把栈顶的数据作为返回地址送上处理器的EIP寄存器，此时栈顶为eip指向的kernel_thread
        在执行ret后，处理器会去执行kernel_thread 函数，栈顶依次是占位的返回地址、参数1、2
@@ -163,6 +809,27 @@ struct task_struct* thread_start(char* name, int prio, thread_func function, voi
     return thread;
 }
 
+/* 创建实时内核线程, 调度参数见 struct sched_dl_attr. 参数非法或通不过接纳控制时返回 NULL */
+struct task_struct* thread_start_dl(char* name, const struct sched_dl_attr* attr, thread_func function, void* func_arg) {
+    if (attr->runtime == 0) {
+        return NULL;
+    }
+    struct task_struct* thread = alloc_task_struct();
+    if (thread == NULL) {
+        return NULL;
+    }
+    init_thread(thread, name, NICE_0_PRIO);
+    if (dl_setattr(thread, attr, true) != 0) {
+        release_pid(thread->pid);
+        free_task_struct(thread);
+        return NULL;
+    }
+    thread_create(thread, function, func_arg);
+    thread_link(thread);
+    sched_enqueue(thread);
+    return thread;
+}
+
 /* 将 kernel 中的 main 函数完善为主线程 */
 static void make_main_thread(void) {
     /* 
@@ -171,49 +838,136 @@ static void make_main_thread(void) {
     */
     main_thread = running_thread();
     init_thread(main_thread, "main", 31);
+    main_thread->on_cpu = true;
+    cpus[0].rq.curr = main_thread;
 
-    /* main 函数是当前线程，当前线程不在 thread_ready_list 中，
+    /* main 函数是当前线程，当前线程不在就绪队列中，
     所以只将其加在 thread_all_list 中 */
-    ASSERT(!elem_find(&thread_all_list, &main_thread->all_list_tag));
-    list_append(&thread_all_list, &main_thread->all_list_tag);
+    thread_link(main_thread);
 }
 
-/* 实现任务调度 */
+/* 实现任务调度, 调用前需关中断. 被换下的任务可能已由其他 cpu 唤醒并放回了就绪队列 */
 void schedule() {
     ASSERT(intr_get_status() == INTR_OFF);
 
+    struct cpu* c = this_cpu();
+    struct run_queue* rq = &c->rq;
     struct task_struct* cur = running_thread();
+    spin_lock(&rq->lock);
+    update_curr(cur);
+    uint64_t now = clock_monotonic_ns();
+    if (cur != c->idle) {
+        sched_info_depart(cur, now);
+    }
     if (cur->status == TASK_RUNNING) {
-        // 若此线程只是 cpu 时间片到了，将其加入到就绪队列尾
-        ASSERT(!elem_find(&thread_ready_list, &cur->general_tag));
-        list_append(&thread_ready_list, &cur->general_tag);
-        // 重新将当前线程的 ticks 重置为其 priority
-        cur->ticks = cur->priority;
-        cur->status = TASK_READY;
+        if (cur == c->idle) {
+            // idle 不参与公平调度, 只在就绪队列为空时才被选中
+            cur->status = TASK_BLOCKED;
+        } else if (cur->dl_runtime != 0 && cur->dl_budget <= 0) {
+            // 实时任务的预算用完了, 等下个周期再运行
+            dl_throttle(cur);
+        } else {
+            // 若此线程只是 cpu 时间片到了，将其按 vruntime 放回就绪队列
+            enqueue_task(rq, cur);
+            cur->status = TASK_READY;
+        }
     } else {
         // 若此线程需要某事件发生后才能继续上 cpu 运行，
         // 不需要将其加入队列，因为当前线程不在就绪队列中
     }
+    update_min_vruntime(c);
 
-    /* 如果就绪队列中没有可运行的任务,就唤醒idle */
-    if (list_empty(&thread_ready_list)) {
-        thread_unblock(idle_thread);
+    /* 先选截止期限最早的实时任务, 再选 vruntime 最小的任务, 本 cpu 无事可做时先去别的 cpu 偷, 还没有就运行idle */
+    if (rq->nr_running == 0) {
+        idle_balance(c);
+    }
+    struct task_struct* next = pick_next_task(rq);
+    if (next != NULL) {
+        dequeue_task(rq, next);
+        /* 实时任务一直运行到预算用完或被抢占, ticks 只用作重新调度的标记 */
+        next->ticks = next->dl_runtime != 0 ? 1 : sched_slice(rq, next);
+    } else {
+        next = c->idle;
+        next->ticks = SCHED_MIN_GRANULARITY;
+    }
+    if (next != c->idle) {
+        sched_info_arrive(next, now);
     }
-
-    ASSERT(!list_empty(&thread_ready_list));
-    thread_tag = NULL;
-    // 将 thread_ready_list 队列中的第一个就绪线程弹出，准备将其调度上 cpu 
-    thread_tag = list_pop(&thread_ready_list);
-    struct task_struct* next = elem2entry(struct task_struct, general_tag, thread_tag);
     next->status = TASK_RUNNING;
+    next->exec_start = next->elapsed_ticks;
+    rq->curr = next;
+
+    if (next == cur) {
+        spin_unlock(&rq->lock);  // 被唤醒得早, 还没换下就又被选中了
+        return;
+    }
+    next->on_cpu = true;
+    c->prev = cur;
 
+    fpu_switch(c, cur, next);
     process_activate(next);  // 激活任务页表等
 
     // 将线程 cur 的上下文保护好，再将线程 next 的上下文装载到处理器
     switch_to(cur, next);
+    schedule_tail();
+}
+
+/* 任务切换完成后在新任务的栈上调用: 此时被换下的任务已不再使用它的栈,
+   清除其 on_cpu 标记, 其他 cpu 才可以偷走或回收它, 最后释放 schedule 中加的锁 */
+void schedule_tail(void) {
+    struct cpu* c = this_cpu();
+    c->prev->on_cpu = false;
+    spin_unlock(&c->rq.lock);
+}
+
+/* 时钟中断中调用: 给当前任务记账, 其时间片用完就调度 */
+void sched_tick(uint32_t nr_ticks) {
+    struct task_struct* cur_thread = running_thread();
+    ASSERT(cur_thread->stack_magic == 0x19870916);  // 检查栈是否溢出
+
+    cur_thread->elapsed_ticks += nr_ticks;  // 记录此线程占用的 cpu 时间
+    if (cur_thread->dl_runtime != 0) {
+        /* 实时任务不按时间片轮转, 预算用完或被抢占时才调度 */
+        if ((int32_t)(cur_thread->elapsed_ticks - cur_thread->exec_start) >= cur_thread->dl_budget) {
+            cur_thread->ticks = 0;
+        }
+        if (cur_thread->ticks == 0) {
+            schedule();
+        }
+        return;
+    }
+    if (cur_thread->ticks == 0) {
+        schedule();  // 若进程时间片用完，就开始调度新的进程上 cpu
+    } else {
+        cur_thread->ticks--;  // 将当前进程的时间片-1, 之后当前线程 cur_thread 继续执行
+    }
+}
+
+/* 修改任务 pthread 的优先级, 它的权重随之改变. 用于锁的优先级继承 */
+void thread_set_priority(struct task_struct* pthread, uint8_t prio) {
+    enum intr_status old_status = intr_disable();
+    struct run_queue* rq = task_rq_lock(pthread);
+    if (pthread->priority != prio) {
+        /* 就绪的任务按新权重重新入队, 正在运行的先按旧权重结算已运行的时间 */
+        bool queued = pthread->on_rq;
+        if (queued) {
+            dequeue_task(rq, pthread);
+        } else if (rq->curr == pthread) {
+            update_curr(pthread);
+        }
+        pthread->priority = prio;
+        pthread->weight = prio_to_weight(prio);
+        if (queued) {
+            enqueue_task(rq, pthread);
+        }
+    }
+    spin_unlock(&rq->lock);
+    intr_set_status(old_status);
 }
 
-/* 当前线程将自己阻塞，标志其状态为 stat */
+/* 当前线程将自己阻塞，标志其状态为 stat.
+   若在阻塞前需要把自己登记到等待队列中, 须在登记前设置状态并直接调用 schedule,
+   否则其他 cpu 上的唤醒者可能在状态设置之前就来唤醒 */
 void thread_block(enum task_status stat) {
     // stat 取值为 TASK_BLOCKED、TASK_WAITING、TASK_HANGING 这三种状态时才不会被调度 */
     ASSERT(((stat == TASK_BLOCKED) || (stat == TASK_WAITING) || (stat == TASK_HANGING)));
@@ -227,37 +981,103 @@ void thread_block(enum task_status stat) {
 /* 将线程 pthread 解除阻塞 */
 // 参数 pthread 指向的是目前已经被阻塞，又希望被唤醒的线程 
 // 函数 thread_unblock 是由当前运行的线程调用的，由它实施唤醒动作
+// pthread 放回它上次运行的 cpu 的就绪队列, 那里的缓存中可能还留有它的数据
 void thread_unblock(struct task_struct* pthread) {
     enum intr_status old_status = intr_disable();
+    struct run_queue* rq = task_rq_lock(pthread);
     ASSERT(((pthread->status == TASK_BLOCKED) || (pthread->status == TASK_WAITING) || (pthread->status == TASK_HANGING)));
     if (pthread->status != TASK_READY) {
-        ASSERT(!elem_find(&thread_ready_list, &pthread->general_tag));
-        if (elem_find(&thread_ready_list, &pthread->general_tag)) {
-            PANIC("thread_unblock: blocked thread in ready_list\n");
+        if (pthread->on_rq) {
+            PANIC("thread_unblock: blocked thread in ready_queue\n");
+        }
+        sched_info_wakeup(pthread, clock_monotonic_ns());
+        if (pthread->dl_runtime != 0) {
+            dl_wakeup(rq, pthread);
+        } else {
+            /* 睡眠期间 vruntime 没有增长, 为了不让它长时间独占 cpu,
+               最多只给它半个调度周期的补偿, 这样交互任务醒来后能尽快运行 */
+            uint32_t floor = rq->min_vruntime - SCHED_WAKEUP_CREDIT;
+            if (vruntime_before(pthread->vruntime, floor)) {
+                pthread->vruntime = floor;
+            }
+            enqueue_task(rq, pthread);
+            pthread->status = TASK_READY;
+
+            /* 被唤醒者的 vruntime 明显小于那个 cpu 上的当前任务时, 让当前任务尽快让出 cpu;
+               否则找个空闲的 cpu 来把它偷走. 普通任务不抢占实时任务 */
+            struct cpu* c = pthread->cpu;
+            struct task_struct* curr = rq->curr;
+            if (curr != pthread) {
+                update_curr(curr);
+                if (curr == c->idle || (curr->dl_runtime == 0 && \
+                    vruntime_before(pthread->vruntime + SCHED_WAKEUP_GRAN, curr->vruntime))) {
+                    resched_cpu(c);
+                } else {
+                    kick_idle_cpu(c);
+                }
+            }
         }
-        // 放到队列的最前面，使其尽快得到调度
-        list_push(&thread_ready_list, &pthread->general_tag);
-        pthread->status = TASK_READY;
     }
+    spin_unlock(&rq->lock);
     intr_set_status(old_status);
 }
 
-/* 系统空闲时运行的线程 */
-static void idle(void* arg UNUSED) {
+/* cpu 空闲时运行的循环, 每个 cpu 的 idle 线程都执行它 */
+void cpu_idle(void) {
     while (1) {
         thread_block(TASK_BLOCKED);
+        intr_disable();
+        /* 从被选中到此处之间可能已有任务被唤醒, 那就不必 hlt 了.
+           之后再被唤醒的任务会通过处理器间中断把 cpu 从 hlt 中叫醒 */
+        if (this_cpu()->rq.nr_running != 0) {
+            intr_enable();
+            continue;
+        }
+        // 没有可运行的任务, 停掉周期时钟中断, 直到下一个定时器到期或有其他中断
+        tick_nohz_idle_enter();
         // 执行 hlt 时必须要保证目前处在开中断的情况下
+        // sti 要到下一条指令后才生效, 所以中断不会插在 sti 和 hlt 之间
         asm volatile ("sti; hlt":::"memory");
+        tick_nohz_idle_exit();
     }
 }
 
+/* 系统空闲时运行的线程 */
+static void idle(void* arg UNUSED) {
+    cpu_idle();
+}
+
+/* 为 cpu c 创建 idle 线程, 它不进就绪队列, 只在就绪队列为空时运行.
+   BSP 的 idle 线程由 schedule 第一次换上 cpu, AP 则一启动就在它的栈上运行 */
+struct task_struct* idle_thread_create(struct cpu* c) {
+    struct task_struct* thread = alloc_task_struct();
+    init_thread(thread, "idle", 10);
+    thread_create(thread, idle, NULL);
+    thread->status = TASK_BLOCKED;
+    thread->cpu = c;
+    c->idle = thread;
+
+    thread_link(thread);
+    return thread;
+}
+
 /* 主动让出 cpu ，换其他线程运行 */ 
 void thread_yield(void) {
     struct task_struct* cur = running_thread();
     enum intr_status old_status = intr_disable();
-    ASSERT(!elem_find(&thread_ready_list, &cur->general_tag));
-    list_append(&thread_ready_list, &cur->general_tag);
-    cur->status = TASK_READY;
+    struct run_queue* rq = &this_cpu()->rq;
+    spin_lock(&rq->lock);
+    update_curr(cur);
+    if (cur->dl_runtime != 0) {
+        /* 实时任务让出 cpu 即放弃本周期剩余的预算, 下个周期再运行, 周期性任务以此等待下个周期 */
+        cur->dl_budget = 0;
+        dl_throttle(cur);
+    } else {
+        enqueue_task(rq, cur);
+        cur->status = TASK_READY;
+        rq->yield_skip = cur;
+    }
+    spin_unlock(&rq->lock);
     schedule();
     intr_set_status(old_status);
 }
@@ -272,8 +1092,13 @@ static void pad_print(char* buf, int32_t buf_len, void* ptr, char format) {
             break;
         case 'd':
             out_pad_0idx = sprintf(buf, "%d", *((int16_t*)ptr));
+            break;
+        case 'u':
+            out_pad_0idx = sprintf(buf, "%d", *((uint32_t*)ptr));
+            break;
         case 'x':
             out_pad_0idx = sprintf(buf, "%x", *((uint32_t*)ptr));
+            break;
     }
     while(out_pad_0idx < buf_len) { // 以空格填充
         buf[out_pad_0idx] = ' ';
@@ -282,39 +1107,54 @@ static void pad_print(char* buf, int32_t buf_len, void* ptr, char format) {
     sys_write(stdout_no, buf, buf_len - 1);
 }
 
+/* 纳秒换算成毫秒 */
+static uint32_t ns2ms(uint64_t ns) {
+    return (uint32_t)div_u64(ns, 1000000);
+}
+
 /* 用于在list_traversal函数中的回调函数,用于针对线程队列的处理 */
 static bool elem2thread_info(struct list_elem* pelem, int arg UNUSED) {
     struct task_struct* pthread = elem2entry(struct task_struct, all_list_tag, pelem);
     char out_pad[16] = {0};
 
-    pad_print(out_pad, 16, &pthread->pid, 'd');
+    pad_print(out_pad, 6, &pthread->pid, 'd');
 
     if (pthread->parent_pid == -1) {
-        pad_print(out_pad, 16, "NULL", 's');
+        pad_print(out_pad, 6, "NULL", 's');
     } else { 
-        pad_print(out_pad, 16, &pthread->parent_pid, 'd');
+        pad_print(out_pad, 6, &pthread->parent_pid, 'd');
     }
 
     switch (pthread->status) {
         case 0:
-            pad_print(out_pad, 16, "RUNNING", 's');
+            pad_print(out_pad, 9, "RUNNING", 's');
             break;
         case 1:
-            pad_print(out_pad, 16, "READY", 's');
+            pad_print(out_pad, 9, "READY", 's');
             break;
         case 2:
-            pad_print(out_pad, 16, "BLOCKED", 's');
+            pad_print(out_pad, 9, "BLOCKED", 's');
             break;
         case 3:
-            pad_print(out_pad, 16, "WAITING", 's');
+            pad_print(out_pad, 9, "WAITING", 's');
             break;
         case 4:
-            pad_print(out_pad, 16, "HANGING", 's');
+            pad_print(out_pad, 9, "HANGING", 's');
             break;
         case 5:
-            pad_print(out_pad, 16, "DIED", 's');
+            pad_print(out_pad, 9, "DIED", 's');
     }
-    pad_print(out_pad, 16, &pthread->elapsed_ticks, 'x');
+    pad_print(out_pad, 9, &pthread->elapsed_ticks, 'x');
+
+    /* 就绪等待、等硬盘和等锁的时间以毫秒为单位, 随后是自愿和非自愿切换次数 */
+    uint32_t ms = ns2ms(pthread->stats.run_delay);
+    pad_print(out_pad, 9, &ms, 'u');
+    ms = ns2ms(pthread->stats.blocked_disk);
+    pad_print(out_pad, 9, &ms, 'u');
+    ms = ns2ms(pthread->stats.blocked_lock);
+    pad_print(out_pad, 9, &ms, 'u');
+    pad_print(out_pad, 8, &pthread->stats.nr_voluntary, 'u');
+    pad_print(out_pad, 8, &pthread->stats.nr_involuntary, 'u');
 
     memset(out_pad, 0, 16);
     ASSERT(strlen(pthread->name) < 17);
@@ -324,37 +1164,121 @@ static bool elem2thread_info(struct list_elem* pelem, int arg UNUSED) {
     return false;	// 此处返回false是为了迎合主调函数list_traversal,只有回调函数返回false时才会继续调用此函数
 }
 
-/* 打印任务列表 */
+/* 打印任务列表, DELAY、DISK 和 LOCK 三列的单位为毫秒 */
 void sys_ps(void) {
-   char* ps_title = "PID            PPID           STAT           TICKS          COMMAND\n";
+   char* ps_title = "PID  PPID STAT    TICKS   DELAY   DISK    LOCK    VCSW   ICSW   COMMAND\n";
    sys_write(stdout_no, ps_title, strlen(ps_title));
+   lock_acquire(&thread_all_lock);
    list_traversal(&thread_all_list, elem2thread_info, 0);
+   lock_release(&thread_all_lock);
+}
+
+/* 根据pid找pcb,若找到则返回该pcb,否则返回NULL */
+struct task_struct* pid2thread(int32_t pid) {
+    if (pid <= 0 || pid > MAX_PID) {
+        return NULL;
+    }
+    lock_acquire(&thread_all_lock);
+    struct task_struct* thread = pid_table[pid];
+    lock_release(&thread_all_lock);
+    return thread;
+}
+
+/* 把新任务加入 thread_all_list 和 pid 表. 是线程的挂到所属进程的 threads 上,
+   有父进程的挂到父进程的 children 上, 父进程此时一定还在 pid 表中 */
+void thread_link(struct task_struct* pthread) {
+    lock_acquire(&thread_all_lock);
+    ASSERT(pid_table[pthread->pid] == NULL);
+    pid_table[pthread->pid] = pthread;
+    list_append(&thread_all_list, &pthread->all_list_tag);
+    if (pthread->group_leader != pthread) {
+        list_append(&pthread->group_leader->threads, &pthread->thread_tag);
+    }
+    if (pthread->parent_pid != -1) {
+        struct task_struct* parent = pid_table[pthread->parent_pid];
+        ASSERT(parent != NULL);
+        list_append(&parent->children, &pthread->sibling_tag);
+    }
+    lock_release(&thread_all_lock);
+}
+
+/* thread_link 的逆过程, 在回收任务时调用 */
+static void thread_unlink(struct task_struct* pthread) {
+    lock_acquire(&thread_all_lock);
+    ASSERT(pid_table[pthread->pid] == pthread);
+    pid_table[pthread->pid] = NULL;
+    list_remove(&pthread->all_list_tag);
+    if (pthread->group_leader != pthread) {
+        list_remove(&pthread->thread_tag);
+    }
+    if (pthread->parent_pid != -1) {
+        list_remove(&pthread->sibling_tag);
+    }
+    lock_release(&thread_all_lock);
+}
+
+/* 把 pid 对应任务的调度统计复制到 buf, 成功返回 0, 找不到该任务返回 -1 */
+int32_t sys_schedstat(pid_t pid, struct schedstat* buf) {
+    int32_t ret = -1;
+    lock_acquire(&thread_all_lock);  // 持锁期间任务不会被回收
+    struct task_struct* pthread = pid2thread(pid);
+    if (pthread != NULL) {
+        memcpy(buf, &pthread->stats, sizeof(struct schedstat));
+        ret = 0;
+    }
+    lock_release(&thread_all_lock);
+    return ret;
+}
+
+/* 修改任务 pid 的实时调度参数, pid 为 0 时指当前任务. 成功返回 0, 失败返回 -1 */
+int32_t sys_sched_setdl(pid_t pid, const struct sched_dl_attr* attr) {
+    if (attr == NULL) {
+        return -1;
+    }
+    struct sched_dl_attr kattr = *attr;
+    int32_t ret = -1;
+    lock_acquire(&thread_all_lock);  // 持锁期间任务不会被回收
+    struct task_struct* pthread = (pid == 0) ? running_thread() : pid2thread(pid);
+    if (pthread != NULL && pthread != pthread->cpu->idle) {
+        ret = thread_set_dl(pthread, &kattr);
+    }
+    lock_release(&thread_all_lock);
+    return ret;
 }
 
 /* 回收thread_over的pcb和页表,并将其从调度队列中去除 */
 void thread_exit(struct task_struct* thread_over, bool need_schedule) {
+    /* thread_over 可能刚在其他 cpu 上把自己挂起, 要等它彻底换下 cpu, 不再用自己的栈后才能回收 */
+    while (thread_over != running_thread() && thread_over->on_cpu) {
+        cpu_relax();
+    }
+
+    /* 从all_thread_list、pid 表和父进程的子进程链表中去掉此任务 */
+    thread_unlink(thread_over);
+
     /* 要保证schedule在关中断情况下调用 */
     intr_disable();
     thread_over->status = TASK_DIED;
 
     /* 如果thread_over不是当前线程,就有可能还在就绪队列中,将其从中删除 */
-    if (elem_find(&thread_ready_list, &thread_over->general_tag)) {
-        list_remove(&thread_over->general_tag);
-    }
-    if (thread_over->pgdir) {     // 如是进程,回收进程的页表
+    sched_dequeue(thread_over);
+    dl_release(thread_over);
+    if (thread_over->pgdir && thread_over->group_leader == thread_over) {  // 如是进程,回收进程的页表, 其他线程只是借用
         mfree_page(PF_KERNEL, thread_over->pgdir, 1);
     }
 
-    /* 从all_thread_list中去掉此任务 */
-    list_remove(&thread_over->all_list_tag);
-    
+    fpu_free(thread_over);
+
+    /* pcb 页回收后可能立即被其他 cpu 分配出去, 先取出 pid */
+    pid_t pid = thread_over->pid;
+
     /* 回收pcb所在的页,主线程的pcb不在堆中,跨过 */
     if (thread_over != main_thread) {
-        mfree_page(PF_KERNEL, thread_over, 1);
+        free_task_struct(thread_over);
     }
 
     /* 归还pid */
-    release_pid(thread_over->pid);
+    release_pid(pid);
 
     /* 如果需要下一轮调度则主动调用schedule */
     if (need_schedule) {
@@ -363,30 +1287,28 @@ void thread_exit(struct task_struct* thread_over, bool need_schedule) {
     }
 }
 
-/* 比对任务的pid */
-static bool pid_check(struct list_elem* pelem, int32_t pid) {
-    struct task_struct* pthread = elem2entry(struct task_struct, all_list_tag, pelem);
-    if (pthread->pid == pid) {
-        return true;
-    }
-    return false;
-}
-
-/* 根据pid找pcb,若找到则返回该pcb,否则返回NULL */
-struct task_struct* pid2thread(int32_t pid) {
-    struct list_elem* pelem = list_traversal(&thread_all_list, pid_check, pid);
-    if (pelem == NULL) {
-        return NULL;
-    }
-    struct task_struct* thread = elem2entry(struct task_struct, all_list_tag, pelem);
-    return thread;
-}
-
 /* 初始化线程环境 */
 void thread_init(void) {
     put_str("thread_init start\n");
-    list_init(&thread_ready_list);
+    uint8_t cpu_id;
+    for (cpu_id = 0; cpu_id < NR_CPUS; cpu_id++) {
+        struct cpu* c = &cpus[cpu_id];
+        struct run_queue* rq = &c->rq;
+        c->id = cpu_id;
+        c->online = (cpu_id == 0);  // 其他 cpu 到 smp_init 时才启动
+        spin_lock_init(&rq->lock);
+        rb_root_init(&rq->tasks_timeline);
+        rq->leftmost = NULL;
+        rq->nr_running = rq->load_weight = rq->min_vruntime = 0;
+        rq->curr = rq->yield_skip = NULL;
+        rb_root_init(&rq->dl_timeline);
+        rq->dl_leftmost = NULL;
+        rq->dl_nr_running = rq->dl_bw = 0;
+    }
+    spin_lock_init(&dl_bw_lock);
+    spin_lock_init(&task_cache.lock);
     list_init(&thread_all_list);
+    lock_init(&thread_all_lock);
     pid_pool_init();
     //lock_init(&pid_lock);
 
@@ -395,7 +1317,7 @@ void thread_init(void) {
 
     make_main_thread();  // 将当前 main 函数创建为线程
     
-    idle_thread = thread_start("idle", 10, idle, NULL);  // 创建 idle 线程
+    idle_thread_create(&cpus[0]);  // 创建 BSP 的 idle 线程
 
     put_str("thread_init done\n");
 }
\ No newline at end of file
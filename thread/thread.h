@@ -5,16 +5,41 @@
 #include "kernel/list.h"
 #include "memory.h"
 #include "kernel/bitmap.h"
+#include "kernel/rbtree.h"
+#include "spinlock.h"
+#include "timer.h"
 
 #define TASK_NAME_LEN 16
 
 #define MAX_FILES_OPEN_PER_PROC 8
+#define MAX_PID 1024            // pid 的取值范围为 1 ~ MAX_PID
 
 /* 用来指定在线程中运行的函数类型 */
 typedef void thread_func(void*);
 
 typedef int16_t pid_t;
 
+struct cpu;
+struct lock;
+struct uring_ctx;
+struct vdso_proc;
+struct syscall_stat;
+
+/* 完全公平调度(CFS)的参数, 时间单位均为时钟嘀嗒 */
+#define NICE_0_PRIO 31             // 默认优先级, 此优先级的任务权重为 NICE_0_LOAD
+#define NICE_0_LOAD 1024           // 默认优先级任务的权重
+#define SCHED_LATENCY_TICKS (HZ / 5)            // 调度周期 200ms, 就绪任务在此周期内按权重瓜分 cpu
+#define SCHED_MIN_GRANULARITY ((HZ + 49) / 50)  // 每次上 cpu 至少运行 20ms
+/* 唤醒的任务最多获得半个调度周期的 vruntime 补偿, 使交互任务被唤醒后能尽快运行 */
+#define SCHED_WAKEUP_CREDIT (SCHED_LATENCY_TICKS * NICE_0_LOAD / 2)
+/* 被唤醒任务的 vruntime 比当前任务小这么多时抢占当前任务 */
+#define SCHED_WAKEUP_GRAN NICE_0_LOAD
+
+/* 实时(EDF)调度的带宽以 1 << DL_BW_SHIFT 为 100%, 每个 cpu 上实时任务的带宽之和不超过 DL_BW_LIMIT,
+   留出的 5% 使普通任务不会完全饿死 */
+#define DL_BW_SHIFT 20
+#define DL_BW_LIMIT ((1 << DL_BW_SHIFT) / 100 * 95)
+
 /* 进程或线程的状态, 区别在于是否拥有页表 */
 enum task_status {
     TASK_RUNNING,
@@ -25,6 +50,35 @@ enum task_status {
     TASK_DIED
 };
 
+/* 任务阻塞的原因, 用于把阻塞时间分类统计 */
+enum block_reason {
+    BLOCK_OTHER,  // 睡眠、wait、键盘和管道等
+    BLOCK_DISK,   // 等待硬盘完成读写
+    BLOCK_LOCK    // 等待其他任务释放锁
+};
+
+/* 调度统计, 时间单位均为纳秒, 由 schedstat 系统调用原样交给用户 */
+struct schedstat {
+    uint64_t run_delay;           // 在就绪队列中等待上 cpu 的总时间
+    uint64_t wakeup_latency;      // 其中从被唤醒到上 cpu 的时间
+    uint64_t max_wakeup_latency;  // 最长的一次唤醒延迟
+    uint64_t blocked_disk;        // 阻塞等待硬盘的总时间
+    uint64_t blocked_lock;        // 阻塞等待锁的总时间
+    uint64_t blocked_other;       // 其他阻塞的总时间
+    uint32_t nr_runs;             // 上 cpu 的次数
+    uint32_t nr_voluntary;        // 阻塞或让出 cpu 的次数
+    uint32_t nr_involuntary;      // 时间片用完或被抢占的次数
+    uint32_t nr_wakeups;          // 被唤醒的次数
+};
+
+/* 实时任务的参数, 单位为毫秒, 由 sched_setdl 系统调用传入.
+   任务每 period 内最多运行 runtime, 且要在周期开始后的 deadline 内运行完. runtime 为 0 表示回到普通调度 */
+struct sched_dl_attr {
+    uint32_t runtime;
+    uint32_t deadline;
+    uint32_t period;
+};
+
 /* 中断栈 intr_stack 
     此结构用于中断发生时保护程序（线程或进程）的上下文环境：
     进程或线程被外部中断或软中断打断时，会按照此结构压入上下文
@@ -83,14 +137,52 @@ struct task_struct {
     pid_t pid;
     enum task_status status;
     char name[TASK_NAME_LEN];
-    uint8_t priority;          // 线程优先级
+    uint8_t priority;          // 线程优先级, 持有的锁有更高优先级的任务在等待时被临时提高
+    uint8_t normal_prio;       // 线程自身的优先级, 不受优先级继承影响
     uint8_t ticks;             // 每次在处理器上执行的时间嘀嗒数
     // 每次时钟中断都会将当前任务的 ticks 减 1 ，当减到 0 时就被换下处理器。
 
     uint32_t elapsed_ticks;    // 此任务自上 cpu 运行后至今占用了多少 cpu 嘀嗒数
+
+    uint32_t weight;           // 由 priority 换算的调度权重
+    uint32_t vruntime;         // 按权重折算后的虚拟运行时间, 就绪队列按此排序
+    uint32_t exec_start;       // 上次结算 vruntime 时的 elapsed_ticks
+    bool on_rq;                // 是否在就绪队列中
+    struct rb_node run_node;   // 用于就绪队列红黑树中的结点
+    struct cpu* cpu;           // 正在或最近一次运行此任务的 cpu, 就绪时为其所在就绪队列的 cpu
+    bool on_cpu;               // 是否还在 cpu 上, 从 switch_to 中换下后才清除
+
+    struct schedstat stats;    // 调度统计, 在 schedule、thread_unblock 中用高精度时钟记录
+    uint64_t last_queued;      // 进入就绪队列的时刻, 不在队列中等待时为 0
+    uint64_t block_start;      // 开始阻塞的时刻, 未阻塞时为 0
+    uint8_t block_reason;      // 本次阻塞的原因, 取值见 enum block_reason, 由阻塞前的调用者设置
+    bool woken;                // 本次进入就绪队列是因为被唤醒
+
+    void* fpu_state;           // FXSAVE 区域, 第一次使用 FPU 时才分配, 见 fpu.h
+
+    /* 实时调度, dl_runtime 为 0 的是普通任务. 时间单位为嘀嗒 */
+    uint32_t dl_runtime;       // 每个周期的运行预算
+    uint32_t dl_deadline;      // 从周期开始算起的相对截止期限
+    uint32_t dl_period;        // 周期
+    uint32_t dl_bw;            // 占用的带宽 dl_runtime / dl_period, 已计入所在 cpu 的 rq->dl_bw
+    int32_t dl_budget;         // 本周期剩余的预算, 超支时为负, 下个周期补充时扣除
+    uint32_t dl_abs_deadline;  // 当前周期的绝对截止期限, 实时就绪队列按它排序
+    uint32_t dl_next_period;   // 下个周期开始的时刻, 被节流的任务在此时补充预算
+    bool dl_throttled;         // 预算耗尽, 不在就绪队列中, 等 dl_timer 补充预算
+    struct timer_list dl_timer;
+
+    struct list held_locks;    // 持有的锁, 释放锁时据此重新计算继承来的优先级
+    struct lock* blocked_on;   // 正在等待的锁, 优先级沿着它传递给持有者
+
+    /* 系统调用统计, 各有 NR_SYSCALLS 项, 未打开统计时为 NULL, 见 scstat.h */
+    struct syscall_stat* sc_stats;        // 自己的
+    struct syscall_stat* sc_child_stats;  // 已退出的子进程和线程累计的
+
     int32_t fd_table[MAX_FILES_OPEN_PER_PROC];  // 文件描述符数组
     struct list_elem general_tag;   // 用于线程在一般的队列中的结点
     struct list_elem all_list_tag;  // 用于线程队列 thread_all_list 中的结点
+    struct list_elem sibling_tag;   // 用于父进程 children 链表中的结点
+    struct list_elem thread_tag;    // 用于所属进程主线程 threads 链表中的结点
 
     uint32_t* pgdir;                     // 进程自己页表的虚拟地址（往寄存器 cr3 中加载页目录地址时，会将pgdir转换成物理地址）
     struct virtual_addr userprog_vaddr;  // 用户进程的虚拟地址池
@@ -98,22 +190,70 @@ struct task_struct {
     uint32_t cwd_inode_nr;               // 进程所在的工作目录的 inode 编号
     int16_t parent_pid;                  // 父进程id
     int8_t exit_status;                  // 进程结束时自己调用 exit 传入的参数
+
+    /* 同一进程的线程共用主线程的 pgdir、userprog_vaddr、u_block_desc 和 fd_table */
+    struct task_struct* group_leader;    // 所属进程的主线程, 主线程和内核线程指向自己
+    uint16_t nr_threads;                 // 仅主线程有效: 进程中尚未退出的线程数, 含主线程
+    struct list children;                // 仅主线程有效: 子进程链表, wait 和 exit 只需遍历它
+    struct list threads;                 // 仅主线程有效: 进程中 clone 出的线程, 不含主线程
+    void* ustack;                        // clone 出的线程自己的用户栈, 主线程为 NULL
+    struct uring_ctx* uring;             // 仅主线程有效: 批量异步系统调用的队列, 见 uring.h
+    struct vdso_proc* vdso;              // 仅主线程有效: 只读映射给进程的进程页, 见 vdso.h
+    void* thread_retval;                 // 线程退出时的返回值, 由 join 取走
+    struct task_struct* joiner;          // 正在 join 此线程的线程
     uint32_t stack_magic;                // 栈的边界标记，用于检测栈的溢出
 };
 
-extern struct list thread_ready_list;
+/* 每个 cpu 一个的就绪队列, 以 vruntime 为键的红黑树, 最左边的任务最先上 cpu */
+struct run_queue {
+    struct spinlock lock;           // 保护本队列及其中任务的状态, 在关中断下持有
+    struct rb_root tasks_timeline;  // 就绪任务组成的红黑树
+    struct rb_node* leftmost;       // 缓存树中最左(vruntime最小)的结点
+    uint32_t nr_running;            // 就绪任务数
+    uint32_t load_weight;           // 就绪任务的权重之和
+    uint32_t min_vruntime;          // 单调递增的最小 vruntime, 新建和唤醒的任务以此为基准
+    struct task_struct* curr;       // 本 cpu 上正在运行的任务
+    struct task_struct* yield_skip; // 刚调用 thread_yield 让出 cpu 的任务, 本轮调度尽量不选它
+
+    /* 实时任务不参与公平调度, 按绝对截止期限另组一棵红黑树, 有就绪的实时任务时先运行它们 */
+    struct rb_root dl_timeline;
+    struct rb_node* dl_leftmost;    // 截止期限最早的实时任务
+    uint32_t dl_nr_running;         // 就绪的实时任务数, 也计入 nr_running
+    uint32_t dl_bw;                 // 接纳到本 cpu 上的实时任务的带宽之和, 由 dl_bw_lock 保护
+};
+
 extern struct list thread_all_list;
+extern struct lock thread_all_lock;
+extern struct task_struct* main_thread;
 
 void thread_create(struct task_struct* pthread, thread_func function, void* func_arg);
 void init_thread(struct task_struct* pthread, char* name, int prio);
 struct task_struct* thread_start(char* name, int prio, thread_func function, void* func_arg);
+struct task_struct* thread_start_dl(char* name, const struct sched_dl_attr* attr, thread_func function, void* func_arg);
 struct task_struct* running_thread(void);
 void schedule(void);
 void thread_init(void);
 void thread_block(enum task_status stat);
 void thread_unblock(struct task_struct* pthread);
 void thread_yield(void);
+void sched_enqueue(struct task_struct* pthread);
+void sched_dequeue(struct task_struct* pthread);
+void sched_tick(uint32_t nr_ticks);
+void thread_set_priority(struct task_struct* pthread, uint8_t prio);
+int32_t thread_set_dl(struct task_struct* pthread, const struct sched_dl_attr* attr);
+void sched_dl_fork(struct task_struct* child);
+int32_t sys_sched_setdl(pid_t pid, const struct sched_dl_attr* attr);
+void schedule_tail(void);
+struct task_struct* idle_thread_create(struct cpu* c);
+void cpu_idle(void);
 pid_t fork_pid(void);
 void sys_ps(void);
+int32_t sys_schedstat(pid_t pid, struct schedstat* buf);
+void thread_exit(struct task_struct* thread_over, bool need_schedule);
+struct task_struct* pid2thread(int32_t pid);
+void thread_link(struct task_struct* pthread);
+struct task_struct* alloc_task_struct(void);
+void free_task_struct(struct task_struct* pthread);
+uint32_t task_cache_shrink(void);
 
 #endif
\ No newline at end of file
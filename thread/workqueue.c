@@ -0,0 +1,76 @@
+#include "workqueue.h"
+#include "global.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "kernel/print.h"
+
+#define SYSTEM_WQ_PRIO 31  // 与 main 线程相同, 使下半部能及时得到运行
+
+struct workqueue system_wq;
+
+/* 初始化工作 work, 执行时调用 func(data) */
+void work_init(struct work_struct* work, work_func* func, void* data) {
+    work->entry.prev = work->entry.next = NULL;
+    work->func = func;
+    work->data = data;
+    work->pending = false;
+}
+
+/* 工作线程: 依次取出工作并在开中断下执行, 队列为空时阻塞 */
+static void worker_thread(void* arg) {
+    struct workqueue* wq = arg;
+    while (1) {
+        enum intr_status old_status = spin_lock_irqsave(&wq->lock);
+        while (list_empty(&wq->works)) {
+            /* 先置为阻塞态再放锁, 此后提交的工作一定能看到 idle 并唤醒自己 */
+            wq->idle = true;
+            running_thread()->status = TASK_BLOCKED;
+            spin_unlock(&wq->lock);
+            schedule();
+            spin_lock(&wq->lock);
+        }
+        struct work_struct* work = elem2entry(struct work_struct, entry, list_pop(&wq->works));
+        work->pending = false;  // 执行期间允许再次提交, 以免漏掉执行中到来的中断
+        spin_unlock_irqrestore(&wq->lock, old_status);
+
+        work->func(work->data);
+    }
+}
+
+/* 创建名为 name 的工作队列及其优先级为 prio 的工作线程 */
+void workqueue_create(struct workqueue* wq, char* name, int prio) {
+    list_init(&wq->works);
+    spin_lock_init(&wq->lock);
+    wq->idle = false;
+    wq->worker = thread_start(name, prio, worker_thread, wq);
+}
+
+/* 把 work 提交到 wq, 可在中断处理程序中调用.
+   work 已在队列中等待时不重复提交, 返回 false */
+bool queue_work(struct workqueue* wq, struct work_struct* work) {
+    enum intr_status old_status = spin_lock_irqsave(&wq->lock);
+    if (work->pending) {
+        spin_unlock_irqrestore(&wq->lock, old_status);
+        return false;
+    }
+    work->pending = true;
+    list_append(&wq->works, &work->entry);
+    if (wq->idle) {
+        wq->idle = false;
+        thread_unblock(wq->worker);
+    }
+    spin_unlock_irqrestore(&wq->lock, old_status);
+    return true;
+}
+
+/* 把 work 提交到通用工作队列 */
+bool schedule_work(struct work_struct* work) {
+    return queue_work(&system_wq, work);
+}
+
+/* 创建通用工作队列, 需在注册使用它的中断处理程序之前调用 */
+void workqueue_init(void) {
+    put_str("workqueue_init start\n");
+    workqueue_create(&system_wq, "kworker", SYSTEM_WQ_PRIO);
+    put_str("workqueue_init done\n");
+}
@@ -0,0 +1,36 @@
+#ifndef __THREAD_WORKQUEUE_H
+#define __THREAD_WORKQUEUE_H
+
+#include "stdint.h"
+#include "global.h"
+#include "kernel/list.h"
+#include "thread.h"
+#include "spinlock.h"
+
+typedef void work_func(void*);
+
+/* 推迟执行的工作, 由中断处理程序(上半部)提交, 在工作线程中开中断执行(下半部) */
+struct work_struct {
+    struct list_elem entry;  // 用于在工作队列中排队
+    work_func* func;         // 要执行的函数
+    void* data;              // func 的参数
+    bool pending;            // 已提交但尚未开始执行, 此时再提交会被忽略
+};
+
+/* 工作队列, 每个队列由一个内核工作线程依次执行其中的工作 */
+struct workqueue {
+    struct list works;              // 待执行的工作
+    struct spinlock lock;           // 保护 works 和 idle, 中断处理程序中也会申请
+    struct task_struct* worker;     // 工作线程
+    bool idle;                      // 工作线程因无事可做而阻塞
+};
+
+extern struct workqueue system_wq;  // 通用的工作队列, 供不需要专用线程的驱动使用
+
+void work_init(struct work_struct* work, work_func* func, void* data);
+void workqueue_create(struct workqueue* wq, char* name, int prio);
+bool queue_work(struct workqueue* wq, struct work_struct* work);
+bool schedule_work(struct work_struct* work);
+void workqueue_init(void);
+
+#endif
@@ -5,6 +5,9 @@
 #include "string.h"
 #include "global.h"
 #include "memory.h"
+#include "fpu.h"
+#include "uring.h"
+#include "vdso.h"
 
 extern void intr_exit(void);
 typedef uint32_t Elf32_Word, Elf32_Addr, Elf32_Off;
@@ -152,6 +155,12 @@ done:
 
 /* 用path指向的程序替换当前进程 */
 int32_t sys_execv(const char* path, const char* argv[]) {
+    /* 其他线程还在使用当前的地址空间, 不能替换. 异步队列属于旧程序, 撤销掉 */
+    struct task_struct* leader = running_thread()->group_leader;
+    if (running_thread() != leader || leader->nr_threads > 1 + uring_nr_workers(leader)) {
+        return -1;
+    }
+    uring_release(leader);
     uint32_t argc = 0;
     while (argv[argc]) {
         argc++;
@@ -162,6 +171,8 @@ int32_t sys_execv(const char* path, const char* argv[]) {
     }
     
     struct task_struct* cur = running_thread();
+    fpu_free(cur);  // 新程序从干净的 FPU 状态开始
+    cur->vdso->threaded = 0;  // 旧程序的线程都已退出
     /* 修改进程名 */
     memcpy(cur->name, path, TASK_NAME_LEN);
     cur->name[TASK_NAME_LEN-1] = 0;
@@ -6,12 +6,18 @@
 #include "thread.h"    
 #include "string.h"
 #include "file.h"
+#include "sync.h"
+#include "smp.h"
+#include "fpu.h"
+#include "vdso.h"
+#include "scstat.h"
 
-extern void intr_exit(void);
+extern void fork_ret(void);
 
 
 /* 将父进程的 pcb 拷贝给子进程 */
 static int32_t copy_pcb_vaddrbitmap_stack0(struct task_struct* child_thread, struct task_struct* parent_thread) {
+    struct task_struct* leader = parent_thread->group_leader;
     /* a 复制 pcb 所在的整个页，里面包含进程 pcb 信息及特级 0 极的栈，里面包含了返回地址*/
     memcpy(child_thread, parent_thread, PG_SIZE);
     // 下面再单独修改
@@ -19,9 +25,32 @@ static int32_t copy_pcb_vaddrbitmap_stack0(struct task_struct* child_thread, str
     child_thread->elapsed_ticks = 0;
     child_thread->status = TASK_READY;
     child_thread->ticks = child_thread->priority;  // 为新进程把时间片充满
-    child_thread->parent_pid = parent_thread->pid;
+    /* 由线程 fork 时, 子进程的父进程是线程所在的进程, 进程级的资源也要从主线程取 */
+    child_thread->parent_pid = leader->pid;
+    child_thread->group_leader = child_thread;
+    child_thread->nr_threads = 1;
+    child_thread->ustack = NULL;
+    child_thread->uring = NULL;  // 异步队列的工作线程不随 fork 复制
+    child_thread->joiner = NULL;
+    memcpy(child_thread->fd_table, leader->fd_table, sizeof(leader->fd_table));
+    child_thread->userprog_vaddr = leader->userprog_vaddr;
     child_thread->general_tag.prev = child_thread->general_tag.next = NULL;
+    child_thread->on_rq = false;  // 子进程沿用父进程的 vruntime, 稍后加入就绪队列
+    child_thread->on_cpu = false;
+    /* sched_enqueue 会加上目标 cpu 的 min_vruntime, 这里先换算成相对于本 cpu 的值 */
+    child_thread->vruntime -= this_cpu()->rq.min_vruntime;
+    sched_dl_fork(child_thread);  // 子进程是普通任务
+    memset(&child_thread->stats, 0, sizeof(child_thread->stats));  // 调度统计从零开始
+    child_thread->block_start = 0;
+    child_thread->block_reason = BLOCK_OTHER;
+    child_thread->woken = false;
+    /* 父进程此时可能持有锁, 继承来的优先级不能带给子进程 */
+    list_init(&child_thread->held_locks);
+    child_thread->blocked_on = NULL;
+    thread_set_priority(child_thread, child_thread->normal_prio);
     child_thread->all_list_tag.prev = child_thread->all_list_tag.next = NULL;
+    list_init(&child_thread->children);  // 父进程的子进程和线程都不属于子进程
+    list_init(&child_thread->threads);
     block_desc_init(child_thread->u_block_desc);
 
     /* b 复制父进程的虚拟地址池的位图 */
@@ -42,9 +71,10 @@ static int32_t copy_pcb_vaddrbitmap_stack0(struct task_struct* child_thread, str
 
 /* 复制子进程的进程体（代码和数据）及用户栈 */
 static void copy_body_stack3(struct task_struct* child_thread, struct task_struct* parent_thread, void* buf_page) {
-    uint8_t* vaddr_btmp = parent_thread->userprog_vaddr.vaddr_bitmap.bits;
-    uint32_t btmp_bytes_len = parent_thread->userprog_vaddr.vaddr_bitmap.btmp_bytes_len;
-    uint32_t vaddr_start = parent_thread->userprog_vaddr.vaddr_start;
+    struct virtual_addr* user_vaddr = &parent_thread->group_leader->userprog_vaddr;
+    uint8_t* vaddr_btmp = user_vaddr->vaddr_bitmap.bits;
+    uint32_t btmp_bytes_len = user_vaddr->vaddr_bitmap.btmp_bytes_len;
+    uint32_t vaddr_start = user_vaddr->vaddr_start;
     uint32_t idx_byte = 0;
     uint32_t idx_bit = 0;
     uint32_t prog_vaddr = 0;
@@ -99,8 +129,8 @@ static int32_t build_child_stack(struct task_struct* child_thread) {
        即 esp 为 (uint32_t*)intr_0_stack - 5 */
     uint32_t* ebp_ptr_in_thread_stack = (uint32_t*)intr_0_stack - 5;
 
-    /* switch_to 的返回地址更新为 intr_exit ，直接从中断返回 */
-    *ret_addr_in_thread_stack = (uint32_t)intr_exit;
+    /* switch_to 的返回地址更新为 fork_ret, 由它做完 schedule_tail 的收尾后经 intr_exit 直接从中断返回 */
+    *ret_addr_in_thread_stack = (uint32_t)fork_ret;
 
     /* 下面这两行赋值只是为了使构建的thread_stack更加清晰,其实也不需要,
     * 因为在进入intr_exit后一系列的pop会把寄存器中的数据覆盖 */
@@ -144,6 +174,16 @@ static int32_t copy_process(struct task_struct* child_thread, struct task_struct
         return -1;
     }
 
+    /* 复制父进程的 FPU 状态, 父进程从没用过 FPU 时什么也不做 */
+    if (fpu_fork(child_thread, parent_thread) == -1) {
+        return -1;
+    }
+
+    /* 父进程在统计系统调用时子进程也统计 */
+    if (scstat_fork(child_thread, parent_thread) == -1) {
+        return -1;
+    }
+
     /* b 为子进程创建页表,此页表仅包括内核空间 */
     child_thread->pgdir = create_page_dir();
     if(child_thread->pgdir == NULL) {
@@ -153,6 +193,11 @@ static int32_t copy_process(struct task_struct* child_thread, struct task_struct
     /* c 复制父进程进程体及用户栈给子进程 */
     copy_body_stack3(child_thread, parent_thread, buf_page);
 
+    /* 子进程有自己的进程页, 时间页与父进程共享 */
+    if (vdso_map(child_thread) == -1) {
+        return -1;
+    }
+
     /* d 构建子进程thread_stack和修改返回值pid */
     build_child_stack(child_thread);
 
@@ -164,10 +209,83 @@ static int32_t copy_process(struct task_struct* child_thread, struct task_struct
     return 0;
 }
 
+/* 创建与当前进程共享地址空间的线程, 只能由用户进程通过系统调用clone调用.
+   新线程有自己的用户栈, 在用户态从entry(func, arg)开始执行, entry不能返回.
+   成功返回新线程的id, 失败返回-1 */
+pid_t sys_clone(void* entry, void* func, void* arg) {
+    struct task_struct* parent_thread = running_thread();
+    struct task_struct* leader = parent_thread->group_leader;
+    ASSERT(INTR_OFF == intr_get_status() && parent_thread->pgdir != NULL);
+
+    /* 用户栈从进程共享的虚拟地址池中分配 */
+    void* ustack = get_user_pages(THREAD_USTACK_PAGES);
+    if (ustack == NULL) {
+        return -1;
+    }
+    struct task_struct* child_thread = alloc_task_struct();
+    if (child_thread == NULL) {
+        free_user_pages(ustack, THREAD_USTACK_PAGES);
+        return -1;
+    }
+
+    /* 复制 pcb 和 0 级栈, 地址空间、内存块描述符和文件描述符表都通过 group_leader 共用 */
+    memcpy(child_thread, parent_thread, PG_SIZE);
+    child_thread->pid = fork_pid();
+    child_thread->elapsed_ticks = 0;
+    child_thread->status = TASK_READY;
+    child_thread->ticks = child_thread->priority;
+    child_thread->parent_pid = -1;  // 线程不是谁的子进程, 不会被 wait 到
+    child_thread->general_tag.prev = child_thread->general_tag.next = NULL;
+    child_thread->all_list_tag.prev = child_thread->all_list_tag.next = NULL;
+    list_init(&child_thread->children);  // 只有主线程的这两个链表有效
+    list_init(&child_thread->threads);
+    child_thread->on_rq = false;
+    child_thread->on_cpu = false;
+    child_thread->vruntime -= this_cpu()->rq.min_vruntime;
+    sched_dl_fork(child_thread);
+    memset(&child_thread->stats, 0, sizeof(child_thread->stats));
+    child_thread->block_start = 0;
+    child_thread->block_reason = BLOCK_OTHER;
+    child_thread->woken = false;
+    list_init(&child_thread->held_locks);
+    child_thread->blocked_on = NULL;
+    thread_set_priority(child_thread, child_thread->normal_prio);
+    child_thread->fpu_state = NULL;  // 新线程从干净的 FPU 状态开始
+    if (scstat_fork(child_thread, parent_thread) == -1) {
+        free_user_pages(ustack, THREAD_USTACK_PAGES);
+        free_task_struct(child_thread);
+        return -1;
+    }
+    child_thread->ustack = ustack;
+    child_thread->thread_retval = NULL;
+    child_thread->joiner = NULL;
+
+    /* 在新用户栈上构造 entry 的调用帧: 返回地址(entry 不返回, 置 0)、func、arg */
+    uint32_t* esp3 = (uint32_t*)((uint32_t)ustack + THREAD_USTACK_PAGES * PG_SIZE) - 3;
+    esp3[0] = 0;
+    esp3[1] = (uint32_t)func;
+    esp3[2] = (uint32_t)arg;
+    struct intr_stack* intr_0_stack = (struct intr_stack*)((uint32_t)child_thread + PG_SIZE - sizeof(struct intr_stack));
+    intr_0_stack->eip = entry;
+    intr_0_stack->esp = esp3;
+    build_child_stack(child_thread);
+
+    /* 各线程的 pid 不同, 此后 getpid 不能再读进程页 */
+    leader->vdso->threaded = 1;
+
+    lock_acquire(&thread_all_lock);
+    leader->nr_threads++;
+    thread_link(child_thread);
+    lock_release(&thread_all_lock);
+    sched_enqueue(child_thread);
+
+    return child_thread->pid;
+}
+
 /* fork子进程,内核线程不可直接调用 */
 pid_t sys_fork(void) {
     struct task_struct* parent_thread = running_thread();
-    struct task_struct* child_thread = get_kernel_pages(1);  // 为子进程创建pcb(task_struct结构)
+    struct task_struct* child_thread = alloc_task_struct();  // 为子进程创建pcb(task_struct结构)
     if (child_thread == NULL) {
         return -1;
     }
@@ -177,11 +295,10 @@ pid_t sys_fork(void) {
         return -1;
     }
 
-    /* 添加到就绪线程队列和所有线程队列,子进程由调试器安排运行 */
-    ASSERT(!elem_find(&thread_ready_list, &child_thread->general_tag));
-    list_append(&thread_ready_list, &child_thread->general_tag);
-    ASSERT(!elem_find(&thread_all_list, &child_thread->all_list_tag));
-    list_append(&thread_all_list, &child_thread->all_list_tag);
+    /* 添加到所有线程队列和就绪线程队列,子进程由调试器安排运行.
+       先进全部队列, 否则子进程可能在别的 cpu 上已经运行并退出, 父进程还找不到它 */
+    thread_link(child_thread);
+    sched_enqueue(child_thread);
     
     return child_thread->pid;    // 父进程返回子进程的pid
 }
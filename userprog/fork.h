@@ -3,8 +3,11 @@
 
 #include "thread.h"
 
+#define THREAD_USTACK_PAGES 4  // clone 出的线程的用户栈页数
+
 /* fork子进程,只能由用户进程通过系统调用fork调用,
    内核线程不可直接调用,原因是要从0级栈中获得esp3等 */
 pid_t sys_fork(void);
+pid_t sys_clone(void* entry, void* func, void* arg);
 
 #endif
\ No newline at end of file
@@ -8,6 +8,8 @@
 #include "interrupt.h"
 #include "string.h"
 #include "console.h"
+#include "sync.h"
+#include "vdso.h"
 
 
 extern void intr_exit(void);
@@ -28,6 +30,9 @@ void start_process(void* filename_) {
     proc_stack->eflags = (EFLAGS_IOPL_0 | EFLAGS_MBS | EFLAGS_IF_1);
     proc_stack->esp = (void*)((uint32_t)get_a_page(PF_USER, USER_STACK3_VADDR) + PG_SIZE) ;
     proc_stack->ss = SELECTOR_U_DATA; 
+    if (vdso_map(cur) == -1) {
+        PANIC("start_process: vdso_map failed\n");
+    }
     asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (proc_stack) : "memory");  // 从中断号开始弹栈 
 
 }
@@ -98,18 +103,14 @@ void create_user_vaddr_bitmap(struct task_struct* user_prog) {
 /* 创建用户进程 */
 void process_execute(void* filename, char* name) { 
     /* pcb内核的数据结构,由内核来维护进程信息,因此要在内核内存池中申请 */
-    struct task_struct* thread = get_kernel_pages(1);
+    struct task_struct* thread = alloc_task_struct();
     init_thread(thread, name, default_prio); 
     create_user_vaddr_bitmap(thread);
     thread_create(thread, start_process, filename);  //start_process(filename)
     thread->pgdir = create_page_dir();
     block_desc_init(thread->u_block_desc);  // 用户内存块描述符数组的初始化
 
-    enum intr_status old_status = intr_disable();
-    ASSERT(!elem_find(&thread_ready_list, &thread->general_tag));
-    list_append(&thread_ready_list, &thread->general_tag);
+    thread_link(thread);
 
-    ASSERT(!elem_find(&thread_all_list, &thread->all_list_tag));
-    list_append(&thread_all_list, &thread->all_list_tag);
-    intr_set_status(old_status);
+    sched_enqueue(thread);
 }
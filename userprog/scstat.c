@@ -0,0 +1,237 @@
+#include "scstat.h"
+#include "global.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "string.h"
+#include "thread.h"
+#include "sync.h"
+#include "smp.h"
+#include "timer.h"
+#include "kernel/print.h"
+
+#define SCSTAT_SIZE (NR_SYSCALLS * sizeof(struct syscall_stat))
+#define SCSTAT_PAGES DIV_ROUND_UP(SCSTAT_SIZE, PG_SIZE)
+
+/* 全系统的统计每个 cpu 一份, 系统调用返回前在关中断下更新本 cpu 的那份, 不用加锁, 读取时再相加 */
+static struct syscall_stat* cpu_stats[NR_CPUS];
+
+/* 保护各任务统计区的分配和释放, 以及子进程统计的合并. 任务自己的统计只由自己更新, 不用持锁 */
+static struct lock scstat_lock;
+
+/* 耗时 cycles 落在直方图的哪个桶 */
+static uint32_t scstat_bucket(uint64_t cycles) {
+    uint32_t high = (uint32_t)(cycles >> 32), low = (uint32_t)cycles;
+    if (high != 0) {
+        return SCSTAT_BUCKETS - 1;
+    }
+    if (low == 0) {
+        return 0;
+    }
+    uint32_t msb;
+    asm ("bsrl %1, %0" : "=r" (msb) : "rm" (low));
+    return msb < SCSTAT_BUCKETS ? msb : SCSTAT_BUCKETS - 1;
+}
+
+static void stat_add_one(struct syscall_stat* st, uint64_t cycles) {
+    st->calls++;
+    st->hist[scstat_bucket(cycles)]++;
+    st->total_cycles += cycles;
+    if (cycles > st->max_cycles) {
+        st->max_cycles = cycles;
+    }
+}
+
+/* 把 src 中的 NR_SYSCALLS 项统计累加到 dst */
+static void stat_merge(struct syscall_stat* dst, const struct syscall_stat* src) {
+    uint32_t nr, b;
+    for (nr = 0; nr < NR_SYSCALLS; nr++) {
+        dst[nr].calls += src[nr].calls;
+        for (b = 0; b < SCSTAT_BUCKETS; b++) {
+            dst[nr].hist[b] += src[nr].hist[b];
+        }
+        dst[nr].total_cycles += src[nr].total_cycles;
+        if (src[nr].max_cycles > dst[nr].max_cycles) {
+            dst[nr].max_cycles = src[nr].max_cycles;
+        }
+    }
+}
+
+static struct syscall_stat* stat_alloc(void) {
+    return get_kernel_pages(SCSTAT_PAGES);
+}
+
+static void stat_free(struct syscall_stat* st) {
+    if (st != NULL) {
+        mfree_page(PF_KERNEL, st, SCSTAT_PAGES);
+    }
+}
+
+/* 系统调用 nr 返回前调用, 耗时为 cycles. 此时处于关中断状态, 不会换 cpu */
+void scstat_account(uint32_t nr, uint64_t cycles) {
+    ASSERT(intr_get_status() == INTR_OFF);
+    struct syscall_stat* percpu = cpu_stats[this_cpu()->id];
+    if (percpu != NULL) {
+        stat_add_one(&percpu[nr], cycles);
+    }
+    struct task_struct* cur = running_thread();
+    if (cur->sc_stats != NULL) {
+        stat_add_one(&cur->sc_stats[nr], cycles);
+    }
+}
+
+/* fork 或 clone 时调用, 父任务在统计则子任务也统计. 成功返回 0, 失败返回 -1 */
+int32_t scstat_fork(struct task_struct* child, struct task_struct* parent) {
+    child->sc_stats = NULL;
+    child->sc_child_stats = NULL;
+    if (parent->sc_stats == NULL) {
+        return 0;
+    }
+    child->sc_stats = stat_alloc();
+    return child->sc_stats == NULL ? -1 : 0;
+}
+
+/* 任务退出时调用, 把它自己和它的子进程的统计并入父进程的子进程统计, 线程并入主线程的.
+   父进程已停止统计时直接丢弃. 主线程自己的统计只由它自己更新, 所以线程也不并入那里 */
+void scstat_exit(struct task_struct* pthread) {
+    if (pthread->sc_stats == NULL && pthread->sc_child_stats == NULL) {
+        return;
+    }
+    /* 持 thread_all_lock 时父进程不会退出而把 pthread 过继给 init, 它的 pcb 也就不会被回收 */
+    lock_acquire(&thread_all_lock);
+    lock_acquire(&scstat_lock);
+    struct task_struct* parent = pthread->group_leader;
+    if (pthread == parent) {
+        parent = pthread->parent_pid == -1 ? NULL : pid2thread(pthread->parent_pid);
+    }
+    struct syscall_stat** dst = NULL;
+    if (parent != NULL && parent->sc_stats != NULL) {
+        dst = &parent->sc_child_stats;
+        if (*dst == NULL) {
+            *dst = stat_alloc();
+        }
+    }
+    if (dst != NULL && *dst != NULL) {
+        if (pthread->sc_stats != NULL) {
+            stat_merge(*dst, pthread->sc_stats);
+        }
+        if (pthread->sc_child_stats != NULL) {
+            stat_merge(*dst, pthread->sc_child_stats);
+        }
+    }
+    stat_free(pthread->sc_stats);
+    stat_free(pthread->sc_child_stats);
+    pthread->sc_stats = NULL;
+    pthread->sc_child_stats = NULL;
+    lock_release(&scstat_lock);
+    lock_release(&thread_all_lock);
+}
+
+/* 把各 cpu 的全系统统计相加后存入 buf */
+static void global_stats_get(struct syscall_stat* buf) {
+    memset(buf, 0, SCSTAT_SIZE);
+    uint32_t cpu_id;
+    for (cpu_id = 0; cpu_id < NR_CPUS; cpu_id++) {
+        if (cpu_stats[cpu_id] != NULL) {
+            stat_merge(buf, cpu_stats[cpu_id]);
+        }
+    }
+}
+
+/* 系统调用统计的控制与读取, cmd 取值见 enum scstat_cmd.
+   pid 为 0 指当前任务, 只有 SCSTAT_GET、SCSTAT_GET_CHILDREN、SCSTAT_GET_ALL 和 SCSTAT_RESET 可以用 SCSTAT_GLOBAL,
+   只有读取可以指定其他任务. 成功返回 0, 失败返回 -1 */
+int32_t sys_scstat(int32_t pid, uint32_t cmd, struct syscall_stat* buf) {
+    struct task_struct* cur = running_thread();
+    if (pid == cur->pid) {
+        pid = 0;
+    }
+    if (pid == SCSTAT_GLOBAL) {
+        if (cmd == SCSTAT_GET || cmd == SCSTAT_GET_CHILDREN || cmd == SCSTAT_GET_ALL) {
+            if (buf == NULL) {
+                return -1;
+            }
+            global_stats_get(buf);
+            return 0;
+        }
+        if (cmd == SCSTAT_RESET) {
+            enum intr_status old_status = intr_disable();  // 本 cpu 的统计在关中断下更新
+            uint32_t cpu_id;
+            for (cpu_id = 0; cpu_id < NR_CPUS; cpu_id++) {
+                if (cpu_stats[cpu_id] != NULL) {
+                    memset(cpu_stats[cpu_id], 0, SCSTAT_SIZE);
+                }
+            }
+            intr_set_status(old_status);
+            return 0;
+        }
+        return -1;
+    }
+
+    int32_t ret = 0;
+    if (cmd == SCSTAT_GET || cmd == SCSTAT_GET_CHILDREN || cmd == SCSTAT_GET_ALL) {
+        /* 与 scstat_exit 相同, 先持 thread_all_lock 再持 scstat_lock. 此时目标任务不能释放统计区,
+           读到的是它正在更新的值, 可能差一两次调用 */
+        lock_acquire(&thread_all_lock);
+        lock_acquire(&scstat_lock);
+        struct task_struct* target = pid == 0 ? cur : pid2thread(pid);
+        struct syscall_stat* src = NULL;
+        if (target != NULL) {
+            src = cmd == SCSTAT_GET ? target->sc_stats : target->sc_child_stats;
+        }
+        if (target == NULL || buf == NULL || (src == NULL && target->sc_stats == NULL)) {
+            ret = -1;  // 任务不存在或没有在统计
+        } else if (src == NULL) {
+            memset(buf, 0, SCSTAT_SIZE);  // 在统计, 但还没有子进程退出
+        } else {
+            memcpy(buf, src, SCSTAT_SIZE);
+        }
+        /* SCSTAT_GET_ALL 按 scstat_exit 的方式并入子进程统计, 与子进程都退出后的结果一致 */
+        if (ret == 0 && cmd == SCSTAT_GET_ALL && target->sc_child_stats != NULL) {
+            stat_merge(buf, target->sc_child_stats);
+        }
+        lock_release(&scstat_lock);
+        lock_release(&thread_all_lock);
+        return ret;
+    }
+
+    lock_acquire(&scstat_lock);
+    if (pid != 0) {
+        ret = -1;
+    } else if (cmd == SCSTAT_ENABLE || cmd == SCSTAT_RESET) {
+        if (cur->sc_stats == NULL) {
+            if (cmd == SCSTAT_RESET || (cur->sc_stats = stat_alloc()) == NULL) {
+                ret = -1;
+            }
+        } else {
+            memset(cur->sc_stats, 0, SCSTAT_SIZE);
+        }
+        if (cmd == SCSTAT_RESET && cur->sc_child_stats != NULL) {
+            memset(cur->sc_child_stats, 0, SCSTAT_SIZE);
+        }
+    } else if (cmd == SCSTAT_DISABLE) {
+        stat_free(cur->sc_stats);
+        stat_free(cur->sc_child_stats);
+        cur->sc_stats = NULL;
+        cur->sc_child_stats = NULL;
+    } else {
+        ret = -1;
+    }
+    lock_release(&scstat_lock);
+    return ret;
+}
+
+/* 为每个已发现的 cpu 分配全系统统计, 需在 smp_init 之后调用. 此前的系统调用不计入 */
+void scstat_init(void) {
+    put_str("scstat_init start\n");
+    lock_init(&scstat_lock);
+    uint32_t cpu_id;
+    for (cpu_id = 0; cpu_id < nr_cpus; cpu_id++) {
+        struct syscall_stat* st = stat_alloc();
+        if (st == NULL) {
+            PANIC("scstat_init: no memory\n");
+        }
+        cpu_stats[cpu_id] = st;
+    }
+    put_str("scstat_init done\n");
+}
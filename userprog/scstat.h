@@ -0,0 +1,40 @@
+#ifndef __USERPROG_SCSTAT_H
+#define __USERPROG_SCSTAT_H
+
+#include "stdint.h"
+#include "global.h"
+
+#define NR_SYSCALLS 64             // 系统调用表的大小
+#define SCSTAT_BUCKETS 24          // 延迟直方图的桶数
+#define SCSTAT_GLOBAL (-1)         // sys_scstat 的 pid 取此值时指全系统的统计
+
+/* 一个系统调用号的统计, 时间单位为 TSC 周期, cpu 没有 TSC 时只计次数.
+   直方图按 log2 分桶: 第 i 个桶记录耗时在 [2^i, 2^(i+1)) 周期内的调用, 第 0 个桶还包括 0 周期,
+   最后一个桶记录所有不少于 2^(SCSTAT_BUCKETS-1) 周期的调用 */
+struct syscall_stat {
+    uint32_t calls;
+    uint32_t hist[SCSTAT_BUCKETS];
+    uint64_t total_cycles;
+    uint64_t max_cycles;
+};
+
+/* sys_scstat 的命令. 按任务的统计默认关闭, 打开后 fork、clone 出的任务也跟着统计,
+   它们退出时把自己的统计并入父进程(线程则是主线程)的子进程统计 */
+enum scstat_cmd {
+    SCSTAT_ENABLE,        // 开始统计当前任务, 已打开时清零
+    SCSTAT_DISABLE,       // 停止统计当前任务, 丢弃已有的统计
+    SCSTAT_RESET,         // 清零: 当前任务的统计和子进程统计, pid 为 SCSTAT_GLOBAL 时清零全系统的统计
+    SCSTAT_GET,           // 把任务 pid 的统计复制到 buf, 共 NR_SYSCALLS 项
+    SCSTAT_GET_CHILDREN,  // 把任务 pid 已退出的子进程和线程的累计统计复制到 buf
+    SCSTAT_GET_ALL        // 把以上两者之和复制到 buf, 即任务 pid 连同已退出的子进程和线程的统计
+};
+
+struct task_struct;
+
+void scstat_init(void);
+void scstat_account(uint32_t nr, uint64_t cycles);
+int32_t scstat_fork(struct task_struct* child, struct task_struct* parent);
+void scstat_exit(struct task_struct* pthread);
+int32_t sys_scstat(int32_t pid, uint32_t cmd, struct syscall_stat* buf);
+
+#endif
@@ -11,11 +11,16 @@
 #include "exec.h"
 #include "wait_exit.h"
 #include "pipe.h"
-
-#define syscall_nr 32 
+#include "timer.h"
+#include "futex.h"
+#include "uring.h"
+#include "scstat.h"
+#include "md.h"
 
 typedef void* syscall;
-syscall syscall_table[syscall_nr];
+syscall syscall_table[NR_SYSCALLS];
+
+typedef uint32_t syscall_func(uint32_t arg1, uint32_t arg2, uint32_t arg3);
 
 
 /* 返回当前任务的pid */
@@ -24,6 +29,20 @@ uint32_t sys_getpid(void) {
 }
 
 
+/* 由 kernel.S 中的两个系统调用入口调用, 按子功能号 nr 分派并统计次数和耗时.
+   execv、exit 等不返回的调用不计入. 子功能号非法时返回 -1 */
+uint32_t syscall_dispatch(uint32_t nr, uint32_t arg1, uint32_t arg2, uint32_t arg3) {
+    if (nr >= NR_SYSCALLS || syscall_table[nr] == NULL) {
+        return -1;
+    }
+    /* 没有 TSC 的 cpu 上不能执行 rdtsc, 只计次数 */
+    uint64_t start = tsc_khz != 0 ? rdtsc() : 0;
+    uint32_t ret = ((syscall_func*)syscall_table[nr])(arg1, arg2, arg3);
+    scstat_account(nr, tsc_khz != 0 ? rdtsc() - start : 0);
+    return ret;
+}
+
+
 // /* 打印字符串 str （未实现文件系统前的版本）*/
 // uint32_t sys_write(char* str) {
 //     console_put_str(str);
@@ -62,5 +81,20 @@ void syscall_init(void) {
     syscall_table[SYS_PIPE]	    = sys_pipe;
     syscall_table[SYS_FD_REDIRECT]   = sys_fd_redirect;
     syscall_table[SYS_HELP]	    = sys_help;
+    syscall_table[SYS_NANOSLEEP]    = sys_nanosleep;
+    syscall_table[SYS_CLOCK_GETTIME] = sys_clock_gettime;
+    syscall_table[SYS_FUTEX_WAIT]   = sys_futex_wait;
+    syscall_table[SYS_FUTEX_WAKE]   = sys_futex_wake;
+    syscall_table[SYS_CLONE]        = sys_clone;
+    syscall_table[SYS_THREAD_EXIT]  = sys_thread_exit;
+    syscall_table[SYS_THREAD_JOIN]  = sys_thread_join;
+    syscall_table[SYS_SCHEDSTAT]    = sys_schedstat;
+    syscall_table[SYS_SCHED_SETDL]  = sys_sched_setdl;
+    syscall_table[SYS_URING_SETUP]  = sys_uring_setup;
+    syscall_table[SYS_URING_ENTER]  = sys_uring_enter;
+    syscall_table[SYS_SCSTAT]       = sys_scstat;
+    syscall_table[SYS_SYNC]         = sys_sync;
+    syscall_table[SYS_MD_CREATE]    = sys_md_create;
+    syscall_table[SYS_BLKIO]        = sys_blkio;
     put_str("syscall_init done\n");
 }
\ No newline at end of file
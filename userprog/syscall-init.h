@@ -5,5 +5,6 @@
 
 void syscall_init(void);
 uint32_t sys_getpid(void);
+uint32_t syscall_dispatch(uint32_t nr, uint32_t arg1, uint32_t arg2, uint32_t arg3);
 
 #endif
\ No newline at end of file
@@ -3,6 +3,17 @@
 #include "global.h"
 #include "string.h"
 #include "kernel/print.h"
+#include "smp.h"
+
+#define GDT_DESC_CNT 9        // 代码、数据、显存段前还有一个空描述符, 其后是 tss、sysenter 用的两个内核段和两个用户段
+#define LOADER_GDT_DESC_CNT 4 // loader 建立的 gdt 中有用的描述符个数
+
+#define MSR_SYSENTER_CS  0x174
+#define MSR_SYSENTER_ESP 0x175
+#define MSR_SYSENTER_EIP 0x176
+#define CPUID_SEP (1 << 11)   // 支持 sysenter/sysexit
+
+extern void sysenter_entry(void);
 
 /* 任务状态段tss结构 */
 struct tss {
@@ -35,13 +46,42 @@ struct tss {
     uint32_t io_base;
 }; 
 
-static struct tss tss;
+/* 每个 cpu 各有一个 tss 和一份 gdt. tss 描述符加载后会被置为忙, 不能在多个 cpu 间共用 */
+static struct tss tss[NR_CPUS];
+static struct gdt_desc gdt[NR_CPUS][GDT_DESC_CNT];
 
-/* 更新 tss 中 esp0 字段的值为 pthread 的 0 级栈 */
+/* 更新当前 cpu 的 tss 中 esp0 字段的值为 pthread 的 0 级栈 */
 void update_tss_esp(struct task_struct* pthread) {
     /* 此栈地址是用户进程由用户态进入内核态时所用的栈，这和之前咱们的内核线程地址是一样的，
        用户进程进入内核态后，除了拥有单独的地址空间外，其他方面和内核线程是一样的。*/
-    tss.esp0 = (uint32_t*)((uint32_t)pthread + PG_SIZE);
+    tss[this_cpu()->id].esp0 = (uint32_t*)((uint32_t)pthread + PG_SIZE);
+}
+
+static inline void wrmsr(uint32_t msr, uint32_t value) {
+    asm volatile ("wrmsr" : : "c" (msr), "a" (value), "d" (0));
+}
+
+/* cpu 是否支持 sysenter/sysexit. 早期的 Pentium Pro(family 6, model < 3, stepping < 3) 虽置了 SEP 位却不支持 */
+static bool sysenter_supported(void) {
+    uint32_t eax, ebx, ecx, edx;
+    asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+    uint32_t family = (eax >> 8) & 0xf, model = (eax >> 4) & 0xf, stepping = eax & 0xf;
+    if (family == 6 && model < 3 && stepping < 3) {
+        return false;
+    }
+    return (edx & CPUID_SEP) != 0;
+}
+
+/* 设置当前 cpu 的 sysenter 入口. 进入内核时 esp 指向本 cpu tss 的 esp0 字段,
+   sysenter_entry 从中取出当前任务的 0 级栈, 这样换任务时只需像 int 0x80 一样更新 esp0 */
+static void sysenter_init(struct tss* t) {
+    if (!sysenter_supported()) {
+        put_str("   sysenter not supported, use int 0x80\n");
+        return;
+    }
+    wrmsr(MSR_SYSENTER_CS, SELECTOR_SYSENTER_CS);
+    wrmsr(MSR_SYSENTER_ESP, (uint32_t)&t->esp0);
+    wrmsr(MSR_SYSENTER_EIP, (uint32_t)sysenter_entry);
 }
 
 /* 创建gdt描述符 */
@@ -57,26 +97,35 @@ static struct gdt_desc make_gdt_desc(uint32_t* desc_addr, uint32_t limit, uint8_
     return desc;
 }
 
-/* 在gdt中创建tss并重新加载gdt */
+/* 为当前 cpu 建立自己的 gdt, 在其中创建 tss 并加载 gdt */
 void tss_init() {
     put_str("tss_init start\n");
-    uint32_t tss_size = sizeof(tss);
-    memset(&tss, 0, tss_size);
-    tss.ss0 = SELECTOR_K_STACK;
-    tss.io_base = tss_size;  // 表示此 TSS 中并没有 IO 位图 
+    uint8_t cpu_id = this_cpu()->id;
+    struct tss* t = &tss[cpu_id];
+    struct gdt_desc* g = gdt[cpu_id];
+    uint32_t tss_size = sizeof(struct tss);
+    memset(t, 0, tss_size);
+    t->ss0 = SELECTOR_K_STACK;
+    t->io_base = tss_size;  // 表示此 TSS 中并没有 IO 位图 
+
+    /* 前 4 个描述符照抄 loader 在 0x900 处建立的 gdt, 选择子保持不变 */
+    memcpy(g, (void*)0xc0000900, LOADER_GDT_DESC_CNT * sizeof(struct gdt_desc));
 
-    /* gdt段基址为0x900,把tss放到第4个位置,也就是0x900+0x20的位置 */
+    /* 在gdt中添加dpl为0的TSS描述符, 放到第4个位置 */
+    g[4] = make_gdt_desc((uint32_t*)t, tss_size - 1, TSS_ATTR_LOW, TSS_ATTR_HIGH);
 
-    /* 在gdt中添加dpl为0的TSS描述符 */
-    *((struct gdt_desc*)0xc0000920) = make_gdt_desc((uint32_t*)&tss, tss_size - 1, TSS_ATTR_LOW, TSS_ATTR_HIGH);
+    /* sysenter 进入内核时使用的代码段和栈段, 与 loader 建立的内核段相同 */
+    g[5] = g[1];
+    g[6] = g[2];
 
     /* 在gdt中添加dpl为3的数据段和代码段描述符 */
-    *((struct gdt_desc*)0xc0000928) = make_gdt_desc((uint32_t*)0, 0xfffff, GDT_CODE_ATTR_LOW_DPL3, GDT_ATTR_HIGH);
-    *((struct gdt_desc*)0xc0000930) = make_gdt_desc((uint32_t*)0, 0xfffff, GDT_DATA_ATTR_LOW_DPL3, GDT_ATTR_HIGH);
+    g[7] = make_gdt_desc((uint32_t*)0, 0xfffff, GDT_CODE_ATTR_LOW_DPL3, GDT_ATTR_HIGH);
+    g[8] = make_gdt_desc((uint32_t*)0, 0xfffff, GDT_DATA_ATTR_LOW_DPL3, GDT_ATTR_HIGH);
     
     /* gdt 16位的limit 32位的段基址 */
-    uint64_t gdt_operand = ((8 * 7 - 1) | ((uint64_t)(uint32_t)0xc0000900 << 16));   // 7个描述符大小, 不可一步到位转为uint64_t
+    uint64_t gdt_operand = ((sizeof(gdt[0]) - 1) | ((uint64_t)(uint32_t)g << 16));   // 9个描述符大小, 不可一步到位转为uint64_t
     asm volatile ("lgdt %0" : : "m" (gdt_operand));
     asm volatile ("ltr %w0" : : "r" (SELECTOR_TSS));
+    sysenter_init(t);
     put_str("tss_init and ltr done\n");
 }
@@ -0,0 +1,300 @@
+#include "uring.h"
+#include "global.h"
+#include "debug.h"
+#include "interrupt.h"
+#include "memory.h"
+#include "string.h"
+#include "thread.h"
+#include "sync.h"
+#include "spinlock.h"
+#include "kernel/list.h"
+#include "fs.h"
+#include "wait_exit.h"
+
+#define URING_WORKERS 4             // 每个队列的工作线程数, 也就是最多能同时执行的操作数
+
+/* 内核中一个进程的队列, 挂在主线程的 uring 上 */
+struct uring_ctx {
+    struct uring* ring;             // 用户空间中的共享区
+    uint32_t pg_cnt;                // 共享区的页数
+    uint32_t sq_entries;
+    uint32_t cq_entries;
+    /* 共享区中这几项进程也能改, 内核只用自己的这份 */
+    struct uring_sqe* sqes;
+    struct uring_cqe* cqes;
+    uint32_t sq_mask;
+    uint32_t cq_mask;
+    struct spinlock lock;           // 保护以下各项
+    uint32_t sq_head;               // 下一个要取的提交项, 每次推进后抄到共享区
+    uint32_t sq_limit;              // uring_enter 时确认的提交项到此为止, 不含
+    uint32_t cq_tail;               // 下一个要填的完成项, 每次推进后抄到共享区
+    uint32_t running;               // 已取出还未完成的操作数, 它们在完成队列中各预留了一项
+    struct task_struct* workers[URING_WORKERS];  // 执行操作的工作线程
+    uint32_t nr_workers;
+    struct list idle_workers;       // 因无事可做或完成队列已满而阻塞的工作线程, 以 general_tag 链入
+    bool dying;                     // 队列正在撤销, 工作线程做完手头的操作就退出
+    struct list waiters;            // 在 uring_enter 中等待完成项的任务
+};
+
+/* 在 uring_enter 中等待的任务, 在等待者的内核栈上分配 */
+struct uring_waiter {
+    struct list_elem elem;
+    struct task_struct* task;
+    uint32_t min_complete;          // 完成队列中至少有这么多项时唤醒
+};
+
+/* 完成队列中尚未被进程收走的项数. cq_head 由进程写, 乱写时按队列已满处理 */
+static inline uint32_t cq_ready(struct uring_ctx* ctx) {
+    uint32_t ready = ctx->cq_tail - ctx->ring->cq_head;
+    return (ready > ctx->cq_entries ? ctx->cq_entries : ready);
+}
+
+/* 唤醒等到了足够完成项的任务, dying 时全部唤醒. 调用者持有 ctx->lock */
+static void wake_waiters(struct uring_ctx* ctx) {
+    uint32_t ready = cq_ready(ctx);
+    struct list_elem* elem = ctx->waiters.head.next;
+    while (elem != &ctx->waiters.tail) {
+        struct list_elem* next = elem->next;
+        struct uring_waiter* w = elem2entry(struct uring_waiter, elem, elem);
+        if (ctx->dying || ready >= w->min_complete) {
+            list_remove(elem);
+            thread_unblock(w->task);
+        }
+        elem = next;
+    }
+}
+
+/* 按可取的提交项数唤醒空闲的工作线程, dying 时全部唤醒. 调用者持有 ctx->lock */
+static void wake_workers(struct uring_ctx* ctx) {
+    uint32_t work = ctx->sq_limit - ctx->sq_head;
+    while ((ctx->dying || work > 0) && !list_empty(&ctx->idle_workers)) {
+        struct task_struct* worker = elem2entry(struct task_struct, general_tag, list_pop(&ctx->idle_workers));
+        thread_unblock(worker);
+        if (work > 0) {
+            work--;
+        }
+    }
+}
+
+/* 执行一个提交项, 返回值与相应的同步系统调用相同.
+   与经 int 0x80 进入的系统调用一样在关中断下执行, 需要等待时照常睡眠 */
+static int32_t uring_execute(const struct uring_sqe* sqe) {
+    int32_t res = -1;
+    enum intr_status old_status = intr_disable();
+    switch (sqe->opcode) {
+        case URING_OP_NOP:
+            res = 0;
+            break;
+        case URING_OP_READ:
+            res = sys_read(sqe->fd, sqe->addr, sqe->len);
+            break;
+        case URING_OP_WRITE:
+            res = sys_write(sqe->fd, sqe->addr, sqe->len);
+            break;
+        case URING_OP_OPEN:
+            res = sys_open(sqe->addr, sqe->open_flags);
+            break;
+        case URING_OP_CLOSE:
+            res = sys_close(sqe->fd);
+            break;
+        case URING_OP_STAT:
+            res = sys_stat(sqe->addr, sqe->addr2);
+            break;
+    }
+    intr_set_status(old_status);
+    return res;
+}
+
+/* 工作线程: 每次按提交顺序取一项执行, 完成后填写完成项. 几个工作线程同时执行各自取到的操作,
+   一个慢操作只占住一个线程, 所以完成的顺序可能与提交的顺序不同.
+   它们与进程的线程同属一个线程组, 共用进程的页表和文件描述符表, 所以能直接访问用户缓冲区和进程打开的文件 */
+static void uring_worker(void* arg) {
+    struct uring_ctx* ctx = arg;
+    struct uring* ring = ctx->ring;
+    struct task_struct* cur = running_thread();
+    while (1) {
+        enum intr_status old_status = spin_lock_irqsave(&ctx->lock);
+        /* 完成队列中要给每个正在执行的操作留一项, 没有空位时不再取提交项,
+           等进程收走一些完成项后在 uring_enter 中唤醒 */
+        while (!ctx->dying &&
+               (ctx->sq_head == ctx->sq_limit || cq_ready(ctx) + ctx->running >= ctx->cq_entries)) {
+            list_append(&ctx->idle_workers, &cur->general_tag);
+            cur->status = TASK_BLOCKED;
+            spin_unlock(&ctx->lock);
+            schedule();
+            spin_lock(&ctx->lock);
+        }
+        if (ctx->dying) {
+            spin_unlock_irqrestore(&ctx->lock, old_status);
+            break;
+        }
+        /* 先复制出来再推进 sq_head, 此后进程就可以重用这个提交项 */
+        struct uring_sqe sqe = ctx->sqes[ctx->sq_head & ctx->sq_mask];
+        ring->sq_head = ++ctx->sq_head;
+        ctx->running++;
+        spin_unlock_irqrestore(&ctx->lock, old_status);
+
+        int32_t res = uring_execute(&sqe);
+
+        old_status = spin_lock_irqsave(&ctx->lock);
+        struct uring_cqe* cqe = &ctx->cqes[ctx->cq_tail & ctx->cq_mask];
+        cqe->user_data = sqe.user_data;
+        cqe->res = res;
+        asm volatile ("" : : : "memory");  // 完成项写好之后进程才能看到新的 cq_tail
+        ring->cq_tail = ++ctx->cq_tail;
+        ctx->running--;
+        wake_waiters(ctx);
+        spin_unlock_irqrestore(&ctx->lock, old_status);
+    }
+    sys_thread_exit(NULL);
+}
+
+/* 为当前进程建立提交队列项数为 entries 的异步队列, entries 向上取为 2 的幂.
+   返回用户空间中的共享区, 进程只能建立一个, 失败返回 NULL */
+struct uring* sys_uring_setup(uint32_t entries) {
+    struct task_struct* cur = running_thread();
+    struct task_struct* leader = cur->group_leader;
+    if (cur->pgdir == NULL || leader->uring != NULL || entries == 0 || entries > URING_MAX_ENTRIES) {
+        return NULL;
+    }
+    uint32_t sq_entries = 1;
+    while (sq_entries < entries) {
+        sq_entries <<= 1;
+    }
+    uint32_t cq_entries = sq_entries * 2;
+    uint32_t size = sizeof(struct uring) + sq_entries * sizeof(struct uring_sqe) + cq_entries * sizeof(struct uring_cqe);
+    uint32_t pg_cnt = DIV_ROUND_UP(size, PG_SIZE);
+
+    struct uring_ctx* ctx = get_kernel_pages(1);
+    if (ctx == NULL) {
+        return NULL;
+    }
+    struct uring* ring = get_user_pages(pg_cnt);
+    if (ring == NULL) {
+        mfree_page(PF_KERNEL, ctx, 1);
+        return NULL;
+    }
+    /* 内存不够时少建几个工作线程, 一个都建不了才失败 */
+    ctx->nr_workers = 0;
+    while (ctx->nr_workers < URING_WORKERS) {
+        struct task_struct* worker = alloc_task_struct();
+        if (worker == NULL) {
+            break;
+        }
+        ctx->workers[ctx->nr_workers++] = worker;
+    }
+    if (ctx->nr_workers == 0) {
+        free_user_pages(ring, pg_cnt);
+        mfree_page(PF_KERNEL, ctx, 1);
+        return NULL;
+    }
+
+    ctx->ring = ring;
+    ctx->pg_cnt = pg_cnt;
+    ctx->sq_entries = sq_entries;
+    ctx->cq_entries = cq_entries;
+    ctx->sq_mask = sq_entries - 1;
+    ctx->cq_mask = cq_entries - 1;
+    ctx->sqes = (struct uring_sqe*)(ring + 1);
+    ctx->cqes = (struct uring_cqe*)(ctx->sqes + sq_entries);
+    ctx->sq_head = ctx->sq_limit = ctx->cq_tail = 0;
+    ctx->running = 0;
+    ring->sq_head = ring->sq_tail = ring->cq_head = ring->cq_tail = 0;
+    ring->sq_mask = ctx->sq_mask;
+    ring->cq_mask = ctx->cq_mask;
+    ring->sqes = ctx->sqes;
+    ring->cqes = ctx->cqes;
+    spin_lock_init(&ctx->lock);
+    list_init(&ctx->idle_workers);
+    ctx->dying = false;
+    list_init(&ctx->waiters);
+
+    /* 工作线程是运行在内核态的线程, 但借用进程的页表, 并以进程主线程为 group_leader 共用文件描述符表 */
+    uint32_t idx;
+    for (idx = 0; idx < ctx->nr_workers; idx++) {
+        struct task_struct* worker = ctx->workers[idx];
+        init_thread(worker, "uring", leader->normal_prio);
+        thread_create(worker, uring_worker, ctx);
+        worker->pgdir = leader->pgdir;
+        worker->group_leader = leader;
+        worker->cwd_inode_nr = cur->cwd_inode_nr;
+    }
+
+    lock_acquire(&thread_all_lock);
+    leader->uring = ctx;
+    leader->nr_threads += ctx->nr_workers;
+    for (idx = 0; idx < ctx->nr_workers; idx++) {
+        thread_link(ctx->workers[idx]);
+    }
+    lock_release(&thread_all_lock);
+    for (idx = 0; idx < ctx->nr_workers; idx++) {
+        sched_enqueue(ctx->workers[idx]);
+    }
+    return ring;
+}
+
+/* 通知内核有新的提交项, 并等到完成队列中至少有 min_complete 项.
+   提交的是此刻 sq_tail 之前的各项, sq_tail 比 sq_head 超前多于队列项数时只认前 sq_entries 项,
+   以免乱写的 sq_tail 使内核重复执行旧的提交项. 提交了多少项以 sq_tail 为准, to_submit 不再使用.
+   返回完成队列中可收取的项数, 进程没有建立队列时返回 -1 */
+int32_t sys_uring_enter(uint32_t to_submit UNUSED, uint32_t min_complete) {
+    struct task_struct* cur = running_thread();
+    struct uring_ctx* ctx = cur->group_leader->uring;
+    if (ctx == NULL) {
+        return -1;
+    }
+    if (min_complete > ctx->cq_entries) {
+        min_complete = ctx->cq_entries;
+    }
+
+    enum intr_status old_status = spin_lock_irqsave(&ctx->lock);
+    uint32_t pending = ctx->ring->sq_tail - ctx->sq_head;
+    if (pending > ctx->sq_entries) {
+        pending = ctx->sq_entries;
+    }
+    ctx->sq_limit = ctx->sq_head + pending;
+    /* 有新提交项, 或进程收走了完成项使满了的完成队列又有空位, 都要唤醒工作线程 */
+    wake_workers(ctx);
+    while (!ctx->dying && cq_ready(ctx) < min_complete) {
+        struct uring_waiter w;
+        w.task = cur;
+        w.min_complete = min_complete;
+        list_append(&ctx->waiters, &w.elem);
+        cur->status = TASK_BLOCKED;
+        spin_unlock(&ctx->lock);
+        schedule();
+        spin_lock(&ctx->lock);
+    }
+    int32_t ready = cq_ready(ctx);
+    spin_unlock_irqrestore(&ctx->lock, old_status);
+    return ready;
+}
+
+/* 进程 leader 的异步队列的工作线程数, 没有建立队列时为 0 */
+uint32_t uring_nr_workers(struct task_struct* leader) {
+    return (leader->uring != NULL ? leader->uring->nr_workers : 0);
+}
+
+/* 撤销进程 leader 的异步队列, 由主线程在 exit 或 execv 时调用, 此时进程中已没有其他用户线程.
+   等各工作线程做完手头的操作并退出后回收它们, 尚未取走的提交项被丢弃 */
+void uring_release(struct task_struct* leader) {
+    struct uring_ctx* ctx = leader->uring;
+    if (ctx == NULL) {
+        return;
+    }
+    ASSERT(running_thread() == leader);
+
+    enum intr_status old_status = spin_lock_irqsave(&ctx->lock);
+    ctx->dying = true;
+    wake_workers(ctx);
+    wake_waiters(ctx);
+    spin_unlock_irqrestore(&ctx->lock, old_status);
+
+    uint32_t idx;
+    for (idx = 0; idx < ctx->nr_workers; idx++) {
+        sys_thread_join(ctx->workers[idx]->pid, NULL);
+    }
+    leader->uring = NULL;
+    free_user_pages(ctx->ring, ctx->pg_cnt);
+    mfree_page(PF_KERNEL, ctx, 1);
+}
@@ -0,0 +1,62 @@
+#ifndef __USERPROG_URING_H
+#define __USERPROG_URING_H
+
+#include "stdint.h"
+#include "global.h"
+
+#define URING_MAX_ENTRIES 128       // 提交队列最多的项数, 完成队列是它的 2 倍
+
+/* 批量异步系统调用: 进程用 uring_setup 建立一对与内核共享的环形队列, 把操作填入提交队列(SQ),
+   再用一次 uring_enter 交给内核. 内核中属于该进程的几个工作线程同时执行这些操作, 把结果放进完成队列(CQ),
+   进程可以一边做别的事, 一边成批地收取结果. 操作不保证按提交的顺序执行和完成,
+   有依赖的操作(如对同一个 fd 先写后关)要等前一个完成后再提交 */
+enum uring_op {
+    URING_OP_NOP,    // 空操作, 结果为 0
+    URING_OP_READ,   // read(fd, addr, len)
+    URING_OP_WRITE,  // write(fd, addr, len)
+    URING_OP_OPEN,   // open(addr, open_flags)
+    URING_OP_CLOSE,  // close(fd)
+    URING_OP_STAT    // stat(addr, addr2)
+};
+
+/* 提交队列项, 描述一个要执行的操作 */
+struct uring_sqe {
+    uint8_t opcode;         // 取值见 enum uring_op
+    uint8_t open_flags;     // URING_OP_OPEN 的打开标志
+    uint16_t pad;
+    int32_t fd;
+    void* addr;             // 读写的缓冲区, 或 open、stat 的路径
+    uint32_t len;           // 读写的字节数
+    void* addr2;            // stat 的结果缓冲区
+    uint32_t user_data;     // 原样带回完成队列项, 供进程认出是哪个操作
+};
+
+/* 完成队列项 */
+struct uring_cqe {
+    uint32_t user_data;
+    int32_t res;            // 操作的返回值, 与同步系统调用的返回值相同
+};
+
+/* 与内核共享的队列头, 位于进程的用户空间, 其后紧跟 sqes 和 cqes 两个数组.
+   下标都是单调递增的计数, 与 mask 相与得到数组中的位置. 进程只写 sq_tail 和 cq_head, 内核只写 sq_head 和 cq_tail.
+   进程可以随意改写这一页, 所以内核只从中读 sq_tail 和 cq_head, 其余各项由内核自己另存一份,
+   这里的 mask 和数组指针只是建立时告诉进程的 */
+struct uring {
+    volatile uint32_t sq_head;  // 内核下一个要取的提交项
+    volatile uint32_t sq_tail;  // 进程下一个要填的提交项
+    volatile uint32_t cq_head;  // 进程下一个要收的完成项
+    volatile uint32_t cq_tail;  // 内核下一个要填的完成项
+    uint32_t sq_mask;           // 提交队列项数减 1
+    uint32_t cq_mask;           // 完成队列项数减 1
+    struct uring_sqe* sqes;
+    struct uring_cqe* cqes;
+};
+
+struct task_struct;
+
+struct uring* sys_uring_setup(uint32_t entries);
+int32_t sys_uring_enter(uint32_t to_submit, uint32_t min_complete);
+uint32_t uring_nr_workers(struct task_struct* leader);
+void uring_release(struct task_struct* leader);
+
+#endif
@@ -0,0 +1,68 @@
+#include "vdso.h"
+#include "global.h"
+#include "debug.h"
+#include "memory.h"
+#include "thread.h"
+#include "process.h"
+#include "timer.h"
+#include "kernel/print.h"
+
+static struct vdso_data* vdso_data;  // 时间页在内核中的地址, 初始化之前为 NULL
+
+/* 时钟中断更新 ticks 后调用, 把它同步到时间页 */
+void vdso_update(void) {
+    if (vdso_data != NULL) {
+        vdso_data->ticks = ticks;
+    }
+}
+
+/* 为进程 pthread 分配进程页, 并把时间页和进程页映射进它的地址空间.
+   pthread 是主线程, 可以不是当前任务. 成功返回 0, 失败返回 -1 */
+int32_t vdso_map(struct task_struct* pthread) {
+    ASSERT(pthread->pgdir != NULL && pthread == pthread->group_leader);
+    struct vdso_proc* proc = get_kernel_pages(1);
+    if (proc == NULL) {
+        return -1;
+    }
+    proc->pid = pthread->pid;
+    proc->threaded = 0;
+    pthread->vdso = proc;
+
+    /* 映射要装在 pthread 的页表中 */
+    struct task_struct* cur = running_thread();
+    page_dir_activate(pthread);
+    page_map_user_ro(VDSO_DATA_VADDR, addr_v2p((uint32_t)vdso_data));
+    page_map_user_ro(VDSO_PROC_VADDR, addr_v2p((uint32_t)proc));
+    page_dir_activate(cur);
+    return 0;
+}
+
+/* 进程退出前在它自己的地址空间中调用. 撤掉两页的映射, 回收页表时就不会把时间页当作进程的页释放 */
+void vdso_release(struct task_struct* pthread) {
+    ASSERT(running_thread()->group_leader == pthread);
+    if (pthread->vdso == NULL) {
+        return;
+    }
+    *pte_ptr(VDSO_DATA_VADDR) = 0;
+    *pte_ptr(VDSO_PROC_VADDR) = 0;
+    asm volatile ("invlpg %0" : : "m" (*(uint8_t*)VDSO_DATA_VADDR) : "memory");
+    asm volatile ("invlpg %0" : : "m" (*(uint8_t*)VDSO_PROC_VADDR) : "memory");
+    mfree_page(PF_KERNEL, pthread->vdso, 1);
+    pthread->vdso = NULL;
+}
+
+/* 分配时间页并填入时钟参数, 需在 timer_init 之后、创建第一个用户进程之前调用 */
+void vdso_init(void) {
+    put_str("vdso_init start\n");
+    vdso_data = get_kernel_pages(1);
+    if (vdso_data == NULL) {
+        PANIC("vdso_init: no memory\n");
+    }
+    vdso_data->hz = HZ;
+    vdso_data->tsc_khz = tsc_khz;
+    vdso_data->tsc_mult = tsc_mult;
+    vdso_data->tsc_shift = TSC_SHIFT;
+    vdso_data->tsc_base = tsc_base;
+    vdso_data->ticks = ticks;
+    put_str("vdso_init done\n");
+}
@@ -0,0 +1,35 @@
+#ifndef __USERPROG_VDSO_H
+#define __USERPROG_VDSO_H
+
+#include "stdint.h"
+#include "global.h"
+
+/* 内核只读地映射进每个进程的两页, 位于用户程序起始地址 0x8048000 之下, 不在用户虚拟地址池中.
+   lib/user 直接读这里的值, getpid、clock_gettime 等不必陷入内核 */
+#define VDSO_DATA_VADDR 0x08000000                // 所有进程共享的时间页
+#define VDSO_PROC_VADDR (VDSO_DATA_VADDR + 0x1000)  // 每个进程自己的一页
+
+/* 时间页, 时钟中断中更新 ticks, 其余各项在启动时填好后不再改变 */
+struct vdso_data {
+    volatile uint32_t ticks;   // 与内核的 ticks 相同
+    uint32_t hz;               // 每秒的嘀嗒数
+    uint32_t tsc_khz;          // 为 0 表示没有 TSC, 只能以嘀嗒计时
+    uint32_t tsc_mult;         // 纳秒数 = 周期数 * tsc_mult >> tsc_shift
+    uint32_t tsc_shift;
+    uint64_t tsc_base;         // 单调时钟零点的 TSC 值
+};
+
+/* 进程页 */
+struct vdso_proc {
+    int16_t pid;               // 主线程的 pid
+    volatile uint8_t threaded; // 进程 clone 过线程, 各线程的 pid 不同, getpid 须走系统调用
+};
+
+struct task_struct;
+
+void vdso_init(void);
+void vdso_update(void);
+int32_t vdso_map(struct task_struct* pthread);
+void vdso_release(struct task_struct* pthread);
+
+#endif
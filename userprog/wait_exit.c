@@ -9,6 +9,12 @@
 #include "fs.h"
 #include "file.h"
 #include "pipe.h"
+#include "sync.h"
+#include "interrupt.h"
+#include "fork.h"
+#include "uring.h"
+#include "vdso.h"
+#include "scstat.h"
 
 /* 释放用户进程资源: 
  * 1 页表中对应的物理页
@@ -28,6 +34,9 @@ static void release_prog_resource(struct task_struct *release_thread)
     uint32_t *first_pte_vaddr_in_pde = NULL; // 用来记录pde中第0个pte的地址
     uint32_t pg_phy_addr = 0;
 
+    /* 时间页为所有进程共享, 先撤掉映射, 免得下面把它当作进程的页释放 */
+    vdso_release(release_thread);
+
     /* 回收页表中用户空间的页框 */
     while (pde_idx < user_pde_nr)
     {
@@ -79,41 +88,69 @@ static void release_prog_resource(struct task_struct *release_thread)
     }
 }
 
-/* list_traversal的回调函数,
- * 查找pelem的parent_pid是否是ppid,成功返回true,失败则返回false */
-static bool find_child(struct list_elem *pelem, int32_t ppid)
+/* 在进程leader的子进程中查找状态为TASK_HANGING的任务, 没有则返回NULL.
+ * 调用者持有thread_all_lock */
+static struct task_struct *find_hanging_child(struct task_struct *leader)
 {
-    /* elem2entry中间的参数all_list_tag取决于pelem对应的变量名 */
-    struct task_struct *pthread = elem2entry(struct task_struct, all_list_tag, pelem);
-    if (pthread->parent_pid == ppid)
-    {                // 若该任务的parent_pid为ppid,返回
-        return true; // list_traversal只有在回调函数返回true时才会停止继续遍历,所以在此返回true
+    struct list_elem *elem = leader->children.head.next;
+    while (elem != &leader->children.tail)
+    {
+        struct task_struct *pthread = elem2entry(struct task_struct, sibling_tag, elem);
+        if (pthread->status == TASK_HANGING)
+        {
+            return pthread;
+        }
+        elem = elem->next;
     }
-    return false; // 让list_traversal继续传递下一个元素
+    return NULL;
 }
 
-/* list_traversal的回调函数,
- * 查找状态为TASK_HANGING的任务 */
-static bool find_hanging_child(struct list_elem *pelem, int32_t ppid)
+/* 将进程parent的所有子进程过继给init, 调用者持有thread_all_lock */
+static void init_adopt_children(struct task_struct *parent)
 {
-    struct task_struct *pthread = elem2entry(struct task_struct, all_list_tag, pelem);
-    if (pthread->parent_pid == ppid && pthread->status == TASK_HANGING)
+    struct task_struct *init_proc = pid2thread(1);
+    while (!list_empty(&parent->children))
     {
-        return true;
+        struct list_elem *elem = list_pop(&parent->children);
+        struct task_struct *pthread = elem2entry(struct task_struct, sibling_tag, elem);
+        pthread->parent_pid = 1;
+        list_append(&init_proc->children, elem);
     }
-    return false;
 }
 
-/* list_traversal的回调函数,
- * 将一个子进程过继给init */
-static bool init_adopt_a_child(struct list_elem *pelem, int32_t pid)
+/* 唤醒进程leader中因wait或join而等待的线程, 它们醒来后会重新检查自己等的条件 */
+static void wake_group_waiter(struct task_struct *leader)
 {
-    struct task_struct *pthread = elem2entry(struct task_struct, all_list_tag, pelem);
-    if (pthread->parent_pid == pid)
-    { // 若该进程的parent_pid为pid,返回
-        pthread->parent_pid = 1;
+    if (leader->status == TASK_WAITING)
+    {
+        thread_unblock(leader);
+    }
+    struct list_elem *elem = leader->threads.head.next;
+    while (elem != &leader->threads.tail)
+    {
+        struct task_struct *pthread = elem2entry(struct task_struct, thread_tag, elem);
+        if (pthread->status == TASK_WAITING)
+        {
+            thread_unblock(pthread);
+        }
+        elem = elem->next;
+    }
+}
+
+/* 查找进程leader中已退出而未被join的线程 */
+static struct task_struct *find_group_zombie(struct task_struct *leader)
+{
+    struct list_elem *elem = leader->threads.head.next;
+    while (elem != &leader->threads.tail)
+    {
+        struct task_struct *pthread = elem2entry(struct task_struct, thread_tag, elem);
+        if (pthread->status == TASK_HANGING)
+        {
+            return pthread;
+        }
+        elem = elem->next;
     }
-    return false; // 让list_traversal继续传递下一个元素
+    return NULL;
 }
 
 /* 等待子进程调用exit,将子进程的退出状态保存到status指向的变量.
@@ -121,19 +158,23 @@ static bool init_adopt_a_child(struct list_elem *pelem, int32_t pid)
 pid_t sys_wait(int32_t *status)
 {
     struct task_struct *parent_thread = running_thread();
+    /* 子进程属于进程而不是某个线程, 挂在主线程的children上 */
+    struct task_struct *leader = parent_thread->group_leader;
 
     while (1)
     {
+        /* 持 thread_all_lock 查找子进程, 子进程在 sys_exit 中也要持这把锁才能唤醒父进程 */
+        lock_acquire(&thread_all_lock);
         /* 优先处理已经是挂起状态的任务 */
-        struct list_elem *child_elem = list_traversal(&thread_all_list, find_hanging_child, parent_thread->pid);
+        struct task_struct *child_thread = find_hanging_child(leader);
         /* 若有挂起的子进程 */
-        if (child_elem != NULL)
+        if (child_thread != NULL)
         {
-            struct task_struct *child_thread = elem2entry(struct task_struct, all_list_tag, child_elem);
             *status = child_thread->exit_status;
 
             /* thread_exit之后,pcb会被回收,因此提前获取pid */
             uint16_t child_pid = child_thread->pid;
+            lock_release(&thread_all_lock);
 
             /* 2 从就绪队列和全部队列中删除进程表项*/
             thread_exit(child_thread, false); // 传入false,使thread_exit调用后回到此处
@@ -143,42 +184,150 @@ pid_t sys_wait(int32_t *status)
         }
 
         /* 判断是否有子进程 */
-        child_elem = list_traversal(&thread_all_list, find_child, parent_thread->pid);
-        if (child_elem == NULL)
+        if (list_empty(&leader->children))
         { // 若没有子进程则出错返回
+            lock_release(&thread_all_lock);
             return -1;
         }
         else
         {
-            /* 若子进程还未运行完,即还未调用exit,则将自己挂起,直到子进程在执行exit时将自己唤醒 */
-            thread_block(TASK_WAITING);
+            /* 若子进程还未运行完,即还未调用exit,则将自己挂起,直到子进程在执行exit时将自己唤醒.
+             * 须在放锁前置为 TASK_WAITING, 否则子进程可能在放锁之后、挂起之前退出而看不到父进程在等 */
+            enum intr_status old_status = intr_disable();
+            parent_thread->status = TASK_WAITING;
+            lock_release(&thread_all_lock);
+            schedule();
+            intr_set_status(old_status);
         }
     }
 }
 
-/* 子进程用来结束自己时调用 */
+/* 子进程用来结束自己时调用. 由clone出的线程调用时只结束该线程,
+ * 由主线程调用时先等进程中其余线程都结束, 再结束整个进程 */
 void sys_exit(int32_t status)
 {
     struct task_struct *child_thread = running_thread();
+    if (child_thread != child_thread->group_leader)
+    {
+        sys_thread_exit((void *)status);
+    }
     child_thread->exit_status = status;
     if (child_thread->parent_pid == -1)
     {
         PANIC("sys_exit: child_thread->parent_pid is -1\n");
     }
 
-    /* 将进程child_thread的所有子进程都过继给init */
-    list_traversal(&thread_all_list, init_adopt_a_child, child_thread->pid);
+    lock_acquire(&thread_all_lock);
+    /* 其余线程还在使用地址空间和文件, 等它们都退出. 异步队列的工作线程最后由 uring_release 回收 */
+    while (child_thread->nr_threads > 1 + uring_nr_workers(child_thread))
+    {
+        enum intr_status old_status = intr_disable();
+        child_thread->status = TASK_WAITING;
+        lock_release(&thread_all_lock);
+        schedule();
+        intr_set_status(old_status);
+        lock_acquire(&thread_all_lock);
+    }
+    /* 回收没有被join的线程 */
+    struct task_struct *zombie;
+    while ((zombie = find_group_zombie(child_thread)) != NULL)
+    {
+        thread_exit(zombie, false);
+    }
+    lock_release(&thread_all_lock);
+    uring_release(child_thread);
+    scstat_exit(child_thread);
 
     /* 回收进程child_thread的资源 */
     release_prog_resource(child_thread);
 
-    /* 如果父进程正在等待子进程退出,将父进程唤醒 */
+    lock_acquire(&thread_all_lock);
+    /* 将进程child_thread的所有子进程都过继给init */
+    init_adopt_children(child_thread);
+
+    /* 将自己挂起,等待父进程获取其status,并回收其pcb.
+     * 放锁前就置为 TASK_HANGING, 父进程一拿到锁就能看到并回收, 回收时会等本 cpu 换下自己 */
+    enum intr_status old_status = intr_disable();
+    child_thread->status = TASK_HANGING;
+
+    /* 如果父进程中有线程正在等待子进程退出,将其唤醒 */
     struct task_struct *parent_thread = pid2thread(child_thread->parent_pid);
-    if (parent_thread->status == TASK_WAITING)
+    wake_group_waiter(parent_thread);
+    lock_release(&thread_all_lock);
+    schedule();
+    intr_set_status(old_status);
+}
+
+/* clone出的线程结束自己, retval留给join它的线程. 主线程调用时相当于exit */
+void sys_thread_exit(void *retval)
+{
+    struct task_struct *cur = running_thread();
+    struct task_struct *leader = cur->group_leader;
+    if (cur == leader)
     {
-        thread_unblock(parent_thread);
+        sys_exit((int32_t)retval);
     }
 
-    /* 将自己挂起,等待父进程获取其status,并回收其pcb */
-    thread_block(TASK_HANGING);
+    scstat_exit(cur);
+
+    /* 用户栈属于进程的地址空间, 在还能访问它时由自己释放. 异步队列的工作线程没有用户栈 */
+    if (cur->ustack != NULL)
+    {
+        free_user_pages(cur->ustack, THREAD_USTACK_PAGES);
+        cur->ustack = NULL;
+    }
+
+    lock_acquire(&thread_all_lock);
+    /* 线程fork出的子进程属于进程, 这里只是以防万一 */
+    init_adopt_children(cur);
+
+    /* 挂起自己, 等join它的线程或主线程退出时回收pcb */
+    enum intr_status old_status = intr_disable();
+    cur->thread_retval = retval;
+    cur->status = TASK_HANGING;
+    leader->nr_threads--;
+
+    /* 唤醒join自己的线程和等其余线程结束的主线程, 它们醒来后会重新检查 */
+    wake_group_waiter(leader);
+    lock_release(&thread_all_lock);
+    schedule();
+    intr_set_status(old_status);
+    PANIC("sys_thread_exit: should not be here\n");
+}
+
+/* 等待本进程中id为tid的线程结束, 将其返回值存入*retval并回收它.
+ * 成功返回0, tid不是本进程的其他线程或已有别的线程在join它时返回-1 */
+int32_t sys_thread_join(pid_t tid, void **retval)
+{
+    struct task_struct *cur = running_thread();
+    lock_acquire(&thread_all_lock);
+    while (1)
+    {
+        struct task_struct *pthread = pid2thread(tid);
+        if (pthread == NULL || pthread == cur || pthread == pthread->group_leader ||
+            pthread->group_leader != cur->group_leader ||
+            (pthread->joiner != NULL && pthread->joiner != cur))
+        {
+            lock_release(&thread_all_lock);
+            return -1;
+        }
+        pthread->joiner = cur;  // 占住此线程, 其他线程不能再join它
+        if (pthread->status == TASK_HANGING)
+        {
+            if (retval != NULL)
+            {
+                *retval = pthread->thread_retval;
+            }
+            thread_exit(pthread, false);
+            lock_release(&thread_all_lock);
+            return 0;
+        }
+
+        enum intr_status old_status = intr_disable();
+        cur->status = TASK_WAITING;
+        lock_release(&thread_all_lock);
+        schedule();
+        intr_set_status(old_status);
+        lock_acquire(&thread_all_lock);
+    }
 }
@@ -5,5 +5,7 @@
 
 pid_t sys_wait(int32_t* status);
 void sys_exit(int32_t status);
+void sys_thread_exit(void* retval);
+int32_t sys_thread_join(pid_t tid, void** retval);
 
 #endif 